@@ -0,0 +1,775 @@
+/*
+** i2c_sim - the boot config's I2C traffic on a simulated bus, to find the highest daq rate it
+can sustain before flashing. the firmware's own driver code (nubaja_i2c.h, the AD7998, LSM6DSM
+and AS1115 drivers, config_load) is built against a host stand-in for the ESP-IDF I2C driver
+(sim/driver/i2c.h). every command link is played against register models of the three parts
+and timed: start, stop and 9 scl periods a byte, the pull-up rise time added to each period,
+a fixed driver cost per transaction and an interrupt each time the driver reloads the
+controller's command registers. the bus lock is taken with the firmware's timeout,
+I2C_TASK_LENGTH rounded down to FreeRTOS ticks, so a read that finds the bus taken by another
+task fails the way it does on the car.
+
+daq_task reads the ADC at the daq rate, brake_sync_task reads the brake current alone once a
+PWM period with brake_sync on, the burst sampler reads it at 1 kHz when burst_channels has ADC
+channels, aux_bus_task reads the IMU and writes the display at AUX_BUS_HZ. a rate is
+feasible when every daq, brake and burst read succeeds, returns the values the ADC converted, and
+finishes (plus -cpu) inside its period.
+
+build:  gcc -O2 -Isim -I../main -o i2c_sim i2c_sim.c -lm
+usage:  i2c_sim [options] [config.txt]
+  -r     daq rate to check, Hz (default DAQ_TIMER_HZ). exits 1 if it is not feasible
+  -t     simulated seconds per rate (default 1)
+  -tick  FreeRTOS tick rate, Hz (default 100, the ESP-IDF default)
+  -cpu   rest of the daq tick after the ADC read, us (default 0)
+  -rise  pull-up rise time added to every scl period, ns (default 100)
+  -drv   driver cost per transaction, us (default 50)
+  -isr   cost of each command register reload, us (default 5)
+the driver costs are estimates: compare the "us avg" of i2c_stats with what the board prints
+at the end of a run and adjust -drv. with no config file the firmware defaults are used.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "driver/i2c.h"
+#include "esp_timer.h"
+
+// firmware messages go through sim_log, so a few thousand failed reads stay quiet
+static int sim_quiet = 0;
+static int sim_log(const char *fmt, ...)
+{
+  va_list ap;
+  int n = 0;
+  if (!sim_quiet)
+  {
+    va_start(ap, fmt);
+    n = vprintf(fmt, ap);
+    va_end(ap);
+  }
+  return n;
+}
+
+// the timeline trace (nubaja_trace.h) reads the target's cycle counter, its hooks compile
+// away here
+#define NUBAJA_TRACE_H_
+#define trace_begin(id, arg)
+#define trace_end(id, arg)
+
+#define printf sim_log
+#include "nubaja_proj_vars.h"
+#include "nubaja_config.h"
+#include "nubaja_lsm6dsm.h"
+#include "nubaja_as1115.h"
+#undef printf
+
+#define SIM_BURST_HZ      1000        // CAP_SAMPLE_HZ in nubaja_burst.h
+#define SIM_BRAKE_HZ      1000        // BRAKE_PWM_FREQUENCY in nubaja_pwm.h
+#define SIM_BRAKE_CH      5           // BRAKE_SYNC_CH in nubaja_brake.h
+#define SIM_MAX_OPS       64
+#define SIM_CMD_LOAD      14          // commands the driver loads per END interrupt
+#define SIM_MAX_DEVS      4
+#define SIM_PHASES        256         // most phase offsets tried per rate
+
+int sim_tick_hz = 100;
+static int64_t sim_now_ns = 0;
+
+typedef struct
+{
+  double rise_ns, drv_us, isr_us, cpu_us;
+} sim_timing_t;
+
+static sim_timing_t timing = { 100, 50, 5, 0 };
+
+int64_t esp_timer_get_time()
+{
+  return sim_now_ns / 1000;
+}
+
+/*
+** DEVICE MODELS - each answers at its address on one port. write returns 1 for an ACK
+*/
+
+typedef struct sim_dev sim_dev;
+struct sim_dev
+{
+  const char *name;
+  int port;
+  uint8_t addr, alt_addr;               // alt_addr 0xff = none
+  void (*start)(sim_dev *d, int read);  // after the address byte was acked
+  int (*write)(sim_dev *d, uint8_t b);
+  uint8_t (*read)(sim_dev *d);
+  int n;                                // bytes since the address byte
+  uint8_t ptr;
+};
+
+// AD7998: address pointer byte = command bits 7:4, register 3:0. a read of the result
+// register with command bits 0111 converts the configured channels in turn, 1xxx converts
+// channel xxx + 1 alone
+typedef struct
+{
+  sim_dev d;
+  uint16_t config;
+  uint16_t limit[12];
+  uint8_t cycle, alert;
+  uint16_t word;                        // result being shifted out
+  int seq;                              // next channel of the sequence
+  uint32_t conversions;
+  uint16_t last[AD7998_NUM_CH];         // last value converted per channel
+} ad7998_model;
+
+static uint16_t adc_signal(int ch, uint32_t k)
+{
+  return (uint16_t) ( ( ( ch + 1 ) * 450 + ( k % 97 ) ) & AD7998_BITMASK );
+}
+
+// writing the address pointer restarts the sequence, a repeated start doesn't
+static void adc_start(sim_dev *d, int read)
+{
+  d->n = 0;
+}
+
+static int adc_write(sim_dev *d, uint8_t b)
+{
+  ad7998_model *m = (ad7998_model *) d;
+  int reg = d->ptr & 0x0f, k = d->n++;
+  if (k == 0)
+  {
+    d->ptr = b;
+    m->seq = 0;
+    return 1;
+  }
+  if (reg == 0x2) m->config = ( k == 1 ) ? ( b << 8 ) : ( m->config | b );
+  else if (reg == 0x3) m->cycle = b;
+  else if (reg == 0x1) m->alert = 0;
+  else if (reg >= 0x4) m->limit[reg - 4] = ( k == 1 ) ? ( b << 8 ) : ( m->limit[reg - 4] | b );
+  return 1;
+}
+
+static uint8_t adc_read(sim_dev *d)
+{
+  ad7998_model *m = (ad7998_model *) d;
+  int reg = d->ptr & 0x0f, k = d->n++, ch, i;
+  uint8_t mask = ( ( m->config >> 4 ) & 0xff );
+
+  if (reg == 0x1) return m->alert;
+  if (reg == 0x3) return m->cycle;
+  if (reg == 0x2) return ( k & 1 ) ? ( m->config & 0xff ) : ( m->config >> 8 );
+  if (reg >= 0x4) return ( k & 1 ) ? ( m->limit[reg - 4] & 0xff ) : ( m->limit[reg - 4] >> 8 );
+  if ( ( k & 1 ) == 0 )
+  {
+    ch = -1;
+    if (d->ptr & 0x80)
+    {
+      ch = ( d->ptr >> 4 ) & 0x7;
+      m->last[ch] = adc_signal(ch, m->conversions++);
+      m->word = (uint16_t) ( ( ch << AD7998_CHID_SHIFT ) | m->last[ch] );
+    }
+    else if ( ( d->ptr >> 4 ) == 0x7 && mask != 0 )
+    {
+      for (i = 0; i < AD7998_NUM_CH && ch < 0; i++)
+      {
+        if (mask & ( 1 << ( ( m->seq + i ) % AD7998_NUM_CH ) )) ch = ( m->seq + i ) % AD7998_NUM_CH;
+      }
+      m->seq = ch + 1;
+      m->last[ch] = adc_signal(ch, m->conversions++);
+      m->word = (uint16_t) ( ( ch << AD7998_CHID_SHIFT ) | m->last[ch] );
+    }
+    return m->word >> 8;
+  }
+  return m->word & 0xff;
+}
+
+// LSM6DSM: 128 registers, auto increment (CTRL3_C IF_INC, set out of reset). the outputs
+// change on every read while an ODR is set
+typedef struct
+{
+  sim_dev d;
+  uint8_t reg[128];
+  uint32_t samples;
+  int16_t last[6];                      // gyro x y z, xl x y z of the last sample
+} lsm6dsm_model;
+
+static void imu_start(sim_dev *d, int read)
+{
+  lsm6dsm_model *m = (lsm6dsm_model *) d;
+  int i;
+  d->n = 0;
+  if (read && ( ( m->reg[CTRL1_XL] | m->reg[CTRL2_G] ) & 0xf0 ))
+  {
+    ++m->samples;
+    for (i = 0; i < 6; i++)
+    {
+      m->last[i] = (int16_t) ( ( i < 3 ? 1 : -1 ) * ( 1000 * ( i % 3 + 1 ) + (int) ( m->samples % 500 ) ) );
+      m->reg[OUTX_L_G + 2 * i] = (uint8_t) ( m->last[i] & 0xff );
+      m->reg[OUTX_L_G + 2 * i + 1] = (uint8_t) ( (uint16_t) m->last[i] >> 8 );
+    }
+  }
+}
+
+static int imu_write(sim_dev *d, uint8_t b)
+{
+  lsm6dsm_model *m = (lsm6dsm_model *) d;
+  if (d->n++ == 0)
+  {
+    d->ptr = b & 0x7f;
+    return 1;
+  }
+  m->reg[d->ptr] = b;
+  if (m->reg[0x12] & 0x04) d->ptr = ( d->ptr + 1 ) & 0x7f;
+  return 1;
+}
+
+static uint8_t imu_read(sim_dev *d)
+{
+  lsm6dsm_model *m = (lsm6dsm_model *) d;
+  uint8_t v = m->reg[d->ptr];
+  if (m->reg[0x12] & 0x04) d->ptr = ( d->ptr + 1 ) & 0x7f;
+  return v;
+}
+
+// AS1115: answers 0x00 out of reset, and AS1115_SLAVE_ADDR as well once self addressing
+// (0x2d) is on. init_as1115 writes to both, the datasheet isn't clear when the switch lands
+typedef struct
+{
+  sim_dev d;
+  uint8_t reg[0x30];
+} as1115_model;
+
+static void disp_start(sim_dev *d, int read)
+{
+  d->n = 0;
+}
+
+static int disp_write(sim_dev *d, uint8_t b)
+{
+  as1115_model *m = (as1115_model *) d;
+  if (d->n++ == 0)
+  {
+    d->ptr = b;
+    return d->ptr < sizeof(m->reg);
+  }
+  if (d->ptr >= sizeof(m->reg)) return 0;
+  m->reg[d->ptr] = b;
+  if (d->ptr == 0x2d && ( b & 1 )) d->alt_addr = AS1115_SLAVE_ADDR;
+  ++d->ptr;
+  return 1;
+}
+
+static uint8_t disp_read(sim_dev *d)
+{
+  as1115_model *m = (as1115_model *) d;
+  return ( d->ptr < sizeof(m->reg) ) ? m->reg[d->ptr++] : 0xff;
+}
+
+static ad7998_model adc_dev;
+static lsm6dsm_model imu_dev;
+static as1115_model disp_dev;
+
+/*
+** BUS - one per port: clock, devices, who holds it until when
+*/
+
+typedef struct
+{
+  uint32_t clk_hz;
+  sim_dev *dev[SIM_MAX_DEVS];
+  int n_dev;
+  int64_t busy_until_ns;
+  uint32_t lock_timeouts, nacks;
+} sim_bus_t;
+
+static sim_bus_t bus[I2C_NUM_MAX];
+
+// the last transaction, for the timing table
+typedef struct
+{
+  int starts, bytes, loads;
+  int64_t dur_ns;
+} sim_xfer_t;
+
+static sim_xfer_t last_xfer;
+
+enum { OP_START, OP_STOP, OP_WRITE, OP_READ };
+
+typedef struct
+{
+  int type;
+  uint8_t byte;
+  uint8_t *dst;
+  int ack;
+} sim_op;
+
+struct i2c_cmd_link
+{
+  sim_op op[SIM_MAX_OPS];
+  int n;
+};
+
+esp_err_t i2c_param_config(i2c_port_t port, const i2c_config_t *conf)
+{
+  bus[port].clk_hz = conf->master.clk_speed;
+  return ESP_OK;
+}
+
+esp_err_t i2c_driver_install(i2c_port_t port, int mode, int rx_buf, int tx_buf, int intr_flags)
+{
+  return ESP_OK;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create()
+{
+  return (i2c_cmd_handle_t) calloc(1, sizeof(struct i2c_cmd_link));
+}
+
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd)
+{
+  free(cmd);
+}
+
+static esp_err_t cmd_add(i2c_cmd_handle_t cmd, int type, uint8_t byte, uint8_t *dst, int ack)
+{
+  if (cmd->n == SIM_MAX_OPS) return ESP_FAIL;
+  cmd->op[cmd->n].type = type;
+  cmd->op[cmd->n].byte = byte;
+  cmd->op[cmd->n].dst = dst;
+  cmd->op[cmd->n].ack = ack;
+  ++cmd->n;
+  return ESP_OK;
+}
+
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd) { return cmd_add(cmd, OP_START, 0, NULL, 0); }
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd) { return cmd_add(cmd, OP_STOP, 0, NULL, 0); }
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd, uint8_t data, int ack_en)
+{
+  return cmd_add(cmd, OP_WRITE, data, NULL, ack_en);
+}
+esp_err_t i2c_master_read_byte(i2c_cmd_handle_t cmd, uint8_t *data, int ack)
+{
+  return cmd_add(cmd, OP_READ, 0, data, ack);
+}
+
+static sim_dev *bus_find(sim_bus_t *b, uint8_t addr)
+{
+  int i;
+  for (i = 0; i < b->n_dev; i++)
+  {
+    if (b->dev[i]->addr == addr || b->dev[i]->alt_addr == addr) return b->dev[i];
+  }
+  return NULL;
+}
+
+// take the bus lock like the driver, then play the link against the devices and time it.
+// a NACK with ack checking on ends the transaction there, as the controller does
+esp_err_t i2c_master_cmd_begin(i2c_port_t port, i2c_cmd_handle_t cmd, TickType_t ticks_to_wait)
+{
+  sim_bus_t *b = &bus[port];
+  double bit_ns, t_ns;
+  int64_t start = sim_now_ns, wait_ns = (int64_t) ticks_to_wait * 1000000000 / sim_tick_hz;
+  sim_dev *dev = NULL;
+  int i, addr_next = 0, ret = ESP_OK;
+
+  if (b->clk_hz == 0) return ESP_FAIL;
+  if (b->busy_until_ns > start)
+  {
+    if (b->busy_until_ns - start > wait_ns)
+    {
+      ++b->lock_timeouts;
+      sim_now_ns = start + wait_ns;
+      return ESP_ERR_TIMEOUT;
+    }
+    start = b->busy_until_ns;
+  }
+
+  memset(&last_xfer, 0, sizeof(last_xfer));
+  bit_ns = 1e9 / b->clk_hz + timing.rise_ns;
+  for (i = 0; i < cmd->n && ret == ESP_OK; i++)
+  {
+    sim_op *op = &cmd->op[i];
+    switch (op->type)
+    {
+      case OP_START:
+        ++last_xfer.starts;
+        addr_next = 1;
+        break;
+      case OP_WRITE:
+        ++last_xfer.bytes;
+        if (addr_next)
+        {
+          addr_next = 0;
+          dev = bus_find(b, op->byte >> 1);
+          if (dev != NULL) dev->start(dev, op->byte & 1);
+          else if (op->ack)
+          {
+            ++b->nacks;
+            ret = ESP_FAIL;
+          }
+        }
+        else if (dev != NULL && !dev->write(dev, op->byte) && op->ack)
+        {
+          ++b->nacks;
+          ret = ESP_FAIL;
+        }
+        break;
+      case OP_READ:
+        ++last_xfer.bytes;
+        *op->dst = ( dev != NULL ) ? dev->read(dev) : 0xff;
+        break;
+      default:
+        dev = NULL;
+        break;
+    }
+  }
+  last_xfer.loads = ( cmd->n + SIM_CMD_LOAD - 1 ) / SIM_CMD_LOAD;
+  t_ns = timing.drv_us * 1000 + ( last_xfer.loads - 1 ) * timing.isr_us * 1000 +
+         bit_ns * ( last_xfer.starts + 1 + 9 * last_xfer.bytes );
+  last_xfer.dur_ns = (int64_t) t_ns;
+  b->busy_until_ns = start + last_xfer.dur_ns;
+  sim_now_ns = b->busy_until_ns;
+  return ret;
+}
+
+/*
+** CLIENTS - the tasks that use the buses, each a list of driver calls done once a period
+*/
+
+static config_t cfg;
+static ad7998_chset_t chset;
+static AS1115 display;
+static LSM6DSM imu;
+
+typedef struct
+{
+  const char *name;
+  double hz;
+  int n_steps;
+  void (*step)(int k);
+  int daq;                        // the daq tick: -cpu is added to it
+  int64_t iter_ns, next_ns;
+  int k;
+  uint32_t iters, errors, overruns, mismatches;
+  int64_t worst_ns;
+} sim_client;
+
+// an ADC read whose values don't match what the model converted counts as a mismatch
+static int adc_mismatch;
+
+static void step_adc(int k)
+{
+  uint16_t adc[AD7998_NUM_CH] = { 0 };
+  int ch;
+  if (ad7998_read(cfg.adc_bus, ADC_SLAVE_ADDR, &chset, adc) != I2C_SUCCESS) return;
+  for (ch = 0; ch < AD7998_NUM_CH; ch++)
+  {
+    if ( ( chset.mask & ( 1 << ch ) ) && adc[ch] != adc_dev.last[ch] ) adc_mismatch = 1;
+  }
+}
+
+static void step_brake(int k)
+{
+  uint16_t v;
+  if (ad7998_read_one(cfg.adc_bus, ADC_SLAVE_ADDR, SIM_BRAKE_CH, &v) != I2C_SUCCESS) return;
+  if (v != adc_dev.last[SIM_BRAKE_CH - 1]) adc_mismatch = 1;
+}
+
+static void step_aux(int k)
+{
+  imu_sample_t s;
+  if (k == 0 && cfg.imu_bus != PORT_NONE)
+  {
+    imu_read_gyro_xl(&imu, &s.gyro_x, &s.gyro_y, &s.gyro_z, &s.xl_x, &s.xl_y, &s.xl_z);
+  }
+  if (k == 1 && cfg.display_bus != PORT_NONE)
+  {
+    display_number(&display, 1234, 2);
+  }
+}
+
+static uint32_t total_errors()
+{
+  return i2c_stats[0].errors + i2c_stats[1].errors;
+}
+
+static sim_client clients[4];
+static int n_clients;
+
+static void add_client(const char *name, double hz, int n_steps, void (*step)(int), int daq)
+{
+  sim_client *c = &clients[n_clients++];
+  memset(c, 0, sizeof(*c));
+  c->name = name;
+  c->hz = hz;
+  c->n_steps = n_steps;
+  c->step = step;
+  c->daq = daq;
+}
+
+static void reset_buses()
+{
+  int p;
+  for (p = 0; p < I2C_NUM_MAX; p++)
+  {
+    bus[p].busy_until_ns = 0;
+    bus[p].lock_timeouts = 0;
+    bus[p].nacks = 0;
+  }
+  sim_now_ns = 0;
+}
+
+// every client for secs of simulated time (at least 4 daq periods), in time order. the
+// daq timer starts at 0 and the other tasks phase_ns later
+static int run(double rate, double secs, int64_t phase_ns, int verbose)
+{
+  int i, feasible = 1;
+  uint32_t errors;
+  int64_t end_ns = (int64_t) ( fmax(secs, 4 / rate) * 1e9 ), period;
+
+  reset_buses();
+  i2c_stats_reset();
+  clients[0].hz = rate;
+  for (i = 0; i < n_clients; i++)
+  {
+    sim_client *c = &clients[i];
+    c->iter_ns = c->next_ns = i ? phase_ns + i * 1000 : 0;
+    c->k = 0;
+    c->iters = c->errors = c->overruns = c->mismatches = 0;
+    c->worst_ns = 0;
+  }
+
+  for (;;)
+  {
+    sim_client *c = &clients[0];
+    for (i = 1; i < n_clients; i++)
+    {
+      if (clients[i].next_ns < c->next_ns) c = &clients[i];
+    }
+    if (c->next_ns >= end_ns) break;
+
+    sim_now_ns = c->next_ns;
+    adc_mismatch = 0;
+    errors = total_errors();
+    c->step(c->k);
+    c->errors += total_errors() - errors;
+    c->mismatches += adc_mismatch;
+    if (++c->k < c->n_steps)
+    {
+      c->next_ns = sim_now_ns;
+      continue;
+    }
+
+    // end of one iteration, next one on the period grid like the timer / vTaskDelayUntil
+    if (c->daq) sim_now_ns += (int64_t) ( timing.cpu_us * 1000 );
+    period = (int64_t) ( 1e9 / c->hz );
+    if (sim_now_ns - c->iter_ns > c->worst_ns) c->worst_ns = sim_now_ns - c->iter_ns;
+    ++c->iters;
+    c->iter_ns += period;
+    while (c->iter_ns < sim_now_ns)
+    {
+      ++c->overruns;
+      c->iter_ns += period;
+    }
+    c->k = 0;
+    c->next_ns = c->iter_ns;
+  }
+  sim_now_ns = end_ns;
+
+  for (i = 0; i < n_clients; i++)
+  {
+    sim_client *c = &clients[i];
+    if (c->name[0] != 'a' && ( c->errors || c->overruns || c->mismatches )) feasible = 0;
+    if (verbose)
+    {
+      printf("  %-6s %7.0f Hz: %6u passes, worst %6.1f us, %u overruns, %u errors, %u bad values\n",
+             c->name, c->hz, c->iters, c->worst_ns / 1000.0, c->overruns, c->errors, c->mismatches);
+    }
+  }
+  if (verbose)
+  {
+    sim_quiet = 0;
+    i2c_stats_print();
+    sim_quiet = 1;
+    for (i = 0; i < I2C_NUM_MAX; i++)
+    {
+      if (bus[i].lock_timeouts) printf("  port %d: %u reads found the bus taken and gave up\n", i, bus[i].lock_timeouts);
+    }
+  }
+  return feasible;
+}
+
+// the tasks' timers start wherever boot left them, so a rate has to work at every phase of
+// the other tasks against the daq timer. phases step by half the shortest transaction, at
+// most SIM_PHASES of them. returns 1 if all pass, else 0 with the first phase that failed
+static int64_t min_xfer_ns = 0;
+
+static int check(double rate, double secs, int64_t *bad_phase)
+{
+  int64_t period = (int64_t) ( 1e9 / rate ), step = min_xfer_ns / 2, ph;
+  int j, n;
+
+  n = ( n_clients > 1 ) ? (int) ( period / ( step > 0 ? step : 1 ) ) + 1 : 1;
+  if (n > SIM_PHASES) n = SIM_PHASES;
+  for (j = 0; j < n; j++)
+  {
+    ph = period * j / n;
+    if (!run(rate, secs, ph, 0))
+    {
+      *bad_phase = ph;
+      return 0;
+    }
+  }
+  *bad_phase = 0;
+  return 1;
+}
+
+static void print_xfer(const char *name, int port)
+{
+  if (min_xfer_ns == 0 || last_xfer.dur_ns < min_xfer_ns) min_xfer_ns = last_xfer.dur_ns;
+  printf("  %-22s port %d %5u kHz  %d starts %3d bytes %d loads  %7.1f us\n", name, port,
+         bus[port].clk_hz / 1000, last_xfer.starts, last_xfer.bytes, last_xfer.loads,
+         last_xfer.dur_ns / 1000.0);
+}
+
+static void add_dev(sim_dev *d, const char *name, int port, uint8_t addr,
+                    void (*start)(sim_dev *, int), int (*wr)(sim_dev *, uint8_t), uint8_t (*rd)(sim_dev *))
+{
+  d->name = name;
+  d->port = port;
+  d->addr = addr;
+  d->alt_addr = 0xff;
+  d->start = start;
+  d->write = wr;
+  d->read = rd;
+  bus[port].dev[bus[port].n_dev++] = d;
+}
+
+int main(int argc, char **argv)
+{
+  const char *cfg_path = NULL;
+  double rate = DAQ_TIMER_HZ, secs = 1;
+  int i, p, ok, lo, hi, mid;
+  int64_t phase, hi_phase;
+  imu_sample_t s;
+
+  for (i = 1; i < argc; i++)
+  {
+    const char *opt = argv[i], *val = ( i + 1 < argc ) ? argv[i + 1] : NULL;
+    if (opt[0] != '-')
+    {
+      cfg_path = opt;
+      continue;
+    }
+    ok = ( val != NULL );
+    if (!ok) ;
+    else if (!strcmp(opt, "-r")) ok = ( rate = atof(val) ) > 0;
+    else if (!strcmp(opt, "-t")) ok = ( secs = atof(val) ) > 0;
+    else if (!strcmp(opt, "-tick")) ok = ( sim_tick_hz = atoi(val) ) > 0;
+    else if (!strcmp(opt, "-cpu")) timing.cpu_us = atof(val);
+    else if (!strcmp(opt, "-rise")) timing.rise_ns = atof(val);
+    else if (!strcmp(opt, "-drv")) timing.drv_us = atof(val);
+    else if (!strcmp(opt, "-isr")) timing.isr_us = atof(val);
+    else ok = 0;
+    if (!ok)
+    {
+      fprintf(stderr, "i2c_sim -- bad option %s %s\n", opt, val ? val : "");
+      return 1;
+    }
+    ++i;
+  }
+
+  // the firmware's bring-up, in the same order, quiet unless it fails
+  sim_quiet = 1;
+  if (cfg_path != NULL) config_load(&cfg, cfg_path);
+  else config_defaults(&cfg);
+  sim_quiet = 0;
+  if (cfg_path != NULL && !cfg.found)
+  {
+    fprintf(stderr, "i2c_sim -- cannot read %s\n", cfg_path);
+    return 1;
+  }
+  ad7998_chset_init(&chset, cfg.adc_channels);
+  add_dev(&adc_dev.d, "AD7998", cfg.adc_bus, ADC_SLAVE_ADDR, adc_start, adc_write, adc_read);
+  if (cfg.imu_bus != PORT_NONE)
+  {
+    add_dev(&imu_dev.d, "LSM6DSM", cfg.imu_bus, IMU_SLAVE_ADDR, imu_start, imu_write, imu_read);
+    imu_dev.reg[0x0f] = 0x6a;   // WHO_AM_I
+    imu_dev.reg[0x12] = 0x04;   // CTRL3_C, IF_INC
+  }
+  if (cfg.display_bus != PORT_NONE)
+  {
+    add_dev(&disp_dev.d, "AS1115", cfg.display_bus, 0x00, disp_start, disp_write, disp_read);
+  }
+
+  sim_quiet = 1;
+  for (p = 0; p < I2C_NUM_MAX; p++)
+  {
+    if (config_bus_used(&cfg, p)) i2c_master_config(p, config_bus_clk(&cfg, p), 0, 0);
+  }
+  i2c_stats_reset();
+  ad7998_config_chset(cfg.adc_bus, ADC_SLAVE_ADDR, &chset);
+  if (cfg.imu_bus != PORT_NONE) imu = init_lsm6dsm(cfg.imu_bus, IMU_SLAVE_ADDR);
+  if (cfg.display_bus != PORT_NONE) display = init_as1115(cfg.display_bus, AS1115_SLAVE_ADDR);
+  sim_quiet = 0;
+  for (p = 0; p < I2C_NUM_MAX; p++)
+  {
+    if (i2c_stats[p].errors) printf("i2c_sim -- port %d: %u transactions failed during init\n", p, i2c_stats[p].errors);
+  }
+
+  printf("i2c_sim -- %s: %d ADC channels on port %d, IMU on %d, display on %d, tick %d Hz "
+         "(I2C_TASK_LENGTH = %d ticks)\n", cfg_path ? cfg_path : "defaults", chset.n, cfg.adc_bus,
+         cfg.imu_bus, cfg.display_bus, sim_tick_hz, I2C_TASK_LENGTH / portTICK_RATE_MS);
+  printf("transactions, bus idle (scl period + %.0f ns, %.0f us driver, %.0f us per reload of %d commands):\n",
+         timing.rise_ns, timing.drv_us, timing.isr_us, SIM_CMD_LOAD);
+  reset_buses();
+  step_adc(0);
+  print_xfer("ad7998_read", cfg.adc_bus);
+  if (cfg.imu_bus != PORT_NONE)
+  {
+    imu_read_gyro_xl(&imu, &s.gyro_x, &s.gyro_y, &s.gyro_z, &s.xl_x, &s.xl_y, &s.xl_z);
+    print_xfer("imu_read_gyro_xl", cfg.imu_bus);
+    if (s.gyro_x != imu_dev.last[0] || s.xl_z != imu_dev.last[5]) printf("i2c_sim -- IMU values came back wrong\n");
+  }
+  if (cfg.display_bus != PORT_NONE)
+  {
+    display_number(&display, 1234, 2);
+    print_xfer("display_number", cfg.display_bus);
+    if ( ( disp_dev.reg[DIGIT_0] != 1 ) || ( disp_dev.reg[DIGIT_1] != ( 2 | 0x80 ) ) || ( disp_dev.reg[DIGIT_3] != 4 ) )
+      printf("i2c_sim -- display digits came back wrong\n");
+  }
+
+  n_clients = 0;
+  add_client("daq", rate, 1, step_adc, 1);
+  if (cfg.brake_sync) add_client("brake", SIM_BRAKE_HZ, 1, step_brake, 0);
+  if ( ( cfg.burst_channels >> 2 ) & chset.mask ) add_client("burst", SIM_BURST_HZ, 1, step_adc, 0);
+  if ( ( cfg.imu_bus != PORT_NONE ) | ( cfg.display_bus != PORT_NONE ) ) add_client("aux", AUX_BUS_HZ, 2, step_aux, 0);
+
+  sim_quiet = 1;
+  ok = check(rate, secs, &phase);
+
+  // highest feasible rate, bisecting up to the rate back to back reads on an idle bus allow
+  reset_buses();
+  step_adc(0);
+  lo = 0;
+  hi = (int) ( 1e9 / last_xfer.dur_ns ) + 2;
+  while (hi - lo > 1)
+  {
+    mid = ( lo + hi ) / 2;
+    if (check(mid, secs, &hi_phase)) lo = mid;
+    else hi = mid;
+  }
+  check(hi, secs, &hi_phase);
+
+  printf("at %.0f Hz for %.1f s, other tasks %.1f us after the daq timer:\n", rate, secs, phase / 1000.0);
+  run(rate, secs, phase, 1);
+  if (lo > 0)
+  {
+    printf("max daq rate %d Hz. at %d Hz, other tasks %.1f us after the daq timer:\n", lo, hi, hi_phase / 1000.0);
+    run(hi, secs, hi_phase, 1);
+  }
+  else printf("max daq rate -- no rate works with this config\n");
+
+  printf("i2c_sim -- %.0f Hz is %s\n", rate, ok ? "feasible" : "NOT feasible");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+/*
+** log_dump - decodes binary logs to csv, or writes the record layout for the matlab readers.
+both come from the record schema (LOG_FIELDS in nubaja_log_format.h), so the csv columns,
+the firmware struct and matlab/log_schema.m cannot disagree. regenerate log_schema.m
+whenever LOG_FIELDS changes; read_log.m refuses a log whose record size does not match it.
+
+build:  gcc -O2 -I../main -o log_dump log_dump.c
+usage:  log_dump data_1.bin [data_2.bin ...] > data.csv
+        log_dump -m > ../matlab/log_schema.m
+csv on stdout, one header line then one row per intact record, files back to back. samples
+logged without their slow channels (nubaja_log_qos.h) repeat the last ones logged.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log_reader.h"
+
+// matlab class for each c type used in LOG_FIELDS
+#define LOG_MTYPE_uint32_t    "uint32"
+#define LOG_MTYPE_uint16_t    "uint16"
+#define LOG_MTYPE_float       "single"
+
+#define DUMP_FIELD_SCHEMA(type, name, kind, fmt, info) \
+  printf("    '%s', '%s', '%s', %u, %d;\n", #name, LOG_MTYPE_##type, #kind, \
+         (unsigned) offsetof(data_point, name), fast_offset(#name));
+
+// offset of a field within a packed fast sample (LOG_FAST_FIELDS), -1 if it is not packed
+#define DUMP_FAST_OFFSET(name) \
+  if (!strcmp(field, #name)) return off; \
+  off += sizeof(((data_point *) 0)->name);
+
+static int fast_offset(const char *field)
+{
+  int off = 2 * sizeof(uint32_t);
+
+  if (!strcmp(field, "idx")) return 0;
+  if (!strcmp(field, "time_us")) return sizeof(uint32_t);
+  LOG_FAST_FIELDS(DUMP_FAST_OFFSET)
+  return -1;
+}
+
+static void write_schema()
+{
+  printf("function [ s, record_size, fast_size ] = log_schema()\n");
+  printf("%%record layout of data_N.bin, generated by host/log_dump -m from LOG_FIELDS\n");
+  printf("%%in main/nubaja_log_format.h - do not edit, regenerate.\n");
+  printf("%%   s(k) has name, type (matlab class), kind (META / CH / SP), offset (bytes) and\n");
+  printf("%%   fast, its offset in a packed fast sample of fast_size bytes (-1 = not packed)\n");
+  printf("f = {\n");
+  LOG_FIELDS(DUMP_FIELD_SCHEMA)
+  printf("    };\n");
+  printf("s = cell2struct(f, {'name', 'type', 'kind', 'offset', 'fast'}, 2);\n");
+  printf("record_size = %u;\n", (unsigned) LOG_RECORD_SIZE);
+  printf("fast_size = %u;\n", (unsigned) LOG_FAST_SIZE);
+  printf("end\n");
+}
+
+int main(int argc, char **argv)
+{
+  log_reader r;
+  data_point dp;
+  long n;
+  int i;
+
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: log_dump data_1.bin [data_2.bin ...] | log_dump -m\n");
+    return 1;
+  }
+  if (!strcmp(argv[1], "-m"))
+  {
+    write_schema();
+    return 0;
+  }
+
+  log_csv_header(stdout);
+  for (i = 1; i < argc; i++)
+  {
+    if (!log_reader_open(&r, argv[i])) continue;
+    n = 0;
+    while (log_reader_next(&r, &dp))
+    {
+      log_csv_row(stdout, &dp);
+      ++n;
+    }
+    log_reader_close(&r);
+    fprintf(stderr, "log_dump -- %s: %ld records, %u logging rate changes\n", argv[i], n,
+            (unsigned) r.qos_changes);
+  }
+  return 0;
+}
@@ -0,0 +1,371 @@
+/*
+** log_merge - merges the logs of several loggers (dyno unit, car unit, ...) into one
+time-aligned csv stream. each unit's free-running esp_timer is mapped onto the first log's
+clock as t_ref = offset + (1 + drift) * t_unit, fitted by least squares to sync events seen
+by every unit: rising crossings of a level on one channel, e.g. a shared gpio pulse wired to
+an adc input or the launch edge (tps_sp crossing LAUNCH_THRESHOLD, when the e-brake is
+released). the k-th event of each unit is paired with the k-th event of the first log; one
+pair gives offset only, two or more give offset and drift.
+
+two streaming passes over each file: the first finds the sync events, the second walks all
+units together and linearly interpolates every unit onto a common grid at -r Hz, so memory
+use does not depend on log length.
+
+build:  gcc -O2 -I../main -o log_merge log_merge.c -lm
+usage:  log_merge [-s channel:level] [-g gap_ms] [-r hz] [-c ch1,ch2,..] a.bin b.bin[@channel:level] ..
+  -s    sync event for every file (default tps_sp:LAUNCH_THRESHOLD), file@channel:level overrides
+  -g    dead time after an event before the next one is accepted (default 500 ms)
+  -r    output rate (default the first log's sample rate)
+  -c    channels to output per unit (default all), any CH or SP field of LOG_FIELDS
+csv on stdout: t (s from the start of the span all units cover, on the first log's clock),
+then u<k>.<channel> for each unit and channel.
+clock fits go to stderr.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "nubaja_proj_vars.h"
+#include "log_reader.h"
+
+#define MAX_UNITS         8
+#define MAX_EVENTS        256
+
+// every non-META field of the record schema (LOG_FIELDS) can be merged or synced on
+typedef struct
+{
+  const char *name;
+  size_t offset, size;
+  int is_float;
+} merge_field_t;
+
+#define MERGE_IF_META(...)
+#define MERGE_IF_CH(...)      __VA_ARGS__
+#define MERGE_IF_SP(...)      __VA_ARGS__
+#define MERGE_FIELD(type, name, kind, fmt, info) \
+  MERGE_IF_##kind( { #name, offsetof(data_point, name), sizeof(type), (type) 0.5 != 0 }, )
+
+static const merge_field_t merge_fields[] = { LOG_FIELDS(MERGE_FIELD) };
+#define NUM_MERGE_CH      ( (int) ( sizeof(merge_fields) / sizeof(merge_fields[0]) ) )
+
+typedef struct
+{
+  const char *path;
+  int sync_ch;
+  double sync_level;
+
+  double ev[MAX_EVENTS];          // sync event times, s on this unit's clock
+  int n_ev;
+  double first_t, last_t;         // first / last sample, s on this unit's clock
+  double offset, scale;           // t_ref = offset + scale * t
+
+  log_reader r;
+  uint32_t last_raw;              // esp_timer wraps every 2^32 us, unwrapped here
+  double wrap_s;
+  data_point d0, d1;              // samples either side of the output time
+  double t0, t1;                  // ... on the reference clock
+  int done;
+} unit_t;
+
+static const char *merge_ch_name(int ch)
+{
+  return merge_fields[ch].name;
+}
+
+static int merge_ch_find(const char *name, size_t len)
+{
+  int ch;
+  for (ch = 0; ch < NUM_MERGE_CH; ch++)
+  {
+    if ( ( strlen(merge_ch_name(ch)) == len ) && !strncmp(merge_ch_name(ch), name, len) ) return ch;
+  }
+  return -1;
+}
+
+static double merge_ch_value(const data_point *dp, int ch)
+{
+  const merge_field_t *f = &merge_fields[ch];
+  const uint8_t *p = (const uint8_t *) dp + f->offset;
+  float fv;
+  uint32_t u32;
+  uint16_t u16;
+
+  if (f->is_float)
+  {
+    memcpy(&fv, p, sizeof(fv));
+    return fv;
+  }
+  if (f->size == sizeof(u32))
+  {
+    memcpy(&u32, p, sizeof(u32));
+    return u32;
+  }
+  memcpy(&u16, p, sizeof(u16));
+  return u16;
+}
+
+// "channel:level"
+static int parse_sync(const char *spec, int *ch, double *level)
+{
+  const char *colon = strchr(spec, ':');
+  if (colon == NULL) return 0;
+  *ch = merge_ch_find(spec, colon - spec);
+  *level = atof(colon + 1);
+  return *ch >= 0;
+}
+
+// seconds since the unit's first sample, across timer wraps
+static double unit_time(unit_t *u, const data_point *dp)
+{
+  if (dp->time_us < u->last_raw) u->wrap_s += 4294967296.0 / 1e6;
+  u->last_raw = dp->time_us;
+  return u->wrap_s + dp->time_us / 1e6;
+}
+
+static int unit_open(unit_t *u)
+{
+  u->last_raw = 0;
+  u->wrap_s = 0;
+  return log_reader_open(&u->r, u->path);
+}
+
+// pass 1: sync events and time span
+static int find_events(unit_t *u, double gap_s)
+{
+  data_point dp;
+  double t, t_prev = 0, v, v_prev = 0, last_ev = -1e30;
+  long n = 0;
+
+  if (!unit_open(u)) return 0;
+  while (log_reader_next(&u->r, &dp))
+  {
+    t = unit_time(u, &dp);
+    v = merge_ch_value(&dp, u->sync_ch);
+    if (n == 0) u->first_t = t;
+    if ( ( n > 0 ) && ( v_prev < u->sync_level ) && ( v >= u->sync_level ) )
+    {
+      // crossing time interpolated between the two samples
+      double te = t_prev + ( t - t_prev ) * ( u->sync_level - v_prev ) / ( v - v_prev );
+      if ( ( te - last_ev >= gap_s ) && ( u->n_ev < MAX_EVENTS ) )
+      {
+        u->ev[u->n_ev++] = te;
+        last_ev = te;
+      }
+    }
+    t_prev = t;
+    v_prev = v;
+    ++n;
+  }
+  u->last_t = t_prev;
+  log_reader_close(&u->r);
+  if (n == 0)
+  {
+    fprintf(stderr, "log_merge -- %s has no samples\n", u->path);
+    return 0;
+  }
+  return 1;
+}
+
+// least squares fit of the reference event times against this unit's
+static void fit_clock(unit_t *u, const unit_t *ref)
+{
+  int k, n = u->n_ev < ref->n_ev ? u->n_ev : ref->n_ev;
+  double mx = 0, my = 0, sxx = 0, sxy = 0, res = 0;
+
+  u->scale = 1;
+  if (n == 0)
+  {
+    u->offset = ref->first_t - u->first_t;
+    fprintf(stderr, "log_merge -- %s: no sync events shared with %s, aligning first samples\n",
+            u->path, ref->path);
+    return;
+  }
+  for (k = 0; k < n; k++)
+  {
+    mx += u->ev[k];
+    my += ref->ev[k];
+  }
+  mx /= n;
+  my /= n;
+  for (k = 0; k < n; k++)
+  {
+    sxx += ( u->ev[k] - mx ) * ( u->ev[k] - mx );
+    sxy += ( u->ev[k] - mx ) * ( ref->ev[k] - my );
+  }
+  if ( ( n > 1 ) && ( sxx > 0 ) ) u->scale = sxy / sxx;
+  u->offset = my - u->scale * mx;
+
+  for (k = 0; k < n; k++)
+  {
+    double e = ref->ev[k] - ( u->offset + u->scale * u->ev[k] );
+    res += e * e;
+  }
+  fprintf(stderr, "log_merge -- %s: %d sync pairs, offset %.6f s, drift %+.1f ppm, residual %.1f us rms\n",
+          u->path, n, u->offset, ( u->scale - 1 ) * 1e6, sqrt(res / n) * 1e6);
+  if (u->n_ev != ref->n_ev)
+  {
+    fprintf(stderr, "log_merge -- %s: %d events vs %d in %s, only the first %d paired\n",
+            u->path, u->n_ev, ref->n_ev, ref->path, n);
+  }
+}
+
+static double ref_time(const unit_t *u, double t)
+{
+  return u->offset + u->scale * t;
+}
+
+// step the unit until d0 / d1 bracket t (reference clock)
+static void unit_advance(unit_t *u, double t)
+{
+  data_point dp;
+  while ( !u->done && ( u->t1 < t ) )
+  {
+    if (!log_reader_next(&u->r, &dp))
+    {
+      u->done = 1;
+      break;
+    }
+    u->d0 = u->d1;
+    u->t0 = u->t1;
+    u->d1 = dp;
+    u->t1 = ref_time(u, unit_time(u, &dp));
+  }
+}
+
+static double unit_value(const unit_t *u, int ch, double t)
+{
+  double v0 = merge_ch_value(&u->d0, ch), v1 = merge_ch_value(&u->d1, ch);
+  if (u->t1 <= u->t0) return v1;
+  return v0 + ( v1 - v0 ) * ( t - u->t0 ) / ( u->t1 - u->t0 );
+}
+
+int main(int argc, char **argv)
+{
+  unit_t units[MAX_UNITS];
+  int n_units = 0, out_ch[NUM_MERGE_CH], n_out = 0, i, k, ch;
+  int sync_ch = merge_ch_find("tps_sp", 6);
+  double sync_level = LAUNCH_THRESHOLD, gap_s = 0.5, rate = 0;
+  const char *ch_list = NULL;
+
+  memset(units, 0, sizeof(units));
+  for (i = 1; i < argc; i++)
+  {
+    if ( !strcmp(argv[i], "-s") && ( i + 1 < argc ) ) {
+      if (!parse_sync(argv[++i], &sync_ch, &sync_level)) {
+        fprintf(stderr, "log_merge -- bad sync spec %s\n", argv[i]);
+        return 1;
+      }
+    }
+    else if ( !strcmp(argv[i], "-g") && ( i + 1 < argc ) ) gap_s = atof(argv[++i]) / 1000;
+    else if ( !strcmp(argv[i], "-r") && ( i + 1 < argc ) ) rate = atof(argv[++i]);
+    else if ( !strcmp(argv[i], "-c") && ( i + 1 < argc ) ) ch_list = argv[++i];
+    else if ( ( argv[i][0] != '-' ) && ( n_units < MAX_UNITS ) ) units[n_units++].path = argv[i];
+  }
+  if (n_units < 2)
+  {
+    fprintf(stderr, "usage: log_merge [-s channel:level] [-g gap_ms] [-r hz] [-c ch1,ch2,..] "
+                    "a.bin b.bin[@channel:level] ..\n");
+    return 1;
+  }
+
+  // per file sync overrides, file@channel:level
+  for (k = 0; k < n_units; k++)
+  {
+    char *at = strrchr((char *) units[k].path, '@');
+    units[k].sync_ch = sync_ch;
+    units[k].sync_level = sync_level;
+    if (at != NULL)
+    {
+      *at = '\0';
+      if (!parse_sync(at + 1, &units[k].sync_ch, &units[k].sync_level))
+      {
+        fprintf(stderr, "log_merge -- bad sync spec %s\n", at + 1);
+        return 1;
+      }
+    }
+  }
+
+  if (ch_list == NULL)
+  {
+    for (ch = 0; ch < NUM_MERGE_CH; ch++) out_ch[n_out++] = ch;
+  }
+  else
+  {
+    const char *p = ch_list;
+    while (*p && n_out < NUM_MERGE_CH)
+    {
+      size_t len = strcspn(p, ",");
+      if ( ( ch = merge_ch_find(p, len) ) < 0 )
+      {
+        fprintf(stderr, "log_merge -- no channel %.*s\n", (int) len, p);
+        return 1;
+      }
+      out_ch[n_out++] = ch;
+      p += len + ( p[len] == ',' );
+    }
+  }
+
+  // pass 1: events and clock fits against the first log
+  for (k = 0; k < n_units; k++)
+  {
+    if (!find_events(&units[k], gap_s)) return 1;
+    fprintf(stderr, "log_merge -- %s: %d sync events on %s\n", units[k].path, units[k].n_ev,
+            merge_ch_name(units[k].sync_ch));
+  }
+  units[0].offset = 0;
+  units[0].scale = 1;
+  for (k = 1; k < n_units; k++) fit_clock(&units[k], &units[0]);
+
+  // common span
+  double t_start = -1e30, t_end = 1e30;
+  for (k = 0; k < n_units; k++)
+  {
+    double a = ref_time(&units[k], units[k].first_t), b = ref_time(&units[k], units[k].last_t);
+    if (a > t_start) t_start = a;
+    if (b < t_end) t_end = b;
+  }
+  if (t_end < t_start)
+  {
+    fprintf(stderr, "log_merge -- the logs do not overlap once aligned\n");
+    return 1;
+  }
+
+  // pass 2: stream everything onto the grid
+  for (k = 0; k < n_units; k++)
+  {
+    if (!unit_open(&units[k])) return 1;
+    units[k].t1 = -1e30;
+    unit_advance(&units[k], -1e29);   // prime d1 with the first sample
+    units[k].d0 = units[k].d1;
+    units[k].t0 = units[k].t1;
+  }
+  if (rate <= 0) rate = units[0].r.fh.sample_hz;
+  if (rate <= 0) rate = DAQ_TIMER_HZ;
+
+  printf("t");
+  for (k = 0; k < n_units; k++)
+  {
+    for (i = 0; i < n_out; i++) printf(",u%d.%s", k, merge_ch_name(out_ch[i]));
+  }
+  printf("\n");
+
+  long n_rows = 0;
+  double t;
+  for (n_rows = 0; ( t = t_start + n_rows / rate ) <= t_end; n_rows++)
+  {
+    printf("%.6f", t - t_start);
+    for (k = 0; k < n_units; k++)
+    {
+      unit_advance(&units[k], t);
+      for (i = 0; i < n_out; i++) printf(",%.6g", unit_value(&units[k], out_ch[i], t));
+    }
+    printf("\n");
+  }
+
+  for (k = 0; k < n_units; k++) log_reader_close(&units[k].r);
+  fprintf(stderr, "log_merge -- %d units, %ld rows at %g Hz, t = 0 is %.6f s on %s's clock\n",
+          n_units, n_rows, rate, t_start, units[0].path);
+  return 0;
+}
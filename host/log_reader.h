@@ -0,0 +1,92 @@
+#ifndef NUBAJA_LOG_READER_H_
+#define NUBAJA_LOG_READER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nubaja_log_format.h"
+
+// streams the samples of a binary log in file order with one block in memory at a time.
+// stops at the index or at the first torn block, the same rule as the firmware's log_recover.
+// packed fast samples come out as whole records, with the slow channels of the last full
+// record; rate changes are not samples, the latest is kept in qos
+typedef struct
+{
+  FILE *fp;
+  log_file_header fh;
+  uint8_t *block;
+  uint32_t seq;       // next block expected
+  int n, pos;         // slots in the current block, next slot to read
+  data_point held;    // last full record
+  data_point out[2];  // samples of the current slot
+  int out_n, out_pos;
+  log_qos_marker qos; // last rate change, level 0 until the first one
+  uint32_t qos_changes;
+} log_reader;
+
+void log_reader_close(log_reader *r)
+{
+  if (r->fp != NULL) fclose(r->fp);
+  free(r->block);
+  r->fp = NULL;
+  r->block = NULL;
+}
+
+int log_reader_open(log_reader *r, const char *path)
+{
+  memset(r, 0, sizeof(*r));
+  r->fp = fopen(path, "rb");
+  if (r->fp == NULL)
+  {
+    fprintf(stderr, "log_reader_open -- cannot open %s\n", path);
+    return 0;
+  }
+  if ( ( fread(&r->fh, sizeof(r->fh), 1, r->fp) != 1 ) || ( r->fh.magic != LOG_MAGIC ) ||
+       ( r->fh.version < LOG_VERSION_MIN ) || ( r->fh.version > LOG_VERSION ) || ( r->fh.block_size != LOG_BLOCK_SIZE ) )
+  {
+    fprintf(stderr, "log_reader_open -- %s is not a version %d nubaja log\n", path, LOG_VERSION);
+    log_reader_close(r);
+    return 0;
+  }
+  r->qos.decim = 1;
+  r->block = (uint8_t *) malloc(LOG_BLOCK_SIZE);
+  if (r->block == NULL)
+  {
+    log_reader_close(r);
+    return 0;
+  }
+  return 1;
+}
+
+// next sample, 0 at the end of the intact blocks
+int log_reader_next(log_reader *r, data_point *dp)
+{
+  data_point slot;
+
+  while (r->out_pos >= r->out_n)
+  {
+    while (r->pos >= r->n)
+    {
+      if ( ( fread(r->block, LOG_BLOCK_SIZE, 1, r->fp) != 1 ) || !log_block_valid(r->block, r->seq) )
+      {
+        return 0;
+      }
+      r->n = ((log_block_header *) r->block)->n_samples;
+      r->pos = 0;
+      ++r->seq;
+    }
+    log_record_decode(&slot, r->block + sizeof(log_block_header) + r->pos * LOG_RECORD_SIZE);
+    ++r->pos;
+    if (log_slot_kind(&slot) == LOG_SLOT_QOS)
+    {
+      log_qos_decode(&r->qos, &slot);
+      ++r->qos_changes;
+    }
+    r->out_n = log_slot_expand(&slot, &r->held, r->out);
+    r->out_pos = 0;
+  }
+  *dp = r->out[r->out_pos++];
+  return 1;
+}
+
+#endif // NUBAJA_LOG_READER_H_
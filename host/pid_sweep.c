@@ -0,0 +1,472 @@
+/*
+** pid_sweep - closed-loop simulations of the brake current PID (pid_update in nubaja_pid.h)
+against a dyno plant model, for a grid of gains, spread over every core. gain sets are
+ranked by tracking error, overshoot and settling time over the chosen set point profiles,
+so tuning starts on the dyno from near-final values of KP / KI / KD, BRAKE_WINDUP_GUARD
+and BRAKE_OUTPUT_MAX.
+
+plant: brake coil   L di/dt = V * duty - R i, measured through the 12 bit adc and the
+                    I_BRAKE_SCALE / I_BRAKE_OFFSET conversion, as daq_task does
+       engine/dyno  J dw/dt = engine torque(throttle, rpm) - k_brake * i^2 - friction * w
+                    with the throttle from the profile's tps_sp, or eng_throttle for a
+                    profile whose tps_sp is all zero (a placeholder, the driver has it).
+                    a closed throttle still makes eng_idle % of full torque, as the idle
+                    governor holds it open that far
+
+a profile the engine can't get through even with the current tracked exactly (it stalls,
+rpm below stall_rpm) is reported as infeasible for the plant and left out of the ranking:
+no gains can fix it. a gain set that stalls the engine on a feasible profile is marked and
+ranked after every set that doesn't.
+
+a step is a set point change of STEP_MIN or more. it is judged for as long as the set point
+stays within SETTLE_BAND of the value it stepped to, at every pid update: overshoot is the
+worst excursion past the set point in the direction of the step, settling time the last
+update outside the band. a step that never settles counts its whole window. slower drift of
+the set point after that is tracking, and only shows in the iae. set points past the top of
+the adc range (I_BRAKE_MAX above what ADC_FS reads) can't be seen, let alone settled on, so
+steps are judged against the most the adc can read.
+
+build:  gcc -O2 -pthread -I../main -o pid_sweep pid_sweep.c -lm
+usage:  pid_sweep [-kp min:max:n] [-ki min:max:n] [-kd min:max:n] [-guard a,b,..] [-outmax a,b,..]
+                  [-p accel_launch,test,..] [-hz control_hz] [-m plant.txt] [-top n] [-j threads]
+  -hz   pid update rate, profile entries still last 1 / DAQ_TIMER_HZ each (default DAQ_TIMER_HZ)
+  -m    plant parameters, "key = value" per line, keys as in plant_keys below
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "nubaja_ctrl.h"
+
+#define MAX_LIST          16
+#define MAX_PROFILES      8
+#define SETTLE_BAND       2.0     // % duty
+#define STEP_MIN          5.0     // % duty, smaller set point changes are not treated as steps
+#define MAX_MECH_STEP     0.005   // s, euler step limit for the engine/dyno inertia
+
+typedef struct
+{
+  double supply_v, coil_r, coil_l;            // brake coil drive
+  double inertia, k_brake, friction;          // dyno, brake torque = k_brake * i^2 (eddy current)
+  double eng_torque_max, eng_peak_rpm, eng_rpm_span, eng_throttle, eng_idle;  // engine torque curve
+  double start_rpm, stall_rpm, max_rpm;
+  double substeps;                            // minimum plant integration steps per control tick
+} plant_cfg;
+
+static const struct { const char *key; size_t off; } plant_keys[] =
+{
+  { "supply_v", offsetof(plant_cfg, supply_v) },             { "coil_r", offsetof(plant_cfg, coil_r) },
+  { "coil_l", offsetof(plant_cfg, coil_l) },                 { "inertia", offsetof(plant_cfg, inertia) },
+  { "k_brake", offsetof(plant_cfg, k_brake) },               { "friction", offsetof(plant_cfg, friction) },
+  { "eng_torque_max", offsetof(plant_cfg, eng_torque_max) }, { "eng_peak_rpm", offsetof(plant_cfg, eng_peak_rpm) },
+  { "eng_rpm_span", offsetof(plant_cfg, eng_rpm_span) },     { "eng_throttle", offsetof(plant_cfg, eng_throttle) },
+  { "eng_idle", offsetof(plant_cfg, eng_idle) },
+  { "start_rpm", offsetof(plant_cfg, start_rpm) },           { "stall_rpm", offsetof(plant_cfg, stall_rpm) },
+  { "max_rpm", offsetof(plant_cfg, max_rpm) },               { "substeps", offsetof(plant_cfg, substeps) },
+};
+
+typedef struct
+{
+  float kp, ki, kd, guard, outmax;
+  double iae;         // mean absolute tracking error, % duty
+  double overshoot;   // worst overshoot past a step's set point, % duty
+  double settle;      // worst settling time after a step, s
+  double cost;
+  int stalled;
+} gain_set;
+
+typedef struct
+{
+  const char *name;
+  const uint8_t *i_sp, *tps_sp;
+} profile_ref;
+
+static profile_ref all_profiles[] =
+{
+  { "accel_launch", i_sp_accel_launch, tps_sp_accel_launch }, { "accel", i_sp_accel, tps_sp_accel },
+  { "hill", i_sp_hill, tps_sp_hill }, { "test", i_sp_test, tps_sp_test }, { "demo", i_sp_demo, tps_sp_demo },
+};
+
+// sweep state shared with the worker threads
+static plant_cfg plant;
+static profile_ref profiles[MAX_PROFILES];
+static int n_profiles = 0;
+static int control_hz = DAQ_TIMER_HZ;
+static gain_set *sets;
+static long n_sets, next_set = 0;
+static float pv_max;      // highest current the adc can read, % duty
+static pthread_mutex_t next_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void plant_defaults(plant_cfg *pc)
+{
+  pc->supply_v = 12.0;
+  pc->coil_r = 3.0;
+  pc->coil_l = 0.05;
+  pc->inertia = 0.05;
+  pc->k_brake = 0.3;                  // 4.8 N.m at the 4 A the coil tops out at
+  pc->friction = 0.002;
+  pc->eng_torque_max = 25.0;
+  pc->eng_peak_rpm = 2600;
+  pc->eng_rpm_span = 2400;
+  pc->eng_throttle = 100;
+  pc->eng_idle = 20;
+  pc->start_rpm = 3000;
+  pc->stall_rpm = 1200;
+  pc->max_rpm = 4200;                 // MAX_PRIMARY_RPM
+  pc->substeps = 20;
+}
+
+static int plant_load(plant_cfg *pc, const char *path)
+{
+  char line[128], key[32];
+  double val;
+  size_t k;
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL)
+  {
+    fprintf(stderr, "pid_sweep -- cannot open %s\n", path);
+    return 0;
+  }
+  while (fgets(line, sizeof(line), fp) != NULL)
+  {
+    if ( ( line[0] == '#' ) | ( sscanf(line, " %31[a-z_] = %lf", key, &val) != 2 ) ) continue;
+    for (k = 0; k < sizeof(plant_keys) / sizeof(plant_keys[0]); k++)
+    {
+      if (!strcmp(key, plant_keys[k].key)) *(double *) ( (char *) pc + plant_keys[k].off ) = val;
+    }
+  }
+  fclose(fp);
+  return 1;
+}
+
+// adc round trip of the coil current, as ctrl_update sees it
+static float measure_duty(double amps)
+{
+  double volts = ( amps - I_BRAKE_OFFSET ) / I_BRAKE_SCALE;
+  double counts = floor( volts / ADC_FS * 4096 );
+  if (counts < 0) counts = 0;
+  if (counts > 4095) counts = 4095;
+  return 100 * ( ( counts_to_volts( (uint16_t) counts ) * I_BRAKE_SCALE + I_BRAKE_OFFSET ) / I_BRAKE_MAX );
+}
+
+static double engine_torque(const plant_cfg *pc, double throttle, double rpm)
+{
+  double x = ( rpm - pc->eng_peak_rpm ) / pc->eng_rpm_span;
+  double open = ( pc->eng_idle + ( 100 - pc->eng_idle ) * throttle / 100 ) / 100;
+  double t = pc->eng_torque_max * open * ( 1 - x * x );
+  return t > 0 ? t : 0;
+}
+
+// the engine/dyno over h seconds at coil current amps. 0 if it stalled
+static int engine_step(double *rpm, double throttle, double amps, double h)
+{
+  double w = *rpm * 2 * M_PI / 60;
+  w += h * ( engine_torque(&plant, throttle, *rpm) - plant.k_brake * amps * amps - plant.friction * w ) / plant.inertia;
+  *rpm = w * 60 / ( 2 * M_PI );
+  if (*rpm > plant.max_rpm) *rpm = plant.max_rpm;
+  if (*rpm < plant.stall_rpm)
+  {
+    *rpm = plant.stall_rpm;
+    return 0;
+  }
+  return 1;
+}
+
+// throttle for profile entry k: its tps_sp, or eng_throttle if the table is a placeholder
+static double profile_throttle(const profile_ref *prof, int k)
+{
+  int i;
+  for (i = 0; i < BSIZE; i++)
+  {
+    if (fetch_sp(i, prof->tps_sp) != 0) return fetch_sp(k, prof->tps_sp);
+  }
+  return plant.eng_throttle;
+}
+
+// run a profile with the coil current exactly on its set point. the entry the engine stalls
+// at, -1 if it gets through
+static int profile_stall(const profile_ref *prof)
+{
+  double rpm = plant.start_rpm;
+  int sub = (int) ceil( 1.0 / DAQ_TIMER_HZ / MAX_MECH_STEP );
+  double h = 1.0 / DAQ_TIMER_HZ / sub;
+  int k, s;
+
+  for (k = 0; k < BSIZE; k++)
+  {
+    double amps = fetch_sp(k, prof->i_sp) / 100.0 * I_BRAKE_MAX;
+    double throttle = profile_throttle(prof, k);
+    for (s = 0; s < sub; s++)
+    {
+      if (!engine_step(&rpm, throttle, amps, h)) return k;
+    }
+  }
+  return -1;
+}
+
+// close out a step: settled at the last update outside the band, or never within its window
+static void step_done(gain_set *g, double step_t, double last_out_t, double end_t)
+{
+  double settle = ( last_out_t >= end_t ) ? end_t - step_t : last_out_t - step_t;
+  if (step_t >= 0 && settle > g->settle) g->settle = settle;
+}
+
+// one gain set over one profile, accumulates into g
+static void simulate(gain_set *g, const profile_ref *prof, double *abs_err, long *ticks)
+{
+  pid_ctrl_t pid;
+  double amps = 0, rpm = plant.start_rpm;
+  int per_entry = control_hz / DAQ_TIMER_HZ > 0 ? control_hz / DAQ_TIMER_HZ : 1;
+  double dt = 1.0 / ( DAQ_TIMER_HZ * per_entry );
+  int sub = (int) ceil( dt / MAX_MECH_STEP );
+  if (sub < plant.substeps) sub = (int) plant.substeps;
+  double h = dt / sub;
+  double coil_decay = exp( -h * plant.coil_r / plant.coil_l );
+  double step_t = -1, last_out_t = 0, t = 0;
+  double throttle;
+  float sp_prev = 0, step_sp = 0, step_dir = 0;
+  int k, j, s;
+
+  init_pid(&pid, g->kp, g->ki, g->kd, g->guard, g->outmax);
+
+  for (k = 0; k < BSIZE; k++)
+  {
+    float sp = fetch_sp(k, prof->i_sp);
+    throttle = profile_throttle(prof, k);
+    if (fabs(sp - sp_prev) >= STEP_MIN)
+    {
+      // close out the previous step before starting a new one
+      step_done(g, step_t, last_out_t, t);
+      step_t = t;
+      last_out_t = t;
+      step_sp = sp;
+      step_dir = ( sp > sp_prev ) ? 1 : -1;
+    }
+    else if (step_t >= 0 && fabs(sp - step_sp) > SETTLE_BAND)
+    {
+      // the set point has moved on, the step is over
+      step_done(g, step_t, last_out_t, t);
+      step_t = -1;
+    }
+    sp_prev = sp;
+
+    for (j = 0; j < per_entry; j++)
+    {
+      float pv = measure_duty(amps);
+      double err = sp - pv;
+      double step_err = ( sp < pv_max ? sp : pv_max ) - pv;
+      pid_update(&pid, sp, pv);
+
+      *abs_err += fabs(err);
+      ++*ticks;
+      if (step_t >= 0)
+      {
+        if (-step_dir * step_err > g->overshoot) g->overshoot = -step_dir * step_err;
+        if (fabs(step_err) > SETTLE_BAND) last_out_t = t + dt;
+      }
+
+      double duty = pid.output < 0 ? 0 : ( pid.output > 100 ? 100 : pid.output );
+      for (s = 0; s < sub; s++)
+      {
+        // coil is first order, step it exactly so long ticks stay stable
+        double amps_ss = plant.supply_v * duty / 100 / plant.coil_r;
+        amps = amps_ss + ( amps - amps_ss ) * coil_decay;
+        if (!engine_step(&rpm, throttle, amps, h)) g->stalled = 1;
+      }
+      t += dt;
+    }
+  }
+  step_done(g, step_t, last_out_t, t);
+}
+
+static void *sweep_worker(void *arg)
+{
+  long i;
+  int p;
+  (void) arg;
+  for (;;)
+  {
+    pthread_mutex_lock(&next_lock);
+    i = next_set++;
+    pthread_mutex_unlock(&next_lock);
+    if (i >= n_sets) break;
+
+    gain_set *g = &sets[i];
+    double abs_err = 0;
+    long ticks = 0;
+    for (p = 0; p < n_profiles; p++)
+    {
+      simulate(g, &profiles[p], &abs_err, &ticks);
+    }
+    g->iae = ticks ? abs_err / ticks : 0;
+    g->cost = g->iae + 0.5 * g->overshoot + 2.0 * g->settle;
+  }
+  return NULL;
+}
+
+// sets that stall the engine after the ones that don't, then by cost
+static int cmp_cost(const void *a, const void *b)
+{
+  const gain_set *ga = (const gain_set *) a, *gb = (const gain_set *) b;
+  double d = ga->cost - gb->cost;
+  if (ga->stalled != gb->stalled) return ga->stalled - gb->stalled;
+  return ( d > 0 ) - ( d < 0 );
+}
+
+// "min:max:n" -> n evenly spaced values
+static int parse_range(const char *s, float *v)
+{
+  float lo, hi;
+  int n, i;
+  if (sscanf(s, "%f:%f:%d", &lo, &hi, &n) != 3 || n < 1 || n > MAX_LIST * 4) return 0;
+  for (i = 0; i < n; i++) v[i] = ( n == 1 ) ? lo : lo + ( hi - lo ) * i / ( n - 1 );
+  return n;
+}
+
+// "a,b,c" -> values
+static int parse_list(const char *s, float *v)
+{
+  int n = 0;
+  char *end;
+  while (*s && n < MAX_LIST)
+  {
+    v[n++] = strtof(s, &end);
+    if (*end != ',') break;
+    s = end + 1;
+  }
+  return n;
+}
+
+int main(int argc, char **argv)
+{
+  float kp[MAX_LIST * 4], ki[MAX_LIST * 4], kd[MAX_LIST * 4], guard[MAX_LIST], outmax[MAX_LIST];
+  int n_kp, n_ki, n_kd, n_guard, n_outmax;
+  int top = 20, threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  const char *profile_names = "accel_launch,test";
+  int i, p, a, b, c, d, e;
+
+  plant_defaults(&plant);
+  n_kp = parse_range("0:2:21", kp);
+  n_ki = parse_range("0:2:21", ki);
+  n_kd = parse_range("0:0.5:6", kd);
+  n_guard = parse_list("10,50,100,200,400", guard);
+  n_outmax = parse_list("100", outmax);
+
+  for (i = 1; i + 1 < argc; i += 2)
+  {
+    const char *opt = argv[i], *val = argv[i + 1];
+    int ok = 1;
+    if (!strcmp(opt, "-kp")) ok = ( n_kp = parse_range(val, kp) );
+    else if (!strcmp(opt, "-ki")) ok = ( n_ki = parse_range(val, ki) );
+    else if (!strcmp(opt, "-kd")) ok = ( n_kd = parse_range(val, kd) );
+    else if (!strcmp(opt, "-guard")) ok = ( n_guard = parse_list(val, guard) );
+    else if (!strcmp(opt, "-outmax")) ok = ( n_outmax = parse_list(val, outmax) );
+    else if (!strcmp(opt, "-p")) profile_names = val;
+    else if (!strcmp(opt, "-hz")) control_hz = atoi(val);
+    else if (!strcmp(opt, "-m")) ok = plant_load(&plant, val);
+    else if (!strcmp(opt, "-top")) top = atoi(val);
+    else if (!strcmp(opt, "-j")) threads = atoi(val);
+    else ok = 0;
+    if (!ok)
+    {
+      fprintf(stderr, "pid_sweep -- bad option %s %s\n", opt, val);
+      return 1;
+    }
+  }
+
+  // resolve profile names
+  char names[128];
+  strncpy(names, profile_names, sizeof(names) - 1);
+  names[sizeof(names) - 1] = 0;
+  for (char *tok = strtok(names, ","); tok != NULL && n_profiles < MAX_PROFILES; tok = strtok(NULL, ","))
+  {
+    for (i = 0; i < (int) ( sizeof(all_profiles) / sizeof(all_profiles[0]) ); i++)
+    {
+      if (!strcmp(tok, all_profiles[i].name)) profiles[n_profiles++] = all_profiles[i];
+    }
+  }
+  if (n_profiles == 0 || control_hz < 1 || threads < 1)
+  {
+    fprintf(stderr, "pid_sweep -- no profiles / bad rate / bad thread count\n");
+    return 1;
+  }
+
+  // profiles the plant can't run whatever the gains
+  for (p = 0, i = 0; p < n_profiles; p++)
+  {
+    int stall = profile_stall(&profiles[p]);
+    if (stall >= 0)
+    {
+      printf("pid_sweep -- %s infeasible for this plant: the engine stalls at entry %d with the "
+             "current on its set point, left out of the ranking\n", profiles[p].name, stall);
+      continue;
+    }
+    profiles[i++] = profiles[p];
+  }
+  n_profiles = i;
+  if (n_profiles == 0)
+  {
+    fprintf(stderr, "pid_sweep -- no feasible profiles, check the plant (-m)\n");
+    return 1;
+  }
+
+  n_sets = (long) n_kp * n_ki * n_kd * n_guard * n_outmax;
+  sets = (gain_set *) calloc(n_sets, sizeof(gain_set));
+  if (sets == NULL) return 1;
+  long n = 0;
+  for (a = 0; a < n_kp; a++)
+    for (b = 0; b < n_ki; b++)
+      for (c = 0; c < n_kd; c++)
+        for (d = 0; d < n_guard; d++)
+          for (e = 0; e < n_outmax; e++)
+          {
+            sets[n].kp = kp[a];
+            sets[n].ki = ki[b];
+            sets[n].kd = kd[c];
+            sets[n].guard = guard[d];
+            sets[n].outmax = outmax[e];
+            ++n;
+          }
+
+  pv_max = measure_duty(1e9);
+  for (p = 0; p < n_profiles; p++)
+  {
+    for (i = 0; i < BSIZE; i++)
+    {
+      if (fetch_sp(i, profiles[p].i_sp) > pv_max)
+      {
+        printf("pid_sweep -- %s asks for more than the adc reads, steps judged against %.1f%%\n",
+               profiles[p].name, pv_max);
+        break;
+      }
+    }
+  }
+
+  pthread_t *tid = (pthread_t *) malloc(threads * sizeof(pthread_t));
+  for (i = 0; i < threads; i++) pthread_create(&tid[i], NULL, sweep_worker, NULL);
+  for (i = 0; i < threads; i++) pthread_join(tid[i], NULL);
+  free(tid);
+
+  qsort(sets, n_sets, sizeof(gain_set), cmp_cost);
+
+  printf("pid_sweep -- %ld gain sets x %d profiles at %d Hz on %d threads\n",
+         n_sets, n_profiles, control_hz, threads);
+  printf("%6s %6s %6s %6s %6s | %8s %9s %8s %s\n",
+         "kp", "ki", "kd", "guard", "outmax", "iae(%)", "ovrsht(%)", "settle(s)", "");
+  for (i = 0; i < top && i < n_sets; i++)
+  {
+    gain_set *g = &sets[i];
+    printf("%6.3f %6.3f %6.3f %6.1f %6.1f | %8.3f %9.3f %8.3f %s\n",
+           g->kp, g->ki, g->kd, g->guard, g->outmax, g->iae, g->overshoot, g->settle,
+           g->stalled ? "stall" : "");
+  }
+  printf("\n#define\tKP\t\t\t\t\t\t%g\n#define\tKI\t\t\t\t\t\t%g\n#define\tKD\t\t\t\t\t\t%g\n"
+         "#define\tBRAKE_WINDUP_GUARD\t\t%g\n#define\tBRAKE_OUTPUT_MAX\t\t%g\n",
+         sets[0].kp, sets[0].ki, sets[0].kd, sets[0].guard, sets[0].outmax);
+  free(sets);
+  return 0;
+}
@@ -0,0 +1,138 @@
+/*
+** replay - runs recorded logs back through the daq_task control logic (nubaja_ctrl.h)
+with no hardware attached, as fast as the host allows, and reports every actuator
+command and fault decision. the raw adc counts, rpms and sample index come from the log;
+set points are re-fetched from the profile tables, so changed thresholds, profiles or
+control code can be checked against archived pulls.
+
+build:  gcc -O2 -I../main -o replay replay.c
+usage:  replay [-p profile] [-v] data_1.bin [data_2.bin ...]
+  -p    profile the runs were taken with (default 1)
+  -v    print one line per tick: idx, throttle, brake duty, e-brake, trip, faults
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nubaja_ctrl.h"
+#include "log_reader.h"
+
+typedef struct
+{
+  long samples;
+  long ebrake_idx;        // first tick the e-brake was released, -1 if never
+  long trip_idx;          // first tick a fault tripped, -1 if never
+  long sp_mismatch;       // ticks where the re-fetched set points differ from the recorded ones
+  int overcurrent, overtemp, slip;
+} replay_result;
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// same start of run state daq_task sets up
+static void replay_init(control_t *ctrl, fault_t *faults, int profile, profile_t *prof)
+{
+  memset(ctrl, 0, sizeof(*ctrl));
+  ctrl->run = 1;
+  ctrl->eng = 1;
+  ctrl->en_log = 1;
+  ctrl->num_profile = profile;
+  load_profile(ctrl, prof);
+  clear_faults(faults);
+}
+
+static int replay_file(const char *path, int profile, int verbose, replay_result *res)
+{
+  log_reader r;
+  control_t ctrl;
+  fault_t faults;
+  ctrl_cmd_t cmd;
+  derived_t dv;
+  data_point rec, dp;
+  profile_t prof;
+
+  if (!log_reader_open(&r, path))
+  {
+    return 0;
+  }
+  replay_init(&ctrl, &faults, profile, &prof);
+  memset(res, 0, sizeof(*res));
+  res->ebrake_idx = -1;
+  res->trip_idx = -1;
+
+  while ( ctrl.run && log_reader_next(&r, &rec) )
+  {
+    dp = rec;
+    ctrl.idx = rec.idx;
+
+    ctrl_setpoints(&ctrl, &faults, &dp, &prof, &cmd);
+    ctrl_update(&ctrl, &faults, &dp, &dv, &cmd);
+
+    if ( ( dp.i_sp != rec.i_sp ) | ( dp.tps_sp != rec.tps_sp ) ) ++res->sp_mismatch;
+    if ( cmd.ebrake_release && ( res->ebrake_idx < 0 ) ) res->ebrake_idx = rec.idx;
+    if ( faults.trip && ( res->trip_idx < 0 ) ) res->trip_idx = rec.idx;
+    ++res->samples;
+
+    if (verbose)
+    {
+      printf("%u,%.2f,%.2f,%d,%d,%d,%d\n", rec.idx, cmd.throttle, cmd.brake_duty,
+             cmd.ebrake_release, faults.trip, faults.overcurrent_fault, faults.overtemp_fault);
+    }
+  }
+
+  res->overcurrent = faults.overcurrent_fault;
+  res->overtemp = faults.overtemp_fault;
+  res->slip = faults.slip_fault;
+  log_reader_close(&r);
+  return 1;
+}
+
+int main(int argc, char **argv)
+{
+  int profile = 1, verbose = 0, i, files = 0;
+  long total = 0;
+  replay_result res;
+
+  for (i = 1; i < argc; i++)
+  {
+    if ( !strcmp(argv[i], "-p") && ( i + 1 < argc ) ) {
+      profile = atoi(argv[++i]);
+    }
+    else if ( !strcmp(argv[i], "-v") ) {
+      verbose = 1;
+    }
+  }
+
+  double t0 = now_sec();
+  if (verbose) printf("idx,throttle,brake_duty,ebrake_release,trip,overcurrent,overtemp\n");
+  for (i = 1; i < argc; i++)
+  {
+    if ( !strcmp(argv[i], "-p") ) { ++i; continue; }
+    if ( argv[i][0] == '-' ) continue;
+
+    if (!replay_file(argv[i], profile, verbose, &res)) continue;
+    ++files;
+    total += res.samples;
+    fprintf(verbose ? stderr : stdout,
+            "%s: %ld samples, ebrake release @ %ld, trip @ %ld (overcurrent %d, overtemp %d, slip %d), "
+            "%ld set point mismatches\n",
+            argv[i], res.samples, res.ebrake_idx, res.trip_idx, res.overcurrent, res.overtemp, res.slip,
+            res.sp_mismatch);
+  }
+  double dt = now_sec() - t0;
+
+  if (files == 0)
+  {
+    fprintf(stderr, "usage: replay [-p profile] [-v] data_1.bin [data_2.bin ...]\n");
+    return 1;
+  }
+  fprintf(stderr, "replay -- %d files, %ld samples in %.3f s (%.0f samples/s)\n",
+          files, total, dt, dt > 0 ? total / dt : 0.0);
+  return 0;
+}
@@ -0,0 +1,497 @@
+/*
+** run_archive - one line per run across a whole season of logs: peak engine and wheel
+power, the power curve, temperatures and fault ticks. summaries come from the same
+derived_update and thresholds the firmware uses, and are cached next to the archive keyed
+by file content (64 bit FNV-1a), so a re-query only reads logs that are new or changed and
+a renamed or copied log is not summarised twice. files still to summarise are shared out
+over every core.
+
+build:  gcc -O2 -pthread -I../main -o run_archive run_archive.c -lm
+usage:  run_archive [options] runs/ [more/ data_9.bin ...]
+  -c    cache file (default <first dir>/run_archive.cache, or ./run_archive.cache)
+  -j    threads (default all cores)
+  -s    sort by hp (default), whp, rpm, belt, brake, faults, slip, dur, name
+  -m    only runs whose path contains this text
+  -top  show the first n runs after sorting
+  -curve  instead of the table, csv of engine power against rpm, max and mean columns per run,
+          in the bins of the firmware's data_N.crv (curve_update in nubaja_curve.h)
+directories are searched recursively for *.bin.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "nubaja_ctrl.h"
+#include "nubaja_curve.h"
+#include "log_reader.h"
+
+#define ARCH_MAGIC      0x4352424eu     // "NBRC"
+#define ARCH_VERSION    2
+#define ARCH_PATH       256
+
+typedef struct
+{
+  int valid;                  // 0 = not a readable log, kept so it isn't retried
+  uint32_t samples;
+  float duration;             // s, from time_us
+  float peak_hp, peak_rpm;    // engine power and the primary rpm it came at
+  float peak_whp;
+  float max_belt, max_brake;  // deg C
+  float max_i_brake;          // A
+  uint32_t overcurrent, overtemp; // ticks over MAX_I_BRAKE / MAX_BELT_TEMP, MAX_BRAKE_TEMP
+  uint32_t slip;              // slip events, SLIP_TICKS low efficiency ticks in a row
+  int32_t first_fault;        // sample index of the first over limit tick, -1 if none
+  power_curve_t curve;        // as the firmware builds it for data_N.crv
+} run_summary;
+
+typedef struct
+{
+  char path[ARCH_PATH];
+  uint64_t size;
+  int64_t mtime;
+  uint64_t hash;
+  run_summary s;
+} arch_entry;
+
+typedef struct
+{
+  uint32_t magic, version, entry_size, n;
+  uint64_t params;            // summary constants, a change invalidates the whole cache
+} arch_cache_header;
+
+static arch_entry *runs, *cached;
+static long n_runs, cap_runs, n_cached;
+static long next_run, n_hashed, n_summarised;
+static pthread_mutex_t next_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t n)
+{
+  const uint8_t *p = (const uint8_t *) data;
+  while (n--)
+  {
+    h ^= *p++;
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+#define FNV_BASIS 0xcbf29ce484222325ull
+
+// everything a summary depends on besides the log itself
+static uint64_t summary_params()
+{
+  const double k[] = { TORQUE_SCALE, TORQUE_OFFSET, LOAD_CELL_SCALE, LOAD_CELL_OFFSET,
+                       THERM_SCALE, THERM_OFFSET, BELT_TEMP_SCALE, BELT_TEMP_OFFSET,
+                       I_BRAKE_SCALE, I_BRAKE_OFFSET, ADC_FS, MAX_I_BRAKE, MAX_BELT_TEMP,
+                       MAX_BRAKE_TEMP, SLIP_EFFICIENCY, SLIP_MIN_POWER, SLIP_TICKS,
+                       CURVE_BIN_RPM, CURVE_RPM_MAX, LOG_VERSION, LOG_RECORD_SIZE };
+  return fnv1a(FNV_BASIS, k, sizeof(k));
+}
+
+static int file_hash(const char *path, uint64_t *hash)
+{
+  static __thread uint8_t buf[1 << 16];
+  FILE *fp = fopen(path, "rb");
+  size_t n;
+  uint64_t h = FNV_BASIS;
+
+  if (fp == NULL) return 0;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) h = fnv1a(h, buf, n);
+  fclose(fp);
+  *hash = h;
+  return 1;
+}
+
+// the same conversions and limit checks as ctrl_update, over the whole log
+static void summarise(const char *path, run_summary *s)
+{
+  log_reader r;
+  data_point dp;
+  derived_t dv;
+  uint32_t last_us = 0;
+  double dur_us = 0;
+  int slip_run = 0;
+
+  memset(s, 0, sizeof(*s));
+  s->first_fault = -1;
+  if (!log_reader_open(&r, path)) return;
+  s->valid = 1;
+
+  while (log_reader_next(&r, &dp))
+  {
+    float hp, whp, belt, brake, amps;
+    int over = 0;
+
+    if (s->samples > 0) dur_us += (uint32_t) ( dp.time_us - last_us );
+    last_us = dp.time_us;
+    ++s->samples;
+
+    derived_update(&dv, &dp);
+    hp = dv.eng_power / 100.0f;
+    whp = dv.wheel_power / 100.0f;
+    if (hp > s->peak_hp)
+    {
+      s->peak_hp = hp;
+      s->peak_rpm = dp.prim_rpm;
+    }
+    if (whp > s->peak_whp) s->peak_whp = whp;
+    curve_update(&s->curve, &dp, &dv);
+
+    amps = counts_to_volts(dp.i_brake) * I_BRAKE_SCALE + I_BRAKE_OFFSET;
+    brake = counts_to_volts(dp.temp3) * THERM_SCALE + THERM_OFFSET;
+    belt = counts_to_volts(dp.belt_temp) * BELT_TEMP_SCALE + BELT_TEMP_OFFSET;
+    if (s->samples == 1 || amps > s->max_i_brake) s->max_i_brake = amps;
+    if (s->samples == 1 || brake > s->max_brake) s->max_brake = brake;
+    if (s->samples == 1 || belt > s->max_belt) s->max_belt = belt;
+    if (amps > MAX_I_BRAKE)
+    {
+      ++s->overcurrent;
+      over = 1;
+    }
+    if ( ( belt > MAX_BELT_TEMP ) || ( brake > MAX_BRAKE_TEMP ) )
+    {
+      ++s->overtemp;
+      over = 1;
+    }
+    if (over && s->first_fault < 0) s->first_fault = (int32_t) dp.idx;
+
+    if ( ( dv.eng_power >= SLIP_MIN_POWER * 100 ) && ( dv.efficiency < SLIP_EFFICIENCY * 10 ) )
+    {
+      if (++slip_run == SLIP_TICKS) ++s->slip;
+    }
+    else slip_run = 0;
+  }
+  log_reader_close(&r);
+  s->duration = (float) ( dur_us * 1e-6 );
+}
+
+static const arch_entry *cache_find_path(const arch_entry *e)
+{
+  long i;
+  for (i = 0; i < n_cached; i++)
+  {
+    if ( !strcmp(cached[i].path, e->path) && ( cached[i].size == e->size ) &&
+         ( cached[i].mtime == e->mtime ) ) return &cached[i];
+  }
+  return NULL;
+}
+
+static const arch_entry *cache_find_hash(uint64_t hash, uint64_t size)
+{
+  long i;
+  for (i = 0; i < n_cached; i++)
+  {
+    if ( ( cached[i].hash == hash ) && ( cached[i].size == size ) ) return &cached[i];
+  }
+  return NULL;
+}
+
+// unchanged path, size and mtime: cached as is. otherwise hash, and only summarise new content
+static void *archive_worker(void *arg)
+{
+  long i;
+  (void) arg;
+  for (;;)
+  {
+    pthread_mutex_lock(&next_lock);
+    i = next_run++;
+    pthread_mutex_unlock(&next_lock);
+    if (i >= n_runs) break;
+
+    arch_entry *e = &runs[i];
+    const arch_entry *c = cache_find_path(e);
+    if (c == NULL)
+    {
+      if (!file_hash(e->path, &e->hash))
+      {
+        fprintf(stderr, "run_archive -- cannot read %s\n", e->path);
+        continue;
+      }
+      c = cache_find_hash(e->hash, e->size);
+      pthread_mutex_lock(&next_lock);
+      ++n_hashed;
+      n_summarised += ( c == NULL );
+      pthread_mutex_unlock(&next_lock);
+    }
+    if (c != NULL)
+    {
+      e->hash = c->hash;
+      e->s = c->s;
+    }
+    else summarise(e->path, &e->s);
+  }
+  return NULL;
+}
+
+static void cache_load(const char *path)
+{
+  arch_cache_header h;
+  FILE *fp = fopen(path, "rb");
+
+  if (fp == NULL) return;
+  if ( ( fread(&h, sizeof(h), 1, fp) == 1 ) && ( h.magic == ARCH_MAGIC ) &&
+       ( h.version == ARCH_VERSION ) && ( h.entry_size == sizeof(arch_entry) ) &&
+       ( h.params == summary_params() ) )
+  {
+    cached = (arch_entry *) malloc(( h.n + 1 ) * sizeof(arch_entry));
+    if (cached != NULL) n_cached = (long) fread(cached, sizeof(arch_entry), h.n, fp);
+  }
+  else fprintf(stderr, "run_archive -- %s is stale or not a cache, rebuilding\n", path);
+  fclose(fp);
+}
+
+// written beside and renamed over, so an interrupted run leaves the old cache intact
+static void cache_save(const char *path)
+{
+  char tmp[ARCH_PATH + 8];
+  arch_cache_header h = { ARCH_MAGIC, ARCH_VERSION, sizeof(arch_entry), 0, summary_params() };
+  FILE *fp;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  fp = fopen(tmp, "wb");
+  if (fp == NULL)
+  {
+    fprintf(stderr, "run_archive -- cannot write %s\n", tmp);
+    return;
+  }
+  h.n = (uint32_t) n_runs;
+  if ( ( fwrite(&h, sizeof(h), 1, fp) != 1 ) ||
+       ( fwrite(runs, sizeof(arch_entry), n_runs, fp) != (size_t) n_runs ) )
+  {
+    fprintf(stderr, "run_archive -- short write to %s\n", tmp);
+    fclose(fp);
+    remove(tmp);
+    return;
+  }
+  fclose(fp);
+  if (rename(tmp, path) != 0) fprintf(stderr, "run_archive -- cannot replace %s\n", path);
+}
+
+static void add_run(const char *path, const struct stat *st)
+{
+  arch_entry *e;
+  if (strlen(path) >= ARCH_PATH)
+  {
+    fprintf(stderr, "run_archive -- path too long, skipped: %s\n", path);
+    return;
+  }
+  if (n_runs == cap_runs)
+  {
+    cap_runs = cap_runs ? cap_runs * 2 : 256;
+    runs = (arch_entry *) realloc(runs, cap_runs * sizeof(arch_entry));
+    if (runs == NULL)
+    {
+      fprintf(stderr, "run_archive -- out of memory\n");
+      exit(1);
+    }
+  }
+  e = &runs[n_runs++];
+  memset(e, 0, sizeof(*e));
+  strcpy(e->path, path);
+  e->size = (uint64_t) st->st_size;
+  e->mtime = (int64_t) st->st_mtime;
+}
+
+static int is_log(const char *name)
+{
+  size_t n = strlen(name);
+  return ( n > 4 ) && !strcasecmp(name + n - 4, ".bin");
+}
+
+static void scan(const char *path, int top_level)
+{
+  struct stat st;
+  DIR *d;
+  struct dirent *de;
+  char sub[ARCH_PATH + 256];
+
+  if (stat(path, &st) != 0)
+  {
+    fprintf(stderr, "run_archive -- cannot stat %s\n", path);
+    return;
+  }
+  if (!S_ISDIR(st.st_mode))
+  {
+    if (top_level || is_log(path)) add_run(path, &st);
+    return;
+  }
+  d = opendir(path);
+  if (d == NULL) return;
+  while ((de = readdir(d)) != NULL)
+  {
+    if (de->d_name[0] == '.') continue;
+    snprintf(sub, sizeof(sub), "%s/%s", path, de->d_name);
+    if (stat(sub, &st) != 0) continue;
+    if (S_ISDIR(st.st_mode) || is_log(de->d_name)) scan(sub, 0);
+  }
+  closedir(d);
+}
+
+static int sort_key;
+enum { KEY_HP, KEY_WHP, KEY_RPM, KEY_BELT, KEY_BRAKE, KEY_FAULTS, KEY_SLIP, KEY_DUR, KEY_NAME };
+static const char *key_names[] = { "hp", "whp", "rpm", "belt", "brake", "faults", "slip", "dur", "name" };
+
+static double key_value(const arch_entry *e)
+{
+  switch (sort_key)
+  {
+    case KEY_WHP: return e->s.peak_whp;
+    case KEY_RPM: return e->s.peak_rpm;
+    case KEY_BELT: return e->s.max_belt;
+    case KEY_BRAKE: return e->s.max_brake;
+    case KEY_FAULTS: return (double) e->s.overcurrent + e->s.overtemp;
+    case KEY_SLIP: return e->s.slip;
+    case KEY_DUR: return e->s.duration;
+    default: return e->s.peak_hp;
+  }
+}
+
+// biggest first, name ascending, unreadable files last
+static int cmp_runs(const void *pa, const void *pb)
+{
+  const arch_entry *a = (const arch_entry *) pa, *b = (const arch_entry *) pb;
+  double d;
+  if (a->s.valid != b->s.valid) return b->s.valid - a->s.valid;
+  if (sort_key == KEY_NAME) return strcmp(a->path, b->path);
+  d = key_value(b) - key_value(a);
+  return ( d > 0 ) - ( d < 0 );
+}
+
+static void print_table(arch_entry **sel, int n)
+{
+  int i;
+  printf("%-40s %8s %7s %7s %6s %6s %6s %6s %6s %6s %5s %8s\n", "run", "samples", "dur_s",
+         "hp", "@rpm", "whp", "belt", "brake", "amps", "faults", "slip", "first");
+  for (i = 0; i < n; i++)
+  {
+    const run_summary *s = &sel[i]->s;
+    if (!s->valid)
+    {
+      printf("%-40s not a version %d log\n", sel[i]->path, LOG_VERSION);
+      continue;
+    }
+    printf("%-40s %8u %7.1f %7.2f %6.0f %6.2f %6.1f %6.1f %6.2f %6u %5u %8d\n", sel[i]->path,
+           s->samples, s->duration, s->peak_hp, s->peak_rpm, s->peak_whp, s->max_belt,
+           s->max_brake, s->max_i_brake, s->overcurrent + s->overtemp, s->slip, s->first_fault);
+  }
+}
+
+static void print_curves(arch_entry **sel, int n)
+{
+  int i, b;
+  printf("rpm");
+  for (i = 0; i < n; i++) printf(",%s max,%s mean", sel[i]->path, sel[i]->path);
+  printf("\n");
+  for (b = 0; b < CURVE_BINS; b++)
+  {
+    printf("%d", b * CURVE_BIN_RPM);
+    for (i = 0; i < n; i++)
+    {
+      const curve_bin_t *bin = &sel[i]->s.curve.eng[b];
+      if (bin->n == 0) printf(",,");
+      else printf(",%.2f,%.2f", bin->power_max / 100.0f, bin->power_sum / (float) bin->n / 100);
+    }
+    printf("\n");
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int threads = (int) sysconf(_SC_NPROCESSORS_ONLN), top = 0, curve = 0;
+  const char *cache_path = NULL, *match = NULL;
+  char default_cache[ARCH_PATH];
+  pthread_t *tid;
+  arch_entry **sel;
+  long i, n_sel = 0;
+  int a, k, ok;
+  double t0 = now_sec();
+
+  for (a = 1; a < argc && argv[a][0] == '-'; a++)
+  {
+    const char *opt = argv[a], *val = ( a + 1 < argc ) ? argv[a + 1] : NULL;
+    ok = 1;
+    if (!strcmp(opt, "-curve"))
+    {
+      curve = 1;
+      continue;
+    }
+    if (val == NULL) ok = 0;
+    else if (!strcmp(opt, "-c")) cache_path = val;
+    else if (!strcmp(opt, "-j")) ok = ( threads = atoi(val) ) > 0;
+    else if (!strcmp(opt, "-m")) match = val;
+    else if (!strcmp(opt, "-top")) top = atoi(val);
+    else if (!strcmp(opt, "-s"))
+    {
+      ok = 0;
+      for (k = 0; k <= KEY_NAME; k++)
+      {
+        if (!strcmp(val, key_names[k])) ok = 1, sort_key = k;
+      }
+    }
+    else ok = 0;
+    if (!ok)
+    {
+      fprintf(stderr, "run_archive -- bad option %s %s\n", opt, val ? val : "");
+      return 1;
+    }
+    ++a;
+  }
+  if (a >= argc)
+  {
+    fprintf(stderr, "usage: run_archive [-c cache] [-j n] [-s key] [-m text] [-top n] [-curve] "
+            "runs/ [data_1.bin ...]\n");
+    return 1;
+  }
+
+  for (k = a; k < argc; k++) scan(argv[k], 1);
+  if (cache_path == NULL)
+  {
+    struct stat st;
+    if (stat(argv[a], &st) == 0 && S_ISDIR(st.st_mode))
+      snprintf(default_cache, sizeof(default_cache), "%s/run_archive.cache", argv[a]);
+    else snprintf(default_cache, sizeof(default_cache), "run_archive.cache");
+    cache_path = default_cache;
+  }
+
+  cache_load(cache_path);
+  tid = (pthread_t *) malloc(threads * sizeof(pthread_t));
+  for (k = 0; k < threads; k++) pthread_create(&tid[k], NULL, archive_worker, NULL);
+  for (k = 0; k < threads; k++) pthread_join(tid[k], NULL);
+  free(tid);
+  if ( ( n_hashed > 0 ) || ( n_runs != n_cached ) ) cache_save(cache_path);
+
+  sel = (arch_entry **) malloc(( n_runs + 1 ) * sizeof(arch_entry *));
+  qsort(runs, n_runs, sizeof(arch_entry), cmp_runs);
+  for (i = 0; i < n_runs; i++)
+  {
+    if (match != NULL && strstr(runs[i].path, match) == NULL) continue;
+    if (curve && !runs[i].s.valid) continue;
+    sel[n_sel++] = &runs[i];
+  }
+  if (top > 0 && n_sel > top) n_sel = top;
+
+  if (curve) print_curves(sel, (int) n_sel);
+  else print_table(sel, (int) n_sel);
+
+  fprintf(stderr, "run_archive -- %ld runs, %ld summarised, %ld from cache, %.3f s\n", n_runs,
+          n_summarised, n_runs - n_summarised, now_sec() - t0);
+  free(sel);
+  free(runs);
+  free(cached);
+  return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef SIM_DRIVER_I2C_H_
+#define SIM_DRIVER_I2C_H_
+
+#include <stdint.h>
+
+/*
+** host stand-in for the ESP-IDF v3 I2C master driver, just enough for main/nubaja_i2c.h to
+build unchanged. command links are recorded and played against the device models in
+i2c_sim.c, which also works out how long the transaction holds the bus.
+*/
+
+typedef int esp_err_t;
+typedef int i2c_port_t;
+typedef uint32_t TickType_t;
+typedef int portMUX_TYPE;
+
+#define ESP_OK                      0
+#define ESP_FAIL                    -1
+#define ESP_ERR_TIMEOUT             0x107
+
+#define I2C_NUM_0                   0
+#define I2C_NUM_1                   1
+#define I2C_NUM_MAX                 2
+#define I2C_MODE_MASTER             1
+#define I2C_MASTER_WRITE            0
+#define I2C_MASTER_READ             1
+#define GPIO_PULLUP_DISABLE         0
+
+// the FreeRTOS tick is a simulation setting, so I2C_TASK_LENGTH / portTICK_RATE_MS
+// rounds the way it does on the target
+extern int sim_tick_hz;
+#define portTICK_RATE_MS            ( 1000 / sim_tick_hz )
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux)     ( (void) (mux) )
+#define portEXIT_CRITICAL(mux)      ( (void) (mux) )
+
+typedef struct
+{
+  int mode;
+  int sda_io_num, sda_pullup_en;
+  int scl_io_num, scl_pullup_en;
+  struct
+  {
+    uint32_t clk_speed;
+  } master;
+} i2c_config_t;
+
+typedef struct i2c_cmd_link *i2c_cmd_handle_t;
+
+esp_err_t i2c_param_config(i2c_port_t port, const i2c_config_t *conf);
+esp_err_t i2c_driver_install(i2c_port_t port, int mode, int rx_buf, int tx_buf, int intr_flags);
+i2c_cmd_handle_t i2c_cmd_link_create();
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd);
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd);
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd);
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd, uint8_t data, int ack_en);
+esp_err_t i2c_master_read_byte(i2c_cmd_handle_t cmd, uint8_t *data, int ack);
+esp_err_t i2c_master_cmd_begin(i2c_port_t port, i2c_cmd_handle_t cmd, TickType_t ticks_to_wait);
+
+#endif // SIM_DRIVER_I2C_H_
@@ -0,0 +1,156 @@
+#ifndef SIM_ESP_PARTITION_H_
+#define SIM_ESP_PARTITION_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+** host stand-in for the ESP-IDF partition api, one data partition emulated in a file so
+main/nubaja_stage.h builds unchanged. it behaves like NOR flash: erase sets whole 4 KB
+sectors to 0xff, a write can only clear bits (a write that would set one is counted, and
+ANDed in as the part does), and every erase is counted per sector for the
+wear report. sim_flash_open picks the file and size before stage_init looks the partition up;
+fail_after cuts the power part way through a write, every write and erase fails from then on.
+*/
+
+#ifndef SIM_ESP_ERR_T
+#define SIM_ESP_ERR_T
+typedef int esp_err_t;
+#define ESP_OK                      0
+#define ESP_FAIL                    -1
+#endif
+#define ESP_ERR_INVALID_ARG         0x102
+#define ESP_ERR_INVALID_SIZE        0x104
+
+#define SIM_FLASH_SECTOR            4096
+
+typedef enum { ESP_PARTITION_TYPE_APP = 0, ESP_PARTITION_TYPE_DATA = 1 } esp_partition_type_t;
+typedef int esp_partition_subtype_t;
+#define ESP_PARTITION_SUBTYPE_ANY   0xff
+
+typedef struct
+{
+  esp_partition_type_t type;
+  esp_partition_subtype_t subtype;
+  uint32_t address;
+  uint32_t size;
+  char label[17];
+} esp_partition_t;
+
+typedef struct
+{
+  esp_partition_t part;
+  FILE *fp;
+  uint32_t *erases;         // per sector
+  uint32_t bad_writes;      // writes that tried to set a bit
+  uint32_t fail_after;      // fail every write and erase once this many bytes are written, 0 = never
+  uint64_t written;
+} sim_flash_t;
+
+static sim_flash_t sim_flash;
+
+// back the partition with path, created erased at size bytes if it does not exist
+static int sim_flash_open(const char *path, const char *label, uint32_t size)
+{
+  uint8_t ff[SIM_FLASH_SECTOR];
+  uint32_t off;
+
+  memset(&sim_flash, 0, sizeof(sim_flash));
+  sim_flash.fp = fopen(path, "r+b");
+  if (sim_flash.fp == NULL)
+  {
+    sim_flash.fp = fopen(path, "w+b");
+    if (sim_flash.fp == NULL) return 0;
+    memset(ff, 0xff, sizeof(ff));
+    for (off = 0; off < size; off += SIM_FLASH_SECTOR) fwrite(ff, SIM_FLASH_SECTOR, 1, sim_flash.fp);
+  }
+  fseek(sim_flash.fp, 0, SEEK_END);
+  sim_flash.part.type = ESP_PARTITION_TYPE_DATA;
+  sim_flash.part.subtype = 0x40;
+  sim_flash.part.size = (uint32_t) ftell(sim_flash.fp) / SIM_FLASH_SECTOR * SIM_FLASH_SECTOR;
+  snprintf(sim_flash.part.label, sizeof(sim_flash.part.label), "%s", label);
+  sim_flash.erases = (uint32_t *) calloc(sim_flash.part.size / SIM_FLASH_SECTOR, sizeof(uint32_t));
+  return 1;
+}
+
+static void sim_flash_close()
+{
+  if (sim_flash.fp != NULL) fclose(sim_flash.fp);
+  free(sim_flash.erases);
+  memset(&sim_flash, 0, sizeof(sim_flash));
+}
+
+static const esp_partition_t *esp_partition_find_first(esp_partition_type_t type,
+                                                       esp_partition_subtype_t subtype, const char *label)
+{
+  if ( (sim_flash.fp == NULL) || (type != sim_flash.part.type) ||
+       ( (subtype != ESP_PARTITION_SUBTYPE_ANY) && (subtype != sim_flash.part.subtype) ) ||
+       ( (label != NULL) && strcmp(label, sim_flash.part.label) ) )
+  {
+    return NULL;
+  }
+  return &sim_flash.part;
+}
+
+static esp_err_t esp_partition_read(const esp_partition_t *part, size_t offset, void *dst, size_t size)
+{
+  if (offset + size > part->size) return ESP_ERR_INVALID_SIZE;
+  fseek(sim_flash.fp, (long) offset, SEEK_SET);
+  return (fread(dst, 1, size, sim_flash.fp) == size) ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t esp_partition_write(const esp_partition_t *part, size_t offset, const void *src, size_t size)
+{
+  const uint8_t *p = (const uint8_t *) src;
+  uint8_t old[256];
+  size_t k, n;
+
+  if (offset + size > part->size) return ESP_ERR_INVALID_SIZE;
+  while (size > 0)
+  {
+    n = (size < sizeof(old)) ? size : sizeof(old);
+    if (sim_flash.fail_after)
+    {
+      if (sim_flash.written >= sim_flash.fail_after) return ESP_FAIL;
+      if (sim_flash.written + n > sim_flash.fail_after) n = sim_flash.fail_after - sim_flash.written;
+    }
+    fseek(sim_flash.fp, (long) offset, SEEK_SET);
+    if (fread(old, 1, n, sim_flash.fp) != n) return ESP_FAIL;
+    for (k = 0; k < n; k++)
+    {
+      if (p[k] & ~old[k]) ++sim_flash.bad_writes;
+      old[k] &= p[k];
+    }
+    fseek(sim_flash.fp, (long) offset, SEEK_SET);
+    fwrite(old, 1, n, sim_flash.fp);
+    sim_flash.written += n;
+    offset += n;
+    p += n;
+    size -= n;
+  }
+  fflush(sim_flash.fp);
+  return ESP_OK;
+}
+
+static esp_err_t esp_partition_erase_range(const esp_partition_t *part, size_t offset, size_t size)
+{
+  uint8_t ff[SIM_FLASH_SECTOR];
+  size_t off;
+
+  if ( (offset % SIM_FLASH_SECTOR) || (size % SIM_FLASH_SECTOR) ) return ESP_ERR_INVALID_ARG;
+  if (offset + size > part->size) return ESP_ERR_INVALID_SIZE;
+  if ( sim_flash.fail_after && (sim_flash.written >= sim_flash.fail_after) ) return ESP_FAIL;
+  memset(ff, 0xff, sizeof(ff));
+  fseek(sim_flash.fp, (long) offset, SEEK_SET);
+  for (off = 0; off < size; off += SIM_FLASH_SECTOR)
+  {
+    fwrite(ff, SIM_FLASH_SECTOR, 1, sim_flash.fp);
+    ++sim_flash.erases[(offset + off) / SIM_FLASH_SECTOR];
+  }
+  fflush(sim_flash.fp);
+  return ESP_OK;
+}
+
+#endif // SIM_ESP_PARTITION_H_
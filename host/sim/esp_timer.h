@@ -0,0 +1,9 @@
+#ifndef SIM_ESP_TIMER_H_
+#define SIM_ESP_TIMER_H_
+
+#include <stdint.h>
+
+// host stand-in for the ESP-IDF header: time is the simulated bus time, see i2c_sim.c
+int64_t esp_timer_get_time();
+
+#endif // SIM_ESP_TIMER_H_
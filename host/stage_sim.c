@@ -0,0 +1,354 @@
+/*
+** stage_sim - the flash staging ring (nubaja_stage.h) run against a simulated card, to check
+that a run that outlasts a stalled or missing SD card still reaches the card whole and in
+order, and how the ring wears. the firmware's ring code is built unchanged over a file backed
+NOR partition (sim/esp_partition.h). each run logs synthetic samples a logging queue at a
+time: straight into its log while the card keeps up and the ring is empty, into the ring
+while the card is stalled, and behind the ring (staged, then the ring moved over) otherwise,
+as nubaja_sd.h does. between runs the ring is erased as stage_task does. the logs are then
+read back with log_reader and every sample index checked.
+
+-cut cuts the power once that many bytes have been written to the flash: the run stops,
+the ring is rebuilt by stage_init as at the next boot, and what it held is moved to the card.
+
+build:  gcc -O2 -Wall -Isim -I../main -o stage_sim stage_sim.c
+usage:  stage_sim [options]
+  -hz     sample rate, Hz (default 1000)
+  -t      seconds per run (default 60)
+  -runs   runs (default 3)
+  -q      records per logging queue (default 1500, LOGGING_QUEUE_SIZE)
+  -stall  start:len, the card takes nothing for len seconds from start in every run. repeats
+  -nocard no card: every run is staged, and moved to the card at the end
+  -cut    power cut after this many bytes written to the flash
+  -size   partition size, KB (default 1024)
+  -o      file prefix for the flash image and logs (default /tmp/stage_sim)
+exits 1 if a sample is missing, duplicated or out of order for any other reason than the ring
+running full (refused) or a torn entry (lost).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "esp_partition.h"
+#include "nubaja_log_format.h"
+#include "nubaja_stage.h"
+#include "log_reader.h"
+
+#define MAX_STALLS    8
+#define MAX_RUNS      64
+
+typedef struct
+{
+  int hz, t, runs, q, nocard, size_kb;
+  uint32_t cut;
+  int n_stalls;
+  double stall_start[MAX_STALLS], stall_len[MAX_STALLS];
+  const char *prefix;
+} sim_opts;
+
+// one log on the simulated card
+typedef struct
+{
+  char name[256];
+  uint32_t blocks;
+  uint32_t samples;       // samples the run logged
+  uint32_t run;           // stage run moved into it, for runs staged without a card
+} sim_log;
+
+static sim_opts opt = { 1000, 60, 3, 1500, 0, 1024, 0, 0, { 0 }, { 0 }, "/tmp/stage_sim" };
+static sim_log logs[MAX_RUNS + 1];     // by file number, 1 on
+static stage_t stage;
+static uint8_t block[LOG_BLOCK_SIZE];
+static data_point queue[LOG_BLOCK_SAMPLES * 32];
+static uint32_t direct, staged_queues;
+
+static int card_stalled(double t)
+{
+  int k;
+  if (opt.nocard) return 1;
+  for (k = 0; k < opt.n_stalls; k++)
+  {
+    if ( (t >= opt.stall_start[k]) && (t < opt.stall_start[k] + opt.stall_len[k]) ) return 1;
+  }
+  return 0;
+}
+
+static void log_create(int num)
+{
+  log_file_header fh;
+  FILE *fp;
+
+  snprintf(logs[num].name, sizeof(logs[num].name), "%s_%d.bin", opt.prefix, num);
+  logs[num].blocks = 0;
+  fp = fopen(logs[num].name, "wb");
+  if (fp == NULL)
+  {
+    fprintf(stderr, "stage_sim -- cannot create %s\n", logs[num].name);
+    exit(2);
+  }
+  log_file_header_init(&fh, opt.hz);
+  fwrite(&fh, sizeof(fh), 1, fp);
+  fclose(fp);
+}
+
+// n records at the end of a log as blocks of their own, like log_write_queue and log_append_block
+static void log_append(int num, const data_point *recs, int n)
+{
+  data_point *b = (data_point *) ( block + sizeof(log_block_header) );
+  FILE *fp = fopen(logs[num].name, "r+b");
+  int k;
+
+  if (fp == NULL)
+  {
+    fprintf(stderr, "stage_sim -- cannot open %s\n", logs[num].name);
+    exit(2);
+  }
+  fseek(fp, sizeof(log_file_header) + logs[num].blocks * LOG_BLOCK_SIZE, SEEK_SET);
+  while (n > 0)
+  {
+    k = (n < LOG_BLOCK_SAMPLES) ? n : LOG_BLOCK_SAMPLES;
+    memcpy(b, recs, k * sizeof(data_point));
+    memset(b + k, 0, (LOG_BLOCK_SAMPLES - k) * sizeof(data_point));
+    log_summarise_block((log_block_header *) block, logs[num].blocks, b, k);
+    log_seal_block(block);
+    fwrite(block, LOG_BLOCK_SIZE, 1, fp);
+    ++logs[num].blocks;
+    recs += k;
+    n -= k;
+  }
+  fclose(fp);
+}
+
+static void stage_queue(const data_point *recs, int n, int num)
+{
+  int k = 0, open = 0;
+
+  while (k < n)
+  {
+    if ( !open && !stage_begin(&stage, num) )
+    {
+      stage.refused += n - k;
+      return;
+    }
+    open = 1;
+    k += stage_add(&stage, &recs[k], n - k);
+    if (stage_room(&stage) == 0)
+    {
+      stage_end(&stage, STAGE_RECORDS);
+      open = 0;
+    }
+  }
+  if (open) stage_end(&stage, STAGE_RECORDS);
+}
+
+// the log a staged entry belongs in. runs staged without a card get the next free number
+static int migrate_target(const stage_entry_header *hdr)
+{
+  int num;
+
+  if (hdr->file_num != 0) return hdr->file_num;
+  for (num = 1; num <= MAX_RUNS; num++)
+  {
+    if (logs[num].run == hdr->run) return num;
+  }
+  for (num = 1; (num <= MAX_RUNS) && logs[num].name[0]; num++) ;
+  if (num > MAX_RUNS)
+  {
+    fprintf(stderr, "stage_sim -- more than %d logs\n", MAX_RUNS);
+    exit(2);
+  }
+  log_create(num);
+  logs[num].run = hdr->run;
+  return num;
+}
+
+// the ring onto the card, oldest entry first, as stage_migrate does
+static void migrate()
+{
+  data_point recs[STAGE_SLOTS];
+  stage_entry_header hdr;
+  int got, ok;
+
+  while ( (got = stage_peek(&stage, &hdr)) != 0 )
+  {
+    if (got < 0)
+    {
+      stage_pop(&stage, 0, 0);
+      continue;
+    }
+    ok = stage_read(&stage, &hdr, recs);
+    if ( ok && (hdr.kind == STAGE_RECORDS) ) log_append(migrate_target(&hdr), recs, hdr.n);
+    stage_pop(&stage, ok, hdr.n);
+  }
+}
+
+// one run. 0 if the power was cut part way
+static int run(int num)
+{
+  uint32_t n = (uint32_t) opt.hz * opt.t, idx = 0;
+  int k, file_num = opt.nocard ? 0 : num;
+
+  if (!opt.nocard) log_create(num);
+  stage_new_run(&stage);
+  while (idx < n)
+  {
+    for (k = 0; (k < opt.q) && (idx < n); k++, idx++)
+    {
+      memset(&queue[k], 0, sizeof(data_point));
+      queue[k].idx = idx;
+      queue[k].time_us = (uint32_t) ( (uint64_t) idx * 1000000 / opt.hz );
+      queue[k].prim_rpm = (uint16_t) ( num * 1000 + idx % 1000 );
+    }
+    logs[num].samples += k;
+
+    // the queue is full at time idx / hz, the writer finds the card as it is then
+    if ( !card_stalled((double) idx / opt.hz) && (stage.pending == 0) )
+    {
+      log_append(num, queue, k);
+      ++direct;
+    }
+    else
+    {
+      stage_queue(queue, k, file_num);
+      ++staged_queues;
+      if (!card_stalled((double) idx / opt.hz)) migrate();
+    }
+    if ( sim_flash.fail_after && (sim_flash.written >= sim_flash.fail_after) )
+    {
+      printf("power cut in run %d at sample %u, %u bytes into the flash\n",
+             num, (unsigned) idx, (unsigned) sim_flash.written);
+      return 0;
+    }
+  }
+  if (!card_stalled((double) n / opt.hz)) migrate();
+  return 1;
+}
+
+// every log read back: each run's samples once each and in order
+static int verify(int runs)
+{
+  log_reader r;
+  data_point dp;
+  uint32_t expect, got, gaps, all_gaps = 0, bad = 0, missing = 0;
+  int num;
+
+  for (num = 1; num <= MAX_RUNS; num++)
+  {
+    if (!logs[num].name[0]) continue;
+    if (!log_reader_open(&r, logs[num].name)) return 0;
+    expect = 0;
+    got = 0;
+    gaps = 0;
+    while (log_reader_next(&r, &dp))
+    {
+      if (dp.idx < expect) ++bad;
+      else if (dp.idx > expect) ++gaps;
+      expect = dp.idx + 1;
+      ++got;
+    }
+    log_reader_close(&r);
+    all_gaps += gaps;
+    printf("%s: %u samples in %u blocks, %u gaps%s\n", logs[num].name, (unsigned) got,
+           (unsigned) logs[num].blocks, (unsigned) gaps, bad ? ", OUT OF ORDER" : "");
+    missing -= got;
+  }
+  for (num = 1; num <= runs; num++) missing += logs[num].samples;
+  printf("samples missing: %u (refused %u, in %u lost entries%s)\n", (unsigned) missing,
+         (unsigned) stage.refused, (unsigned) stage.lost, opt.cut ? ", the rest at the power cut" : "");
+  if ( (stage.refused > 0) || (stage.lost > 0) ) return bad == 0;
+  // a power cut loses the end of its run, never samples in between
+  return (bad == 0) && (all_gaps == 0) && ( opt.cut || (missing == 0) );
+}
+
+static void print_wear()
+{
+  uint32_t k, lo = UINT32_MAX, hi = 0, sectors = sim_flash.part.size / SIM_FLASH_SECTOR;
+
+  for (k = 0; k < sectors; k++)
+  {
+    if (sim_flash.erases[k] < lo) lo = sim_flash.erases[k];
+    if (sim_flash.erases[k] > hi) hi = sim_flash.erases[k];
+  }
+  printf("wear: %u sectors, %u to %u erases each, %u writes that set a bit\n",
+         (unsigned) sectors, (unsigned) lo, (unsigned) hi, (unsigned) sim_flash.bad_writes);
+}
+
+int main(int argc, char **argv)
+{
+  char path[256];
+  int i, num, done = 0;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-hz") && (i + 1 < argc)) opt.hz = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-t") && (i + 1 < argc)) opt.t = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-runs") && (i + 1 < argc)) opt.runs = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-q") && (i + 1 < argc)) opt.q = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-nocard")) opt.nocard = 1;
+    else if (!strcmp(argv[i], "-cut") && (i + 1 < argc)) opt.cut = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "-size") && (i + 1 < argc)) opt.size_kb = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-o") && (i + 1 < argc)) opt.prefix = argv[++i];
+    else if (!strcmp(argv[i], "-stall") && (i + 1 < argc) && (opt.n_stalls < MAX_STALLS))
+    {
+      if (sscanf(argv[++i], "%lf:%lf", &opt.stall_start[opt.n_stalls], &opt.stall_len[opt.n_stalls]) != 2)
+      {
+        fprintf(stderr, "stage_sim -- -stall takes start:len\n");
+        return 2;
+      }
+      ++opt.n_stalls;
+    }
+    else
+    {
+      fprintf(stderr, "usage: stage_sim [-hz n] [-t s] [-runs n] [-q n] [-stall start:len] [-nocard] "
+                      "[-cut bytes] [-size kb] [-o prefix]\n");
+      return 2;
+    }
+  }
+  if ( (opt.hz <= 0) || (opt.t <= 0) || (opt.runs <= 0) || (opt.runs > MAX_RUNS) ||
+       (opt.q <= 0) || (opt.q > (int) (sizeof(queue) / sizeof(queue[0]))) )
+  {
+    fprintf(stderr, "stage_sim -- bad option value\n");
+    return 2;
+  }
+
+  // a fresh, erased partition
+  snprintf(path, sizeof(path), "%s.flash", opt.prefix);
+  remove(path);
+  if (!sim_flash_open(path, STAGE_PARTITION_LABEL, opt.size_kb * 1024))
+  {
+    fprintf(stderr, "stage_sim -- cannot create %s\n", path);
+    return 2;
+  }
+  stage_init(&stage);
+  sim_flash.fail_after = opt.cut;
+
+  for (num = 1; num <= opt.runs; num++)
+  {
+    done = num;
+    if (!run(num)) break;
+    stage_print(&stage);
+    // between runs: the erases stage_task does while nothing is logged
+    while (stage_erase(&stage, 1) > 0) ;
+  }
+
+  print_wear();
+  if (done < opt.runs || opt.cut)
+  {
+    // the next boot rebuilds the ring from the flash alone
+    sim_flash_close();
+    if (!sim_flash_open(path, STAGE_PARTITION_LABEL, opt.size_kb * 1024)) return 2;
+    stage_init(&stage);
+  }
+  // a card is there by now: what is left in the ring goes onto it
+  opt.nocard = 0;
+  opt.n_stalls = 0;
+  migrate();
+  stage_print(&stage);
+
+  printf("%u queues straight to the card, %u through the ring\n", (unsigned) direct, (unsigned) staged_queues);
+  i = verify(done);
+  sim_flash_close();
+  return i ? 0 : 1;
+}
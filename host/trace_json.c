@@ -0,0 +1,291 @@
+/*
+** trace_json - turns the timeline trace of a run (data_N.trc, nubaja_trace.h) into Chrome trace
+event JSON, for chrome://tracing or ui.perfetto.dev. every begin / end pair becomes one span
+on the row of its task or ISR (a row per core for ISRs), marks become instants, and the point
+a frozen ring was centred on is marked "freeze". I2C and flash ring spans go on the row of the
+span open around them on their core, so a transaction shows under the task that made it.
+
+times are esp_timer microseconds, the clock of data_point.time_us, so a late tick in the log
+is found at the same time on the timeline. each core's cycle counts are placed by its own
+sync pairs (see TIMELINE TRACE FILE in nubaja_log_format.h), then the events are sorted.
+
+build:  gcc -O2 -I../main -o trace_json trace_json.c
+usage:  trace_json data_3.trc > data_3.json
+JSON on stdout. a table of count, mean and worst duration of each span goes to stderr.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nubaja_log_format.h"
+
+#define TID_ISR       100         // + core
+#define TID_CORE      200         // + core, CALLER events with nothing open around them
+#define MAX_OPEN      64          // spans open at once on one core
+
+typedef struct
+{
+  trace_event e;
+  uint32_t pos;       // in the file
+  int core;
+  double ts;          // esp_timer us
+} ev_t;
+
+typedef struct
+{
+  int id, tid;
+  uint16_t arg;
+  double ts;
+} open_t;
+
+typedef struct
+{
+  uint32_t n;
+  double sum, max, max_ts;
+} span_stats_t;
+
+static span_stats_t stats[TRACE_NUM_EVENTS];
+static int tid_used[TID_CORE + 2];
+static int n_out;
+
+static int ev_cmp(const void *a, const void *b)
+{
+  const ev_t *x = (const ev_t *) a, *y = (const ev_t *) b;
+
+  if (x->ts != y->ts) return (x->ts < y->ts) ? -1 : 1;
+  return (x->pos < y->pos) ? -1 : (x->pos > y->pos);
+}
+
+static void out_sep()
+{
+  printf(n_out++ ? ",\n" : "\n");
+}
+
+static void out_args(int id, uint16_t arg, const char *extra, uint16_t extra_val)
+{
+  const char *name = trace_event_args[id];
+
+  printf(", \"args\": {");
+  if (name[0]) printf("\"%s\": %u", name, (unsigned) arg);
+  if (extra) printf("%s\"%s\": %u", name[0] ? ", " : "", extra, (unsigned) extra_val);
+  printf("}");
+}
+
+static void out_span(const open_t *o, double ts_end, uint16_t end_arg)
+{
+  span_stats_t *s = &stats[o->id];
+  double dur = ts_end - o->ts;
+
+  out_sep();
+  printf("{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+         trace_event_names[o->id], o->tid, o->ts, dur);
+  out_args(o->id, o->arg, ( end_arg != o->arg ) ? "end" : NULL, end_arg);
+  printf("}");
+  tid_used[o->tid] = 1;
+
+  ++s->n;
+  s->sum += dur;
+  if (dur > s->max)
+  {
+    s->max = dur;
+    s->max_ts = o->ts;
+  }
+}
+
+static void out_instant(const char *name, int tid, double ts, const char *scope, int id, uint16_t arg)
+{
+  out_sep();
+  printf("{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"%s\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f",
+         name, scope, tid, ts);
+  if (id >= 0) out_args(id, arg, NULL, 0);
+  printf("}");
+  tid_used[tid] = 1;
+}
+
+static void out_thread_name(int tid, const char *name, int core)
+{
+  out_sep();
+  if (core >= 0) printf("{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, "
+                        "\"args\": {\"name\": \"core %d %s\"}}", tid, core, name);
+  else printf("{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, "
+              "\"args\": {\"name\": \"%s\"}}", tid, name);
+  out_sep();
+  printf("{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, \"args\": {\"sort_index\": %d}}",
+         tid, tid);
+}
+
+// esp_timer time of every event from the sync pairs of its core. 0 if a core has none
+static int place_events(ev_t *ev, uint32_t n, double mhz)
+{
+  uint32_t i, sync_cycles[2] = { 0, 0 }, last_us = 0;
+  double sync_us[2] = { 0, 0 }, us = 0;
+  int have[2] = { 0, 0 }, any = 0, c;
+
+  // the first sync of each core places the events ahead of it
+  for (i = 0; i + 1 < n; i++)
+  {
+    c = ev[i].core;
+    if ( (ev[i].e.id != TRACE_sync) || (ev[i + 1].e.id != TRACE_sync_time) || have[c] ) continue;
+    us = any ? us + (int32_t) (ev[i + 1].e.cycles - last_us) : ev[i + 1].e.cycles;
+    last_us = ev[i + 1].e.cycles;
+    any = 1;
+    have[c] = 1;
+    sync_cycles[c] = ev[i].e.cycles;
+    sync_us[c] = us;
+  }
+  if (!any) return 0;
+
+  // then every sync re-anchors its core, the 32 bit esp_timer time unwrapped on the way
+  us = 0;
+  any = 0;
+  for (i = 0; i < n; i++)
+  {
+    c = ev[i].core;
+    if ( (ev[i].e.id == TRACE_sync) && (i + 1 < n) && (ev[i + 1].e.id == TRACE_sync_time) )
+    {
+      us = any ? us + (int32_t) (ev[i + 1].e.cycles - last_us) : ev[i + 1].e.cycles;
+      last_us = ev[i + 1].e.cycles;
+      any = 1;
+      sync_cycles[c] = ev[i].e.cycles;
+      sync_us[c] = us;
+    }
+    if (!have[c])
+    {
+      fprintf(stderr, "trace_json -- core %d has no sync, its events are dropped\n", c);
+      have[c] = -1;
+    }
+    ev[i].ts = (have[c] > 0) ? sync_us[c] + (int32_t) (ev[i].e.cycles - sync_cycles[c]) / mhz : -1;
+    if ( (ev[i].e.id == TRACE_sync_time) && (i > 0) ) ev[i].ts = ev[i - 1].ts;
+  }
+  return 1;
+}
+
+int main(int argc, char **argv)
+{
+  trace_file_header th;
+  ev_t *ev;
+  open_t open[2][MAX_OPEN];
+  int n_open[2] = { 0, 0 };
+  uint32_t i, n, unmatched = 0, unfinished = 0;
+  double freeze_ts = -1;
+  int c, k, id, tid, phase, track;
+  FILE *fp;
+
+  if (argc != 2)
+  {
+    fprintf(stderr, "usage: trace_json data_N.trc > data_N.json\n");
+    return 1;
+  }
+  fp = fopen(argv[1], "rb");
+  if (fp == NULL)
+  {
+    fprintf(stderr, "trace_json -- cannot open %s\n", argv[1]);
+    return 1;
+  }
+  if ( (fread(&th, sizeof(th), 1, fp) != 1) || (th.magic != TRACE_MAGIC) || (th.version != TRACE_VERSION) ||
+       (th.event_size != sizeof(trace_event)) || (th.cpu_mhz == 0) )
+  {
+    fprintf(stderr, "trace_json -- %s is not a version %d nubaja trace\n", argv[1], TRACE_VERSION);
+    return 1;
+  }
+  ev = (ev_t *) calloc(th.n_events ? th.n_events : 1, sizeof(ev_t));
+  if (ev == NULL) return 1;
+  for (n = 0; (n < th.n_events) && (fread(&ev[n].e, sizeof(trace_event), 1, fp) == 1); n++)
+  {
+    ev[n].pos = n;
+    ev[n].core = (ev[n].e.flags & TRACE_CORE_BIT) ? 1 : 0;
+  }
+  fclose(fp);
+  if (n < th.n_events) fprintf(stderr, "trace_json -- %s is cut short, %u of %u events\n", argv[1], n, th.n_events);
+  if (!place_events(ev, n, th.cpu_mhz))
+  {
+    fprintf(stderr, "trace_json -- %s has no sync events, nothing to place them by\n", argv[1]);
+    return 1;
+  }
+  if (th.freeze_at < n) freeze_ts = ev[th.freeze_at].ts;
+  qsort(ev, n, sizeof(ev_t), ev_cmp);
+
+  printf("{\"displayTimeUnit\": \"ns\", \"otherData\": {\"file\": \"%s\", \"recorded\": %u, \"kept\": %u}, "
+         "\"traceEvents\": [", argv[1], th.recorded, n);
+  for (i = 0; i < n; i++)
+  {
+    id = ev[i].e.id;
+    c = ev[i].core;
+    phase = ev[i].e.flags & TRACE_PHASE_MASK;
+    if ( (ev[i].ts < 0) || (id <= TRACE_sync_time) || (id >= TRACE_NUM_EVENTS) ) continue;
+
+    // row: fixed by the event, per core for ISRs, or that of the span open around a CALLER event
+    track = trace_event_tracks[id];
+    tid = (track == TRACE_TRACK_ISR) ? TID_ISR + c : track;
+    if (track == TRACE_TRACK_CALLER)
+    {
+      tid = TID_CORE + c;
+      for (k = n_open[c] - 1; k >= 0; k--)
+      {
+        if (open[c][k].tid < TID_ISR)
+        {
+          tid = open[c][k].tid;
+          break;
+        }
+      }
+    }
+
+    if (phase == TRACE_BEGIN)
+    {
+      if (n_open[c] == MAX_OPEN)
+      {
+        ++unmatched;
+        continue;
+      }
+      open[c][n_open[c]].id = id;
+      open[c][n_open[c]].tid = tid;
+      open[c][n_open[c]].arg = ev[i].e.arg;
+      open[c][n_open[c]].ts = ev[i].ts;
+      ++n_open[c];
+    }
+    else if (phase == TRACE_END)
+    {
+      // the latest open span of this event on this core, its begin may have been overwritten
+      for (k = n_open[c] - 1; (k >= 0) && (open[c][k].id != id); k--) ;
+      if (k < 0)
+      {
+        ++unmatched;
+        continue;
+      }
+      out_span(&open[c][k], ev[i].ts, ev[i].e.arg);
+      memmove(&open[c][k], &open[c][k + 1], (n_open[c] - k - 1) * sizeof(open_t));
+      --n_open[c];
+    }
+    else
+    {
+      out_instant(trace_event_names[id], tid, ev[i].ts, "t", id, ev[i].e.arg);
+    }
+  }
+  for (c = 0; c < 2; c++) unfinished += n_open[c];
+  if (freeze_ts >= 0) out_instant("freeze", TRACE_TRACK_DAQ, freeze_ts, "g", -1, 0);
+
+  for (tid = 0; tid < TRACE_NUM_TRACKS; tid++)
+  {
+    if (tid_used[tid]) out_thread_name(tid, trace_track_labels[tid], -1);
+  }
+  for (c = 0; c < 2; c++)
+  {
+    if (tid_used[TID_ISR + c]) out_thread_name(TID_ISR + c, "isr", c);
+    if (tid_used[TID_CORE + c]) out_thread_name(TID_CORE + c, "other", c);
+  }
+  printf("\n]}\n");
+
+  fprintf(stderr, "trace_json -- %s: %u events kept of %u recorded, %.1f ms, %u ends without a begin, "
+          "%u begins without an end\n", argv[1], n, th.recorded,
+          n ? (ev[n - 1].ts - ev[0].ts) / 1000 : 0.0, unmatched, unfinished);
+  fprintf(stderr, "%-14s %8s %10s %10s %14s\n", "span", "count", "mean us", "worst us", "worst at us");
+  for (id = 0; id < TRACE_NUM_EVENTS; id++)
+  {
+    if (stats[id].n == 0) continue;
+    fprintf(stderr, "%-14s %8u %10.1f %10.1f %14.1f\n", trace_event_names[id], stats[id].n,
+            stats[id].sum / stats[id].n, stats[id].max, stats[id].max_ts);
+  }
+  free(ev);
+  return 0;
+}
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "esp_types.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
@@ -14,23 +15,80 @@
 #include "nubaja_fault.h"
 #include "nubaja_i2c.h"
 #include "nubaja_ad7998.h"
+#include "nubaja_lsm6dsm.h"
+#include "nubaja_as1115.h"
 #include "nubaja_sd.h"
 #include "nubaja_pid.h"
+#include "nubaja_ctrl.h"
 #include "nubaja_pwm.h"
+#include "nubaja_config.h"
+#include "nubaja_burst.h"
+#include "nubaja_alert.h"
+#include "nubaja_brake.h"
+#include "nubaja_convst.h"
+#include "nubaja_governor.h"
+#include "nubaja_stats.h"
+#include "nubaja_curve.h"
+#include "nubaja_log_qos.h"
+#include "nubaja_console.h"
+#include "nubaja_trace.h"
+
+// init event bits, set by the init tasks that run alongside the SD mount
+#define INIT_I2C_DONE         BIT0
+#define INIT_PWM_DONE         BIT1
+#define INIT_CFG_LOADED       BIT2
+
+// run_events bits, set by the console (or the boot config for the first run)
+#define RUN_START             BIT0
+#define RUN_ABORT             BIT1           // end the run after the current tick
+#define RUN_ROTATE            BIT2           // close the log and carry on in a new file
+
+// daq_state
+#define DAQ_IDLE              0              // drivers up, waiting for RUN_START
+#define DAQ_RUNNING           1
+
+#define DAQ_TICK_RING         4              // tick timestamps kept, power of two
+#define DAQ_LATE_US           200            // wake-up later than this after the tick counts as late
+
+// tick timing, counted per run
+typedef struct
+{
+  uint32_t ticks;         // loop iterations
+  uint32_t missed;        // timer ticks merged into a later one while daq_task was busy
+  uint32_t overruns;      // iterations still running when the next tick fired
+  uint32_t late_wakes;    // woke more than DAQ_LATE_US after the tick
+  uint32_t max_late_us;
+} daq_timing_t;
 
 //globals
-xQueueHandle daq_timer_queue; // queue to time the daq task
+TaskHandle_t daq_task_handle = NULL; // woken by daq_timer_isr
+volatile uint32_t daq_tick_seq = 0; // timer ticks since boot
+volatile int64_t daq_tick_time_us[DAQ_TICK_RING]; // esp_timer time of each tick, by seq
+daq_timing_t daq_timing;
+run_stats_t run_stats; // per-channel summary of the run so far
+power_curve_t run_curve; // torque / power by rpm bin of the run so far
+log_qos_t log_qos; // logging rate of the slow channels, stepped down while the SD card is behind
 xQueueHandle logging_queue_1, logging_queue_2, current_dp_queue; // queues to store data points
-pid_ctrl_t brake_current_pid;
-pid_ctrl_t engine_breakin_pid; //for engine break-in only
+xQueueHandle imu_queue; // latest IMU sample from aux_bus_task
+xQueueHandle derived_queue; // latest derived channels from daq_task, for display / telemetry
 fault_t ctrl_faults; 
 control_t main_ctrl;
-float i_sp[BSIZE]; //brake current set point array (0-100%)
-float tps_sp[BSIZE]; //throttle position set point array (0-100%)
+ad7998_chset_t adc_chset; //enabled ADC channels
+config_t boot_cfg;
+EventGroupHandle_t init_events;
+EventGroupHandle_t run_events;
+volatile int daq_state = DAQ_IDLE;
+int run_count = 0; // runs since boot
+int run_file_num = 0; // data_N the run started in, set by daq_task. file_num moves on with every rotate
+int run_rotations = 0; // rotates in the run
+run_stats_t console_stats; // copy of run_stats for the stats command
+profile_t main_prof; //brake current, throttle position set points (0-100%), in flash
 
 // interrupt for daq_task timer
 void IRAM_ATTR daq_timer_isr( void *para )
 {
+  trace_begin( TRACE_daq_isr, 0 );
+
   // retrieve the interrupt status and the counter value from the timer
   uint32_t intr_status = TIMERG0.int_st_timers.val;
   TIMERG0.hw_timer[DAQ_TIMER_IDX].update = 1;
@@ -44,8 +102,34 @@ void IRAM_ATTR daq_timer_isr( void *para )
   // enable the alarm again, so it is triggered the next time
   TIMERG0.hw_timer[DAQ_TIMER_IDX].config.alarm_en = TIMER_ALARM_EN;
 
-  // send the counter value to the queue to trigger the daq task
-  xQueueOverwriteFromISR( daq_timer_queue, &intr_status, NULL );
+  // CONVST pulses first, so the stamp is the start of the train
+  if ( adc_convst.run )
+  {
+    adc_convst_fire();
+  }
+
+  // stamp the tick, then wake daq_task directly with the tick number
+  // and switch to it on the way out of the ISR
+  uint32_t seq = ++daq_tick_seq;
+  daq_tick_time_us[seq & ( DAQ_TICK_RING - 1 )] = esp_timer_get_time();
+
+  BaseType_t woken = pdFALSE;
+  if ( daq_task_handle != NULL )
+  {
+    xTaskNotifyFromISR( daq_task_handle, seq, eSetValueWithOverwrite, &woken );
+  }
+  trace_end( TRACE_daq_isr, 0 );
+  if ( woken == pdTRUE )
+  {
+    portYIELD_FROM_ISR();
+  }
+}
+
+static void daq_timing_print()
+{
+  printf("daq_timing -- %u ticks, %u missed, %u overruns, %u late wake-ups (> %d us), max %u us late\n",
+         (unsigned) daq_timing.ticks, (unsigned) daq_timing.missed, (unsigned) daq_timing.overruns,
+         (unsigned) daq_timing.late_wakes, DAQ_LATE_US, (unsigned) daq_timing.max_late_us);
 }
 
 static void daq_timer_init()
@@ -73,123 +157,279 @@ static void daq_timer_init()
 
 static void get_profile () 
 {
-  int i = 0;
+  //choose test, from the boot config if it names one, else at the console
+  main_ctrl.num_profile = boot_cfg.profile;
+  if ( !main_ctrl.num_profile ) {
+    printf("Test selection. Enter profile <number>.\n");
+    printf("Profile 1 - acceleration w/ launch.\n");
+    printf("Profile 2 - acceleration w/o launch.\n");
+    printf("Profile 3 - hill climb.\n");
+    printf("Profile 4 - engine break in.\n");
+    printf("Profile 5 - demo.\n");
+  }
+}
+
+// I2C bring-up, runs on core 1 while daq_task mounts the SD card
+// waits for the boot config, which says which devices sit on which bus
+// the ADC channel set is programmed once both are done
+static void i2c_init_task(void *arg)
+{
+  xEventGroupWaitBits( init_events, INIT_CFG_LOADED, pdFALSE, pdTRUE, portMAX_DELAY );
 
-  //choose test
-  printf("Test selection. Enter profile number.\n");
-  printf("Profile 1 - acceleration w/ launch.\n");
-  printf("Profile 2 - acceleration w/o launch.\n");
-  printf("Profile 3 - hill climb.\n");
-  printf("Profile 4 - engine break in.\n");
-  printf("Profile 5 - demo.\n");
-  while ( !main_ctrl.num_profile ) {
-    scanf("%d", &main_ctrl.num_profile);
+  if ( config_bus_used( &boot_cfg, PORT_0 ) ) {
+    i2c_master_config( PORT_0, config_bus_clk( &boot_cfg, PORT_0 ), I2C_MASTER_0_SDA_IO, I2C_MASTER_0_SCL_IO );
+  }
+  if ( config_bus_used( &boot_cfg, PORT_1 ) ) {
+    i2c_master_config( PORT_1, config_bus_clk( &boot_cfg, PORT_1 ), I2C_MASTER_1_SDA_IO, I2C_MASTER_1_SCL_IO );
   }
 
-  switch( main_ctrl.num_profile ) 
+  xEventGroupSetBits( init_events, INIT_I2C_DONE );
+  mem_note_stack( MEM_TASK_INIT );
+  vTaskDelete(NULL);
+}
+
+// IMU and display, polled at AUX_BUS_HZ for the length of one run on their own bus
+// so they never hold up an ADC read in daq_task
+static void aux_bus_task(void *arg)
+{
+  LSM6DSM imu;
+  AS1115 display;
+  imu_sample_t s;
+  derived_t dv = { 0 };
+  uint16_t rpm = 0;
+  TickType_t last_wake = xTaskGetTickCount();
+  int run = (intptr_t) arg; //exit with the run that started it
+
+  if ( boot_cfg.imu_bus != PORT_NONE ) {
+    imu = init_lsm6dsm( boot_cfg.imu_bus, IMU_SLAVE_ADDR );
+  }
+  if ( boot_cfg.display_bus != PORT_NONE ) {
+    display = init_as1115( boot_cfg.display_bus, AS1115_SLAVE_ADDR );
+  }
+
+  while ( main_ctrl.run && ( run_count == run ) )
   {
-    case 1:
-      for ( i = 0; i < BSIZE; i++) {
-        i_sp[i] = i_sp_accel_launch[i];
-        tps_sp[i] = tps_sp_accel_launch[i];
+    trace_begin( TRACE_aux_bus, 0 );
+    if ( boot_cfg.imu_bus != PORT_NONE ) {
+      if ( imu_read_gyro_xl( &imu, &s.gyro_x, &s.gyro_y, &s.gyro_z,
+                             &s.xl_x, &s.xl_y, &s.xl_z ) == I2C_SUCCESS ) {
+        xQueueOverwrite( imu_queue, &s );
       }
-      break; 
-
-    case 2:
-      for ( i = 0; i < BSIZE; i++) {
-        i_sp[i] = i_sp_accel[i];
-        tps_sp[i] = tps_sp_accel[i];
+    }
+    if ( boot_cfg.display_bus != PORT_NONE ) {
+      xQueuePeek( derived_queue, &dv, 0 );
+      switch ( boot_cfg.display_ch ) {
+        case DISPLAY_ENG_POWER:
+          display_number( &display, dv.eng_power, 2 ); //hp
+          break;
+        case DISPLAY_CVT_RATIO:
+          display_number( &display, dv.cvt_ratio, 3 );
+          break;
+        case DISPLAY_EFFICIENCY:
+          display_number( &display, dv.efficiency, 1 ); //%
+          break;
+        default:
+          rpm_log( primary_rpm_queue, &rpm );
+          display_number( &display, rpm, 0 );
+          break;
       }
-      break; 
-
-    case 3:
-      for ( i = 0; i < BSIZE; i++) {
-        i_sp[i] = i_sp_hill[i];
-        tps_sp[i] = tps_sp_hill[i];
-      }   
-      break;
-
-    case 4:
-      for ( i = 0; i < BSIZE; i++) {
-        i_sp[i] = 0; //no need for brake in engine break-in
-        tps_sp[i] = 0.05 * BREAK_IN_RPM - 90; //variable throttle disabled; constant value
-      } 
-      main_ctrl.en_log = 0;
-      break;
-
-    case 5:
-      for ( i = 0; i < BSIZE; i++) {
-        i_sp[i] = i_sp_demo[i];
-        tps_sp[i] = tps_sp_demo[i];
-        main_ctrl.en_log = 0;
-      } 
-      break;      
+    }
+    trace_end( TRACE_aux_bus, 0 );
+    vTaskDelayUntil( &last_wake, ( 1000 / AUX_BUS_HZ ) / portTICK_PERIOD_MS );
   }
 
+  if ( boot_cfg.display_bus != PORT_NONE ) {
+    display_disable( &display );
+  }
+  mem_note_stack( MEM_TASK_AUX );
+  vTaskDelete(NULL);
 }
 
+static void pwm_init_task(void *arg)
+{
+  pwm_init();
 
-// task to run the main daq system based on a timer
-static void daq_task(void *arg)
+  xEventGroupSetBits( init_events, INIT_PWM_DONE );
+  mem_note_stack( MEM_TASK_INIT );
+  vTaskDelete(NULL);
+}
+
+/*
+** CONSOLE COMMANDS - everything but stop / abort waits for idle, so a run in progress only ever
+sees an event bit at the top of its next tick
+*/
+
+static int cmd_idle ( const char *cmd )
 {
+  if ( daq_state != DAQ_IDLE ) {
+    printf("%s -- not while a run is in progress, abort it first\n", cmd);
+    return 0;
+  }
+  return 1;
+}
 
-  /** INIT STAGE **/
+static void cmd_profile ( int argc, char **argv )
+{
+  int n;
+  if ( argc < 2 ) {
+    printf("profile -- %d\n", main_ctrl.num_profile);
+    return;
+  }
+  if ( !cmd_idle( argv[0] ) ) {
+    return;
+  }
+  n = atoi( argv[1] );
+  if ( ( n < 1 ) | ( n > NUM_PROFILES ) ) {
+    printf("profile -- no profile %s, 1-%d\n", argv[1], NUM_PROFILES);
+    return;
+  }
+  main_ctrl.num_profile = n;
+  printf("profile -- %d armed\n", n);
+}
 
-  // vars
-  uint32_t intr_status;
+static void cmd_start ( int argc, char **argv )
+{
+  if ( !cmd_idle( argv[0] ) ) {
+    return;
+  }
+  if ( !main_ctrl.num_profile ) {
+    printf("start -- pick a profile first\n");
+    return;
+  }
+  xEventGroupSetBits( run_events, RUN_START );
+}
+
+static void cmd_abort ( int argc, char **argv )
+{
+  if ( daq_state != DAQ_RUNNING ) {
+    printf("abort -- no run in progress\n");
+    return;
+  }
+  xEventGroupSetBits( run_events, RUN_ABORT );
+}
+
+static void cmd_rotate ( int argc, char **argv )
+{
+  if ( ( daq_state != DAQ_RUNNING ) | !main_ctrl.en_log ) {
+    printf("rotate -- no run being logged\n");
+    return;
+  }
+  xEventGroupSetBits( run_events, RUN_ROTATE );
+}
+
+static void cmd_engine ( int argc, char **argv )
+{
+  if ( ( argc > 1 ) && !strcmp( argv[1], "off" ) ) {
+    engine_off(); //always allowed
+    printf("engine -- off\n");
+  }
+  else if ( ( argc > 1 ) && !strcmp( argv[1], "on" ) && cmd_idle( argv[0] ) ) {
+    engine_on();
+    printf("engine -- kill relay released\n");
+  }
+}
+
+// what the run's stats and curve are called. they cover the whole run, every rotated file
+// included, and are named after its first file
+static void run_summary_name ( char *name, int run_file, int rotations )
+{
+  if ( rotations ) {
+    sprintf( name, "data_%d + %d rotated, whole run", run_file, rotations );
+  }
+  else {
+    sprintf( name, "data_%d", run_file );
+  }
+}
+
+// the stats of the run in progress, or of the last one. copied first, a run in progress
+// keeps updating them, so a line can be a tick out against the next
+static void cmd_stats ( int argc, char **argv )
+{
+  char run_name[48];
+  memcpy( &console_stats, &run_stats, sizeof(run_stats) );
+  run_summary_name( run_name, run_file_num, run_rotations );
+  stats_print( stdout, run_name, &console_stats );
+}
+
+// read in place, too big to copy. a run in progress can move a bin while it prints
+static void cmd_curve ( int argc, char **argv )
+{
+  char run_name[48];
+  run_summary_name( run_name, run_file_num, run_rotations );
+  printf("curve -- %s\n", run_name);
+  curve_print( stdout, &run_curve );
+}
+
+static void cmd_status ( int argc, char **argv )
+{
+  printf("status -- %s, run %d, profile %d, %s, idx %d\n",
+         ( daq_state == DAQ_RUNNING ) ? "running" : "idle", run_count, main_ctrl.num_profile,
+         filename, main_ctrl.idx);
+  print_faults( &ctrl_faults );
+  daq_timing_print();
+  printf("status -- logging slow channels at 1/%u\n", (unsigned) log_qos_decim[log_qos.level]);
+}
+
+static void cmd_mem ( int argc, char **argv )
+{
+  mem_report( "console" );
+}
+
+static const console_cmd_t daq_cmds[] =
+{
+  { "profile", "[n]",    "show or pick the profile for the next run", cmd_profile },
+  { "start",   "",       "start a run", cmd_start },
+  { "abort",   "",       "end the run now, safe stop", cmd_abort },
+  { "rotate",  "",       "close the log and carry on in the next data_N.bin", cmd_rotate },
+  { "engine",  "on|off", "kill relay, on only when idle", cmd_engine },
+  { "stats",   "",       "channel summary of this or the last run", cmd_stats },
+  { "curve",   "",       "power curve of this or the last run, csv", cmd_curve },
+  { "status",  "",       "state, file, faults, tick timing", cmd_status },
+  { "mem",     "",       "memory report", cmd_mem },
+};
+
+// fresh control state, profile, log file and per-run helpers for one run
+static void run_start ( data_point *dp )
+{
+  int convst_us;
+
+  ++run_count;
 
   //flags
   main_ctrl.en_eng = 0; 
-  main_ctrl.eng = 0;
+  main_ctrl.eng = 1;
   main_ctrl.run = 1;
   main_ctrl.idx = 0;
-  main_ctrl.num_profile = 0;
   main_ctrl.en_log = 1;
 
-  if ( main_ctrl.num_profile == 4 ) 
-  {
-    main_ctrl.en_log = 0;
-  }
-
   //quantities
   main_ctrl.i_brake_amps = 0; 
   main_ctrl.i_brake_duty = 0; 
   main_ctrl.brake_temp = 0; 
   main_ctrl.belt_temp = 0; 
+  main_ctrl.slip_ticks = 0;
+
+  load_profile( &main_ctrl, &main_prof );
+  memset( dp, 0, sizeof(*dp) );
+  clear_faults( &ctrl_faults );
+
+  //ADC conversions paced by CONVST pulses, only while nothing else converts on the part: the
+  //ALERT cycle timer, brake_sync and burst reads would each break the sequence. the set and
+  //spacing go in the headers of the run's log files
+  convst_us = boot_cfg.adc_convst;
+  if ( convst_us && ( boot_cfg.adc_alert || boot_cfg.brake_sync || burst_reads_adc( &boot_cfg ) ) ) {
+    printf("daq_task -- adc_convst is off while adc_alert, brake_sync or an adc burst capture is on\n");
+    convst_us = 0;
+  }
+  adc_convst_start( boot_cfg.adc_bus, &adc_chset, convst_us );
+  log_adc_channels = adc_chset.mask;
+  log_adc_convst_us = adc_convst.run ? adc_convst.step_us : 0;
 
-  data_point dp =
-  {
-    dp.prim_rpm = 0,    dp.sec_rpm = 0,        dp.torque = 0,
-    dp.temp3 = 0,       dp.belt_temp = 0,      dp.temp2 = 0,
-    dp.i_brake = 0,     dp.temp1 = 0,          dp.load_cell = 0, 
-    dp.tps = 0,         dp.i_sp = 0,           dp.tps_sp = 0
-  }; //empty data point  
-
-  //module, peripheral configurations
-
-  // init ADC w/ channel selection
-  i2c_master_config( PORT_0, FAST_MODE_PLUS, I2C_MASTER_0_SDA_IO, I2C_MASTER_0_SCL_IO );
-  // uint8_t ch_sel_h = ( CH6 );
-  // uint8_t ch_sel_l = ( CH4 | CH3 | CH2 );
-  uint8_t ch_sel_h = ( CH8 | CH7 | CH6 | CH5 );
-  uint8_t ch_sel_l = ( CH4 | CH3 | CH2 | CH1 );  
-  ad7998_config( PORT_0, ADC_SLAVE_ADDR, ch_sel_h, ch_sel_l ); 
-
-  // // init sd
-  init_sd();
-  xQueueHandle current_logging_queue = logging_queue_1;
-
-  //init GPIOs
-  configure_gpio();
-
-  //init PWMs
-  pwm_init();
-
-  //init PIDs
-  init_pid( &brake_current_pid, KP, KI, KD, BRAKE_WINDUP_GUARD, BRAKE_OUTPUT_MAX );
-
-  //init faults
-  clear_faults ( &ctrl_faults );
+  //new file, empty queues. waits for the previous run's file to be closed
+  log_open_run();
+  xQueueReset( logging_queue_1 );
+  xQueueReset( logging_queue_2 );
+  xEventGroupClearBits( run_events, RUN_ABORT | RUN_ROTATE );
 
   //default states
   ebrake_set();
@@ -198,173 +438,378 @@ static void daq_task(void *arg)
   set_throttle(0); //no throttle
   set_brake_duty(0); //no braking 
 
-  // //prompt user to start engine
-  // printf("Start engine.\n");
-  // printf("1 = YES ; 0 = NO\n");
-  // while ( !main_ctrl.en_eng ) 
-  // {
-  //   scanf("%d\n", &main_ctrl.en_eng);
-  // }
-  // engine_on();
+  //brake current loop on the PWM period instead of the daq tick
+  if ( boot_cfg.brake_sync ) {
+    brake_sync_start( boot_cfg.adc_bus );
+  }
+
+  //break-in: the governor holds the engine speed from its rpm edges, not the tick
+  if ( ( main_ctrl.num_profile == 4 ) && boot_cfg.breakin_governor ) {
+    governor_start( BREAK_IN_RPM );
+  }
 
-  //prompt user to confirm engine running and warm
-  printf("Engine running?\n");
-  printf("1 = YES ; 0 = NO\n");  
-  while ( !main_ctrl.eng ) {
-    scanf("%d\n", &main_ctrl.eng);    
+  //IMU, display on the other bus
+  if ( ( boot_cfg.imu_bus != PORT_NONE ) | ( boot_cfg.display_bus != PORT_NONE ) ) {
+    xTaskCreatePinnedToCore( aux_bus_task, "aux_bus", 2048, (void *) (intptr_t) run_count, (configMAX_PRIORITIES-3), NULL, 1 );
   }
 
+  //temperature limits in the ADC itself, cut the outputs without waiting for a tick
+  if ( boot_cfg.adc_alert ) {
+    adc_alert_start( boot_cfg.adc_bus, &adc_chset );
+  }
+
+  //high rate capture around launch, faults, the trigger input
+  burst_start( &boot_cfg, boot_cfg.adc_bus, &adc_chset, file_num );
+
+  printf("daq_task -- run %d, profile %d, logging buffers: 2 x %d samples, %u bytes\n",
+         run_count, main_ctrl.num_profile, LOGGING_QUEUE_SIZE,
+         (unsigned) ( 2 * LOGGING_QUEUE_SIZE * sizeof(data_point) ));
+  mem_report( "run start" );
+
   flasher_on();
-  printf("\n\n\n\n\n-------------- LO0000000OP --------------\n\n\n\n\n");
-  /** END INIT STAGE **/  
+  i2c_stats_reset();
+  memset( &daq_timing, 0, sizeof(daq_timing) );
+  stats_reset( &run_stats );
+  curve_reset( &run_curve );
+  log_qos_reset( &log_qos, boot_cfg.log_qos_fill, boot_cfg.log_qos_step );
+  trace_start( boot_cfg.trace_events, boot_cfg.trace_freeze );
+}
 
-  /** LOOP STAGE **/
+// share of both logging buffers holding samples not yet on the card, percent
+static int log_fill_pct ()
+{
+  return (int) ( 100 * ( uxQueueMessagesWaiting( logging_queue_1 ) + uxQueueMessagesWaiting( logging_queue_2 ) )
+                 / ( 2 * LOGGING_QUEUE_SIZE ) );
+}
 
-  while ( main_ctrl.run )
-  {
-    // wait for timer alarm
-    xQueueReceive( daq_timer_queue, &intr_status, portMAX_DELAY );
+// logging carries on in the other queue, returned. reset, though it should be empty after
+// writing: it won't be if a writer (or the staging of one) is still draining it, and what
+// is left would then land in the file after samples queued later, so it is counted as dropped
+static xQueueHandle log_switch_queue ( xQueueHandle lq )
+{
+  lq = ( lq == logging_queue_1 ) ? logging_queue_2 : logging_queue_1;
+  log_qos.dropped += uxQueueMessagesWaiting( lq );
+  xQueueReset( lq );
+  return lq;
+}
 
-    //check if test is done (profiles ended) or if test faulted
-    //end disabled for break-in for continuous operation
-    if ( ( ( main_ctrl.idx == BSIZE ) | ( ctrl_faults.trip ) ) & ( main_ctrl.num_profile != 4 ) ) {
-        main_ctrl.run = 0;
+// queue one slot. a full queue is handed to a writer task and logging carries on in the
+// other one, returned
+static xQueueHandle log_send ( xQueueHandle lq, const data_point *slot )
+{
+  if ( xQueueSend( lq, slot, 0 ) != errQUEUE_FULL ) {
+    return lq;
+  }
+  printf("daq_task -- queue full, writing and switiching...\n");
+  xTaskCreatePinnedToCore( write_logging_queue_to_sd,
+          ( lq == logging_queue_1 ) ? "write_lq_1_sd" : "write_lq_2_sd", 2048, (void *) lq,
+          (configMAX_PRIORITIES-1), NULL, 1 );
+  lq = log_switch_queue( lq );
+  xQueueSend( lq, slot, 0 );
+  return lq;
+}
+
+// safe stop, reports, then the log is closed before daq_task goes back to idle. the
+// summaries and trace are named after run_file, the file the run started in: a rotate
+// changes file_num from a writer task, and they cover the whole run anyway
+static void run_end ( xQueueHandle lq, int run_file, int rotations )
+{
+  data_point slot;
+  //restore defaults, safe system shutdown
+  brake_sync_stop();
+  governor_stop();
+  adc_convst_stop();
+  set_throttle( 0 ); //no throttle
+  set_brake_duty( 0 ); //no braking 
+  engine_off();
+  flasher_off();
+  ebrake_set();
+  adc_alert_stop();
+  burst_stop();
+  print_faults( &ctrl_faults );
+  daq_timing_print();
+  i2c_stats_print();
+  if ( main_ctrl.en_log ) {
+    char run_name[48], sum_name[32], crv_name[32];
+    run_summary_name( run_name, run_file, rotations );
+    sprintf( sum_name, "/sdcard/data_%d.sum", run_file );
+    sprintf( crv_name, "/sdcard/data_%d.crv", run_file );
+    stats_print( stdout, run_name, &run_stats );
+    stats_write( sum_name, run_name, &run_stats );
+    curve_print( stdout, &run_curve );
+    curve_write( crv_name, &run_curve );
+    if ( log_qos_flush( &log_qos, &slot ) ) {
+      lq = log_send( lq, &slot );
     }
+    log_qos_print( &log_qos );
+  }
+  log_close_run( lq );
+  trace_stop();
+  if ( trace.buf != NULL ) {
+    char trc_name[32];
+    sprintf( trc_name, "/sdcard/data_%d.trc", run_file );
+    trace_write( trc_name );
+  }
+  mem_note_stack( MEM_TASK_DAQ );
+  mem_report( "end of run" );
+}
 
-    //get new set points (in the form of 0-100% i.e. duty cycle)
-    dp.i_sp = fetch_sp ( main_ctrl.idx, i_sp );
-    dp.tps_sp = fetch_sp ( main_ctrl.idx, tps_sp );
+// task to run the main daq system based on a timer. after init it sits idle-armed, drivers
+// up and the timer running, and does one run per RUN_START
+static void daq_task(void *arg)
+{
 
-    //e-brake release
-    if ( dp.tps_sp > LAUNCH_THRESHOLD )
-    {
-      ebrake_release();
-    }
+  /** INIT STAGE **/
 
+  // vars
+  uint32_t seq, first_seq = 0, last_seq = 0, late_us;
+  EventBits_t run_bits;
+  int64_t tick_us;
+  ctrl_cmd_t cmd;
+  derived_t dv = { 0 };
+  uint16_t adc[AD7998_NUM_CH] = { 0 }; //results by channel, disabled channels stay 0
+  int launched, tripped; //burst capture trigger edges
+  data_point dp = { 0 }; //empty data point
+  data_point slots[4]; //log records from one sample, see log_qos_slots
+  int n_slots, k, ch;
 
-    if ( main_ctrl.en_log ) 
-    {
-    //RECORD DATA
-    // adc
-    ad7998_read_3( PORT_0, ADC_SLAVE_ADDR, 
-                  &(dp.torque),
-                  &(dp.temp3),
-                  &(dp.belt_temp),
-                  &(dp.temp2),
-                  &(dp.i_brake), 
-                  &(dp.temp1), 
-                  &(dp.load_cell), 
-                  &(dp.tps) );
-
-    //relevant physical quantity conversion for faults
-    main_ctrl.i_brake_amps = ( counts_to_volts ( dp.i_brake ) * I_BRAKE_SCALE )  + I_BRAKE_OFFSET; //ADC counts to amps
-    main_ctrl.i_brake_duty = 100 * ( main_ctrl.i_brake_amps / I_BRAKE_MAX ); //convert brake current in amps to duty cycle from 0-100%
-    main_ctrl.brake_temp = ( counts_to_volts ( dp.temp3 ) * THERM_SCALE )  + THERM_OFFSET; //ADC counts to amps
-    main_ctrl.belt_temp = ( counts_to_volts ( dp.belt_temp ) * BELT_TEMP_SCALE )  + BELT_TEMP_OFFSET; //ADC counts to amps
-    
-    // printf( "brake current: %4.2f\n", main_ctrl.i_brake_amps );
-
-    // rpm measurements
-    rpm_log ( primary_rpm_queue, &(dp.prim_rpm) );
-    rpm_log ( secondary_rpm_queue, &(dp.sec_rpm) );
-    }
+  //module, peripheral configurations
+  //ADC and PWM come up on core 1 while the SD card mounts here
+  init_events = xEventGroupCreate();
+  run_events = xEventGroupCreate();
+  xTaskCreatePinnedToCore( i2c_init_task, "i2c_init", 2048, NULL, (configMAX_PRIORITIES-2), NULL, 1 );
+  xTaskCreatePinnedToCore( pwm_init_task, "pwm_init", 2048, NULL, (configMAX_PRIORITIES-2), NULL, 1 );
 
-    //update PID
-    // pid_update ( &brake_current_pid, dp.i_sp, main_ctrl.i_brake_duty );
-    // printf( "brake cmd: %4.2f\n", brake_current_pid.output );
+  // init sd, then the boot config and profile that live on it
+  init_sd();
+  xQueueHandle current_logging_queue = logging_queue_1;
+  config_load( &boot_cfg, CONFIG_FILENAME );
+  xEventGroupSetBits( init_events, INIT_CFG_LOADED );
+  if ( boot_cfg.verbose ) {
+    sd_print_info();
+  }
+  get_profile();
 
-    //set brake current, throttle
-    set_throttle( dp.tps_sp ); 
-    // set_brake_duty( brake_current_pid.output ); 
-    set_brake_duty( dp.i_sp ); 
+  //init GPIOs
+  configure_gpio();
 
+  xEventGroupWaitBits( init_events, INIT_I2C_DONE | INIT_PWM_DONE, pdFALSE, pdTRUE, portMAX_DELAY );
 
-    // print_data_point( &dp );
+  // init ADC w/ channel selection from the boot config
+  ad7998_chset_init( &adc_chset, boot_cfg.adc_channels );
+  ad7998_config_chset( boot_cfg.adc_bus, ADC_SLAVE_ADDR, &adc_chset );
 
-    // check for faults
-    if ( main_ctrl.i_brake_amps > MAX_I_BRAKE ) 
-    {
-      ctrl_faults.trip = 1;
-      ctrl_faults.overcurrent_fault = 1;      
-    }
-    if ( ( main_ctrl.belt_temp > MAX_BELT_TEMP ) | ( main_ctrl.brake_temp > MAX_BRAKE_TEMP ) )
-    {
-      ctrl_faults.trip = 1;
-      ctrl_faults.overtemp_fault = 1;      
-    }
+  //idle-armed: e-brake on, no throttle or braking, kill relay released so the engine can start
+  ebrake_set();
+  engine_on();
+  set_throttle(0);
+  set_brake_duty(0);
+
+  //commands from here on come from the console. with a profile in the boot config and no
+  //engine prompt the first run starts straight away, as it always has without a terminal
+  console_start( daq_cmds, sizeof(daq_cmds) / sizeof(daq_cmds[0]) );
+  if ( main_ctrl.num_profile && !boot_cfg.engine_prompt ) {
+    xEventGroupSetBits( run_events, RUN_START );
+  }
+  else {
+    printf("daq_task -- idle, start the engine, then start\n");
+  }
+  /** END INIT STAGE **/  
 
-    // push struct to logging queue
-    // if the queue is full, switch queues and send the full for writing to SD
-    if ( main_ctrl.en_log )   
+  for ( ;; )
+  {
+    xEventGroupWaitBits( run_events, RUN_START, pdTRUE, pdTRUE, portMAX_DELAY );
+    daq_state = DAQ_RUNNING;
+    run_start( &dp );
+    run_file_num = file_num;
+    run_rotations = 0;
+    current_logging_queue = logging_queue_1;
+    launched = 0;
+    tripped = 0;
+    xTaskNotifyWait( 0, 0, &seq, 0 ); //drop a tick that fired while idle, it would count as late
+    printf("\n\n\n\n\n-------------- LO0000000OP --------------\n\n\n\n\n");
+
+    /** LOOP STAGE **/
+
+    while ( main_ctrl.run )
     {
-      if (xQueueSend( current_logging_queue, &dp, 0 ) == errQUEUE_FULL )
+      // wait for timer alarm
+      xTaskNotifyWait( 0, 0, &seq, portMAX_DELAY );
+      tick_us = daq_tick_time_us[seq & ( DAQ_TICK_RING - 1 )];
+      late_us = (uint32_t) ( esp_timer_get_time() - tick_us );
+
+      if ( daq_timing.ticks == 0 ) {
+        printf("daq_task -- first sample %d ms after boot\n", (int) ( tick_us / 1000 ) );
+        first_seq = seq;
+        last_seq = seq - 1;
+      }
+
+      //tick accounting. idx follows the timer, so ticks merged while busy leave a gap in idx
+      //rather than stretching the profile
+      ++daq_timing.ticks;
+      daq_timing.missed += seq - last_seq - 1;
+      if ( late_us > DAQ_LATE_US ) {
+        ++daq_timing.late_wakes;
+        trace_mark( TRACE_daq_late, ( late_us < UINT16_MAX ) ? late_us : UINT16_MAX );
+        trace_trigger();
+      }
+      if ( late_us > daq_timing.max_late_us ) {
+        daq_timing.max_late_us = late_us;
+      }
+      last_seq = seq;
+      main_ctrl.idx = seq - first_seq;
+      trace_begin( TRACE_daq_tick, (uint16_t) main_ctrl.idx );
+
+      //stamp the sample with the time of the tick, with CONVST the first conversion
+      dp.idx = main_ctrl.idx;
+      dp.time_us = (uint32_t) ( adc_convst.run ? tick_us + ADC_CONVST_HIGH_US : tick_us );
+
+      //console: abort ends the run after this tick, rotate moves the log to a new file
+      run_bits = xEventGroupClearBits( run_events, RUN_ABORT | RUN_ROTATE );
+      if ( run_bits & RUN_ABORT ) {
+        printf("daq_task -- run aborted at idx %d\n", main_ctrl.idx);
+        main_ctrl.run = 0;
+      }
+
+      //end-of-test check, set points, e-brake
+      ctrl_faults.alert_fault |= adc_alert.tripped;
+      ctrl_setpoints( &main_ctrl, &ctrl_faults, &dp, &main_prof, &cmd );
+      if ( cmd.ebrake_release )
       {
-        printf("daq_task -- queue full, writing and switiching...\n");
-        if ( current_logging_queue == logging_queue_1 )
-        {
-          current_logging_queue = logging_queue_2;
-          xTaskCreatePinnedToCore( write_logging_queue_to_sd,
-                  "write_lq_1_sd", 2048, (void *) logging_queue_1,
-                  (configMAX_PRIORITIES-1), NULL, 1 );
+        ebrake_release();
+        if ( !launched ) {
+          burst_trigger( CAP_TRIG_LAUNCH );
+          launched = 1;
+        }
+      }
+
+      if ( main_ctrl.en_log ) 
+      {
+      //RECORD DATA
+      trace_begin( TRACE_daq_adc, 0 );
+      // adc, collected after this tick's CONVST pulses or converted by the read
+      if ( adc_convst.run ) {
+        adc_convst_read( tick_us, adc );
+      }
+      else {
+        ad7998_read( boot_cfg.adc_bus, ADC_SLAVE_ADDR, &adc_chset, adc );
+      }
+      for ( ch = 0; ch < LOG_NUM_CH; ch++ ) {
+        if ( log_ch_adc[ch] ) {
+          log_ch_set( &dp, ch, adc[log_ch_adc[ch] - 1] );
         }
-      else
+      }
+      if ( brake_sync.run ) {
+        dp.i_brake = brake_sync.i_brake; //sampled at the same point of the PWM period
+      }
+
+      // rpm measurements
+      rpm_log ( primary_rpm_queue, &(dp.prim_rpm) );
+      rpm_log ( secondary_rpm_queue, &(dp.sec_rpm) );
+
+      stats_update( &run_stats, &dp );
+      trace_end( TRACE_daq_adc, 0 );
+      }
+
+      //conversions, PID, faults
+      trace_begin( TRACE_daq_ctrl, 0 );
+      ctrl_update( &main_ctrl, &ctrl_faults, &dp, &dv, &cmd );
+      xQueueOverwrite( derived_queue, &dv );
+      if ( main_ctrl.en_log ) {
+        curve_update( &run_curve, &dp, &dv );
+      }
+      burst.daq_idx = main_ctrl.idx;
+      if ( ctrl_faults.trip & !tripped ) {
+        burst_trigger( CAP_TRIG_FAULT );
+        tripped = 1;
+      }
+
+      if ( run_bits & RUN_ABORT ) {
+        cmd.throttle = 0;
+        cmd.brake_duty = 0;
+      }
+
+      //set brake current, throttle. in break-in the governor has the throttle, unless the
+      //run is being cut short. the log gets the throttle it set
+      if ( governor.run && ( ( run_bits & RUN_ABORT ) | ctrl_faults.alert_fault ) ) {
+        governor_stop();
+      }
+      if ( governor.run ) {
+        dp.tps_sp = governor.tps;
+      }
+      else {
+        set_throttle( cmd.throttle );
+      }
+      if ( brake_sync.run ) {
+        brake_sync_set( cmd.brake_duty );
+      }
+      else {
+        set_brake_duty( cmd.brake_duty ); 
+      }
+      trace_end( TRACE_daq_ctrl, 0 );
+
+      // log_record_print( stdout, &dp );
+
+      // push struct to logging queue, slow channels thinned out while the card is behind
+      // if the queue is full, switch queues and send the full for writing to SD
+      if ( main_ctrl.en_log )   
       {
-          current_logging_queue = logging_queue_1;
-          xTaskCreatePinnedToCore( write_logging_queue_to_sd,
-                  "write_lq_2_sd", 2048, (void *) logging_queue_2,
+        trace_begin( TRACE_daq_log, 0 );
+        n_slots = log_qos_slots( &log_qos, &dp, log_fill_pct(), slots );
+        if ( run_bits & RUN_ROTATE ) {
+          n_slots += log_qos_rotate( &log_qos, &slots[n_slots] );
+        }
+        for ( k = 0; k < n_slots; k++ ) {
+          current_logging_queue = log_send( current_logging_queue, &slots[k] );
+        }
+        if ( run_bits & RUN_ROTATE )
+        {
+          // close the file with the queue so far, carry on into the next one
+          xTaskCreatePinnedToCore( write_rotate_queue_to_sd,
+                  "write_rotate_sd", 2048, (void *) current_logging_queue,
                   (configMAX_PRIORITIES-1), NULL, 1 );
+          current_logging_queue = log_switch_queue( current_logging_queue );
+          ++run_rotations;
         }
+        trace_end( TRACE_daq_log, n_slots );
+      }
 
-        // reset, though queue should be empty after writing
-        // queue won't be empty if a writing task overlap occurred
-        xQueueReset( current_logging_queue );
+      //next tick already here, this one ran over
+      if ( daq_tick_seq != seq ) {
+        ++daq_timing.overruns;
+        trace_mark( TRACE_daq_overrun, 0 );
+        trace_trigger();
       }
+      trace_end( TRACE_daq_tick, (uint16_t) main_ctrl.idx );
     }
 
-    ++main_ctrl.idx;
-  }
-
-  /** END LOOP STAGE **/
-  
-  //restore defaults, safe system shutdown
-  set_throttle( 0 ); //no throttle
-  set_brake_duty( 0 ); //no braking 
-  reset_pid( &brake_current_pid );
-  engine_off();
-  flasher_off();
-  ebrake_set();
-  xTaskCreatePinnedToCore( write_logging_queue_to_sd,
-                "write_lq_final_sd", 2048, (void *) current_logging_queue,
-                (configMAX_PRIORITIES-1), NULL, 1 );  
+    /** END LOOP STAGE **/
 
-  // per FreeRTOS, tasks MUST be deleted before breaking out of its implementing funciton
-  vTaskDelete(NULL);
+    run_end( current_logging_queue, run_file_num, run_rotations );
+    daq_state = DAQ_IDLE;
+    printf("daq_task -- idle, profile %d armed, start for the next run\n", main_ctrl.num_profile);
+  }
 }
 
 // initialize the daq timer and start the daq task
 void app_main()
 {
-  daq_timer_queue = xQueueCreate(1, sizeof(uint32_t));
+  mem_init();
 
   logging_queue_1 = xQueueCreate( LOGGING_QUEUE_SIZE, sizeof(data_point) );
   logging_queue_2 = xQueueCreate( LOGGING_QUEUE_SIZE, sizeof(data_point) );
 
   // setup current data point queue
   current_dp_queue = xQueueCreate( 1, sizeof(data_point) );
-  data_point dp =
-  {
-    dp.prim_rpm = 0,    dp.sec_rpm = 0,        dp.torque = 0,
-    dp.temp3 = 0,       dp.belt_temp = 0,      dp.temp2 = 0,
-    dp.i_brake = 0,     dp.temp1 = 0,          dp.load_cell = 0, 
-    dp.tps = 0,         dp.i_sp = 0,           dp.tps_sp = 0
-  };
+  data_point dp = { 0 };
   xQueueOverwrite( current_dp_queue, &dp );
+  imu_queue = xQueueCreate( 1, sizeof(imu_sample_t) );
+  derived_queue = xQueueCreate( 1, sizeof(derived_t) );
 
-  // start daq timer and tasks
-  daq_timer_init();
-  get_profile();
+  // start the daq task, then the timer that wakes it
+  xTaskCreatePinnedToCore( daq_task, "daq_task", 6144, NULL, (configMAX_PRIORITIES-1), &daq_task_handle, 0 );
 
-  xTaskCreatePinnedToCore( daq_task, "daq_task", 4096, NULL, (configMAX_PRIORITIES-1), NULL, 0 );
+  daq_timer_init();
 }
 
 
@@ -1,27 +1,30 @@
 #ifndef NUBAJA_AD7998_H_
 #define NUBAJA_AD7998_H_
 
+#include <stdio.h>
 #include "nubaja_i2c.h"
-#include "nubaja_sd.h"
 
 //run in fast mode plus
 //use cmd mode
 
 #define ADC_SLAVE_ADDR			0x23 //pn ad7998-1 with AS @ GND. this is default address. 
-#define ADC_FS					3.3
 
 //register addresses
+#define CONVERSION_RESULT		0x00 //last conversion, read back without starting one
 #define CONFIGURATION			0b01110010
+#define ALERT_STATUS 			0x01
+#define CYCLE_TIMER 			0x03
+#define DATA_LOW(ch) 			( 0x04 + 3 * ( (ch) - 1 ) ) //limit registers, channels 1-4 only
+#define DATA_HIGH(ch) 			( 0x05 + 3 * ( (ch) - 1 ) )
+#define AD7998_LIMIT_CH 		4
 
 //configuration register
 #define ALERT_BUSY				0x0 //pin does not provide any interrupt signal
 #define ALERT_EN				0x0 //pin does not provide any interrupt signal
 #define FLTR 					0b1000 //filtering disabled on SDA/SCL
 #define ALERT_BUSY_POLARITY		0x0 //alert/busy output is active low
-#define CHANNEL_SELECTION_0		0b0000010101010000 //torque, belt temp, brake current, load cell		
-#define CHANNEL_SELECTION_1		0b0000001011100000 //temps only
-#define CHANNEL_SELECTION_2		0x0 //idk
-#define CHANNEL_SELECTION_3		0b0000111111110000 //all channels
+#define ALERT_ON 				0b0100 //pin is the ALERT output, asserts on a limit violation
+#define ALERT_RESET 			0b0110 //clears the ALERT pin and the alert status register
 #define CH1 					0b00010000
 #define CH2 					0b00100000
 #define CH3 					0b01000000				
@@ -31,13 +34,22 @@
 #define CH7 					0b0100
 #define CH8 					0b1000
 #define AD7998_BITMASK          0b0000111111111111 //modified since AD7998 registers are 12 bits (4 MSBs unused here)
+#define AD7998_CHID_SHIFT 		12 //conversion results carry the channel id in bits 14:12
+#define AD7998_NUM_CH 			8
+#define AD7998_CH_DEFAULT 		0xd7 //all but temp1, temp2 (tbd)
 
 //cycle timer register
 #define CYCLE_TIME 				0b00000100 //0.5ms conversion interval 
+#define CYCLE_OFF 				0x0 //no automatic conversions
 #define SAMPLE_DELAY_TRIAL		0b11000000 //bit trial and sample interval delaying mechanism implemented
 
 //command mode
 #define CMD_MODE 				0b01110000 //sequence of channels specified in the config register
+#define CMD_ONE(ch) 			( 0b10000000 | ( ( (ch) - 1 ) << 4 ) ) //convert channel ch alone
+
+//CONVST mode timing
+#define AD7998_POWER_UP_US		1 //CONVST high at least this long before the falling edge
+#define AD7998_CONV_US			2 //falling edge of CONVST to result ready
 
 /*
 ** CHANNEL MAPPING - MAPS ADC CHANNELS TO SIGNAL/NET NAMES
@@ -51,13 +63,7 @@ Channel 7 - load cell
 Channel 8 - throttle position
 */
 
-//each new read function requires another call of ad7998_init with the corresponding channel selection
-
-float counts_to_volts ( uint16_t adc_counts ) 
-{
-	float v = ( (float) adc_counts / (float) 4096 ) * (float) ADC_FS;
-	return v;
-}
+//the channel set passed to ad7998_read must match the one last programmed with ad7998_config_chset
 
 void ad7998_config( int port_num, int slave_address, uint8_t ch_sel_h, uint8_t ch_sel_l ) 
 {
@@ -68,62 +74,128 @@ void ad7998_config( int port_num, int slave_address, uint8_t ch_sel_h, uint8_t c
 	printf("ad7998_config -- configuring success\n");
 }
 
-//read function for channel selection 0
-void ad7998_read_0 ( int port_num, int slave_address, 
-	uint16_t *ch1, 
-	uint16_t *ch3,
-	uint16_t *ch5,
-	uint16_t *ch7 )
+//channel set - which channels are converted and read back each sample, built at init
+typedef struct
+{
+	uint8_t mask; 		//bit k = channel k+1
+	uint8_t n; 			//enabled channels = 2 byte results per burst read
+	uint8_t ch_sel_h; 	//configuration register channel bits
+	uint8_t ch_sel_l;
+} ad7998_chset_t;
+
+void ad7998_chset_init ( ad7998_chset_t *cs, uint8_t mask )
+{
+	int i;
+	cs->mask = mask;
+	cs->n = 0;
+	for ( i = 0; i < AD7998_NUM_CH; i++ ) {
+		cs->n += ( mask >> i ) & 0x1;
+	}
+	cs->ch_sel_l = ( mask & 0x0f ) << 4; 	//CH1..CH4
+	cs->ch_sel_h = ( mask >> 4 ) & 0x0f; 	//CH5..CH8
+}
+
+void ad7998_config_chset ( int port_num, int slave_address, const ad7998_chset_t *cs )
 {
-	uint8_t addr_pointer = CMD_MODE; //cmd mode
-	i2c_read_2_bytes_4( port_num, slave_address, addr_pointer, 
-		ch1, ch3, ch5, ch7 );
-	*ch1 = ( *ch1 & AD7998_BITMASK );
-	*ch3 = ( *ch3 & AD7998_BITMASK );
-	*ch5 = ( *ch5 & AD7998_BITMASK );
-	*ch7 = ( *ch7 & AD7998_BITMASK );
+	ad7998_config( port_num, slave_address, cs->ch_sel_h, cs->ch_sel_l );
+	printf("ad7998_config_chset -- %d channels, mask 0x%02x\n", cs->n, cs->mask);
+}
+
+//read every channel in the set with one burst, results land in ch[0..7] by channel
+//(ch[0] = channel 1). disabled channels are left untouched
+int ad7998_read ( int port_num, int slave_address, const ad7998_chset_t *cs, uint16_t *ch )
+{
+	uint16_t raw[AD7998_NUM_CH];
+	int i, ret;
+
+	ret = i2c_read_2_bytes_n( port_num, slave_address, CMD_MODE, raw, cs->n );
+	if ( ret != I2C_SUCCESS ) {
+		return ret;
+	}
+	//each result carries its channel id in bits 14:12
+	for ( i = 0; i < cs->n; i++ ) {
+		ch[ ( raw[i] >> AD7998_CHID_SHIFT ) & 0x7 ] = ( raw[i] & AD7998_BITMASK );
+	}
+	return ret;
+}
+
+//convert and read one channel (1-8) whatever the channel set, 2 bytes on the bus
+int ad7998_read_one ( int port_num, int slave_address, int ch, uint16_t *value )
+{
+	uint16_t raw;
+	int ret;
+
+	ret = i2c_read_2_bytes( port_num, slave_address, CMD_ONE(ch), &raw );
+	if ( ret == I2C_SUCCESS ) {
+		*value = raw & AD7998_BITMASK;
+	}
+	return ret;
+}
+
+/*
+** CONVST MODE - a pulse on CONVST powers the part up on its rising edge, and the falling edge
+samples and converts the next channel of the configured sequence, after which the part powers
+down again. the result sits in the conversion result register, channel id and all, until the
+next conversion replaces it. reading it is a plain 2 byte read with the address pointer on
+that register, which converts nothing, so the sample instant is the pulse edge whatever the
+I2C traffic. rewriting the configuration register starts the sequence over at its lowest
+channel. the pulses come from nubaja_convst.h.
+*/
+
+//the last conversion, raw with its channel id in bits 14:12
+int ad7998_read_result ( int port_num, int slave_address, uint16_t *raw )
+{
+	return i2c_read_2_bytes( port_num, slave_address, CONVERSION_RESULT, raw );
+}
+
+//back to the first channel of the set for the next CONVST pulse. quiet, unlike ad7998_config
+int ad7998_restart_chset ( int port_num, int slave_address, const ad7998_chset_t *cs )
+{
+	return i2c_write_2_byte( port_num, slave_address, CONFIGURATION, cs->ch_sel_h,
+		cs->ch_sel_l | FLTR | ALERT_EN | ALERT_BUSY | ALERT_BUSY_POLARITY );
+}
+
+/*
+** ALERT LIMITS - the part compares every conversion of channels 1-4 against its DATA_LOW and
+DATA_HIGH registers and pulls ALERT low on a violation, with no host involved. with the cycle
+timer running it also converts on its own between daq reads, so a limit is checked every
+cycle interval whatever the daq rate. alert status bit 2k is channel k+1 under DATA_LOW,
+bit 2k+1 channel k+1 over DATA_HIGH.
+*/
+
+typedef struct
+{
+	uint16_t low, high; 	//counts, 0 / AD7998_BITMASK = never
+} ad7998_limit_t;
+
+void ad7998_alert_config ( int port_num, int slave_address, const ad7998_chset_t *cs,
+	const ad7998_limit_t lim[AD7998_LIMIT_CH], uint8_t cycle )
+{
+	int ch;
+
+	for ( ch = 1; ch <= AD7998_LIMIT_CH; ch++ ) {
+		i2c_write_2_byte( port_num, slave_address, DATA_LOW(ch), lim[ch-1].low >> 8, lim[ch-1].low & 0xff );
+		i2c_write_2_byte( port_num, slave_address, DATA_HIGH(ch), lim[ch-1].high >> 8, lim[ch-1].high & 0xff );
+	}
+	//clear anything latched before the limits were set, then hand the pin to ALERT
+	i2c_write_2_byte( port_num, slave_address, CONFIGURATION, cs->ch_sel_h,
+		cs->ch_sel_l | FLTR | ALERT_RESET | ALERT_BUSY_POLARITY );
+	i2c_write_2_byte( port_num, slave_address, CONFIGURATION, cs->ch_sel_h,
+		cs->ch_sel_l | FLTR | ALERT_ON | ALERT_BUSY_POLARITY );
+	i2c_write_byte( port_num, slave_address, CYCLE_TIMER, cycle );
+	printf("ad7998_alert_config -- limits set, cycle 0x%02x\n", cycle);
 }
 
-//read function for channel selection 1
-void ad7998_read_1 ( int port_num, int slave_address, 
-	uint16_t *ch2, 
-	uint16_t *ch3,
-	uint16_t *ch4,
-	uint16_t *ch6 )
+//back to the plain channel set: no automatic conversions, pin unused
+void ad7998_alert_off ( int port_num, int slave_address, const ad7998_chset_t *cs )
 {
-	uint8_t addr_pointer = CMD_MODE; //cmd mode
-	i2c_read_2_bytes_4( port_num, slave_address, addr_pointer, 
-		ch2, ch3, ch4, ch6 );
-	*ch2 = ( *ch2 & AD7998_BITMASK );
-	*ch3 = ( *ch3 & AD7998_BITMASK );
-	*ch4 = ( *ch4 & AD7998_BITMASK );
-	*ch6 = ( *ch6 & AD7998_BITMASK );	
+	i2c_write_byte( port_num, slave_address, CYCLE_TIMER, CYCLE_OFF );
+	ad7998_config( port_num, slave_address, cs->ch_sel_h, cs->ch_sel_l );
 }
 
-//read function for channel selection 3
-void ad7998_read_3 ( int port_num, int slave_address, 
-	uint16_t *ch1, 
-	uint16_t *ch2,
-	uint16_t *ch3,
-	uint16_t *ch4, 
-	uint16_t *ch5, 
-	uint16_t *ch6,
-	uint16_t *ch7,
-	uint16_t *ch8 )
+int ad7998_alert_status ( int port_num, int slave_address, uint8_t *status )
 {
-	uint8_t addr_pointer = CMD_MODE; //cmd mode
-	
-	i2c_read_2_bytes_8( port_num, slave_address, addr_pointer, 
-		 ch1,  ch2,  ch3,  ch4,
-		 ch5,  ch6,  ch7,  ch8 );
-	*ch1 = ( *ch1 & AD7998_BITMASK );
-	*ch2 = ( *ch2 & AD7998_BITMASK );
-	*ch3 = ( *ch3 & AD7998_BITMASK );
-	*ch4 = ( *ch4 & AD7998_BITMASK );	
-	*ch5 = ( *ch5 & AD7998_BITMASK );
-	*ch6 = ( *ch6 & AD7998_BITMASK );
-	*ch7 = ( *ch7 & AD7998_BITMASK );
-	*ch8 = ( *ch8 & AD7998_BITMASK );
+	return i2c_read_byte( port_num, slave_address, ALERT_STATUS, status );
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,154 @@
+#ifndef NUBAJA_ALERT_H_
+#define NUBAJA_ALERT_H_
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "nubaja_ad7998.h"
+#include "nubaja_gpio.h"
+#include "nubaja_pwm.h"
+#include "nubaja_ctrl.h"
+
+/*
+** HARDWARE LIMIT SHUTDOWN - the AD7998 watches brake and belt temperature against limits
+worked out from MAX_BRAKE_TEMP / MAX_BELT_TEMP, converting on its own every ADC_ALERT_CYCLE,
+and pulls ALERT low the moment one is crossed. adc_alert_isr kills the engine from the edge
+interrupt, then wakes adc_alert_task to zero the brake and throttle PWM (set_throttle and
+set_brake_duty work in floats, which an ISR can't touch). daq_task only picks up the fault
+afterwards to end the run, so none of this waits on the sample rate.
+
+only channels 1-4 have limit registers. brake current is on channel 5, so overcurrent stays
+the software check in ctrl_update. a limit at or past the channel's full scale can never be
+crossed in counts, so it is left off in the part, said so at start-up, and only the software
+check in ctrl_update sees that channel.
+*/
+
+#define ADC_ALERT_GPIO        34             // AD7998 ALERT, open drain, needs the board pull-up (34-39 have none) ***NOT ON PCB YET***
+#define ADC_ALERT_CYCLE       CYCLE_TIME     // AD7998 automatic conversion interval, CYCLE_OFF = only on daq reads
+#define ADC_BRAKE_TEMP_CH     2              // temp3
+#define ADC_BELT_TEMP_CH      3
+
+typedef struct
+{
+  volatile int tripped;
+  volatile int64_t edge_us;      // esp_timer time of the ALERT edge
+  int64_t cut_us;                // ... and of the PWM cut
+  uint8_t status;                // alert status register, read after the cut
+  int port;
+  const ad7998_chset_t *chset;
+  TaskHandle_t task;
+} adc_alert_t;
+
+adc_alert_t adc_alert;
+
+// limit in counts for a channel, 0 if max lies at or past full scale and can't be armed
+static int adc_alert_limit ( const char *what, float max, float scale, float offset, uint16_t *high )
+{
+  *high = phys_to_counts( max, scale, offset );
+  if ( *high < AD7998_BITMASK ) {
+    return 1;
+  }
+  *high = AD7998_BITMASK;
+  printf("adc_alert_start -- *** %s limit %.0f is past full scale (%.0f), NOT ARMED, software check only ***\n",
+         what, max, scale * counts_to_volts( AD7998_BITMASK ) + offset);
+  return 0;
+}
+
+static void adc_alert_isr ( void *arg )
+{
+  BaseType_t woken = pdFALSE;
+
+  engine_off();
+  if ( !adc_alert.tripped ) {
+    adc_alert.edge_us = esp_timer_get_time();
+    adc_alert.tripped = 1;
+    vTaskNotifyGiveFromISR( adc_alert.task, &woken );
+  }
+  if ( woken ) {
+    portYIELD_FROM_ISR();
+  }
+}
+
+static void adc_alert_task ( void *arg )
+{
+  ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+  set_brake_duty( 0 );
+  set_throttle( 0 );
+  adc_alert.cut_us = esp_timer_get_time();
+
+  ad7998_alert_status( adc_alert.port, ADC_SLAVE_ADDR, &adc_alert.status );
+  printf("adc_alert_task -- ALERT, engine off, PWM cut %d us after the edge, status 0x%02x\n",
+         (int) ( adc_alert.cut_us - adc_alert.edge_us ), adc_alert.status);
+  vTaskDelete(NULL);
+}
+
+// program the limits and arm the pin. the isr service comes from configure_gpio
+void adc_alert_start ( int port, const ad7998_chset_t *chset )
+{
+  gpio_config_t io_conf;
+  ad7998_limit_t lim[AD7998_LIMIT_CH];
+  int ch, brake_armed, belt_armed;
+
+  memset( &adc_alert, 0, sizeof(adc_alert) );
+  adc_alert.port = port;
+  adc_alert.chset = chset;
+
+  for ( ch = 0; ch < AD7998_LIMIT_CH; ch++ ) {
+    lim[ch].low = 0;
+    lim[ch].high = AD7998_BITMASK;
+  }
+  brake_armed = adc_alert_limit( "brake temp", MAX_BRAKE_TEMP, THERM_SCALE, THERM_OFFSET,
+                                 &lim[ADC_BRAKE_TEMP_CH - 1].high );
+  belt_armed = adc_alert_limit( "belt temp", MAX_BELT_TEMP, BELT_TEMP_SCALE, BELT_TEMP_OFFSET,
+                                &lim[ADC_BELT_TEMP_CH - 1].high );
+  if ( ( chset->mask & ( 1 << ( ADC_BRAKE_TEMP_CH - 1 ) ) ) == 0 ) {
+    printf("adc_alert_start -- brake temp channel not converted, its limit will not be checked\n");
+    brake_armed = 0;
+  }
+  if ( ( chset->mask & ( 1 << ( ADC_BELT_TEMP_CH - 1 ) ) ) == 0 ) {
+    printf("adc_alert_start -- belt temp channel not converted, its limit will not be checked\n");
+    belt_armed = 0;
+  }
+  if ( !brake_armed && !belt_armed ) {
+    printf("adc_alert_start -- no limit can be armed, adc_alert is off\n");
+    adc_alert.chset = NULL; //adc_alert_stop has nothing to undo
+    return;
+  }
+
+  xTaskCreatePinnedToCore( adc_alert_task, "adc_alert", 2048, NULL, configMAX_PRIORITIES-1,
+                           &adc_alert.task, 1 );
+  ad7998_alert_config( port, ADC_SLAVE_ADDR, chset, lim, ADC_ALERT_CYCLE );
+
+  io_conf.intr_type = GPIO_PIN_INTR_NEGEDGE;
+  io_conf.pin_bit_mask = ( 1ULL << ADC_ALERT_GPIO );
+  io_conf.mode = GPIO_MODE_INPUT;
+  io_conf.pull_up_en = GPIO_PULLUP_DISABLE;
+  io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+  gpio_config( &io_conf );
+  gpio_isr_handler_add( ADC_ALERT_GPIO, adc_alert_isr, NULL );
+
+  if ( brake_armed ) {
+    printf("adc_alert_start -- brake temp > %u counts\n", lim[ADC_BRAKE_TEMP_CH - 1].high);
+  }
+  if ( belt_armed ) {
+    printf("adc_alert_start -- belt temp > %u counts\n", lim[ADC_BELT_TEMP_CH - 1].high);
+  }
+}
+
+// end of run, disarm and stop the automatic conversions
+void adc_alert_stop ()
+{
+  if ( adc_alert.chset == NULL ) {
+    return;
+  }
+  gpio_isr_handler_remove( ADC_ALERT_GPIO );
+  if ( !adc_alert.tripped ) {
+    vTaskDelete( adc_alert.task ); //once tripped it deletes itself
+  }
+  ad7998_alert_off( adc_alert.port, ADC_SLAVE_ADDR, adc_alert.chset );
+}
+
+#endif // NUBAJA_ALERT_H_
@@ -41,7 +41,7 @@ AS1115 init_as1115(int port_num, int slave_address)
 */
 void display_one_digit(AS1115 *dev, uint8_t digit, uint8_t value)
 {
-  i2c_write_byte(dev->port_num, dev->port_num, digit, value);
+  i2c_write_byte(dev->port_num, dev->slave_address, digit, value);
 }
 
 // write 4 digits to an AS1115 display
@@ -50,6 +50,27 @@ void display_4_digits(AS1115 *dev, uint8_t digit_0, uint8_t digit_1, uint8_t dig
   i2c_write_4_bytes(dev->port_num, dev->slave_address, DIGIT_0, digit_0, digit_1, digit_2, digit_3);
 }
 
+// show 0-9999 on the 4 digits with the decimal point before the last n_dec digits,
+// out of range values are clamped
+void display_number(AS1115 *dev, int32_t value, int n_dec)
+{
+  uint8_t d[4];
+  int i;
+
+  if (value < 0) value = 0;
+  if (value > 9999) value = 9999;
+  for (i = 3; i >= 0; i--)
+  {
+    d[i] = value % 10;
+    value /= 10;
+  }
+  if ( ( n_dec > 0 ) && ( n_dec < 4 ) )
+  {
+    d[3 - n_dec] |= 0x80;  // decimal point segment
+  }
+  display_4_digits(dev, d[0], d[1], d[2], d[3]);
+}
+
 // disable an AS1115 display
 void display_disable(AS1115 *dev)
 {
@@ -0,0 +1,158 @@
+#ifndef NUBAJA_BRAKE_H_
+#define NUBAJA_BRAKE_H_
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "esp_intr_alloc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nubaja_ad7998.h"
+#include "nubaja_pwm.h"
+#include "nubaja_pid.h"
+#include "nubaja_ctrl.h"
+#include "nubaja_alert.h"
+#include "nubaja_mem.h"
+#include "nubaja_trace.h"
+
+/*
+** PWM-SYNCHRONOUS BRAKE CURRENT - the coil current ripples at BRAKE_PWM_FREQUENCY, and the
+daq read lands at an arbitrary point of the PWM period, so i_brake aliases the ripple. with
+brake_sync on, the MCPWM timer-equals-zero interrupt of the brake timer wakes brake_sync_task
+at the start of every period. it converts the brake current channel alone, at the same
+latency after the period start each time, runs the current PID on it and sets the duty,
+which the MCPWM latches at the next period start. the loop then runs once a PWM period with
+one sample of delay. daq_task only hands over the set point, and logs the synchronous sample
+as i_brake.
+
+the PID gains are per update, so the loop runs them at BRAKE_PWM_FREQUENCY: retune with
+pid_sweep -hz 1000. the reads share the ADC bus with daq_task, i2c_sim shows what that costs.
+*/
+
+#define BRAKE_SYNC_CH         5              // AD7998 channel of the brake current
+#define BRAKE_SYNC_TEZ_INT    BIT4           // MCPWM int_ena / int_st / int_clr, timer 1 equals zero
+
+typedef struct
+{
+  volatile int run;
+  volatile float sp;             // brake current set point, % of I_BRAKE_MAX. 0 = off
+  volatile uint16_t i_brake;     // last synchronous sample, adc counts
+  volatile int64_t tez_us;       // esp_timer time of the last period start
+  uint32_t samples, missed;      // periods sampled / read failed or woke too late
+  int32_t max_lat_us;            // period start to sample taken
+  int port;
+  pid_ctrl_t pid;
+  intr_handle_t isr;
+  TaskHandle_t task;
+} brake_sync_t;
+
+brake_sync_t brake_sync;
+
+static void IRAM_ATTR brake_sync_isr ( void *arg )
+{
+  BaseType_t woken = pdFALSE;
+  uint32_t st = MCPWM0.int_st.val;
+
+  trace_begin( TRACE_brake_isr, 0 );
+  MCPWM0.int_clr.val = st;
+  if ( st & BRAKE_SYNC_TEZ_INT ) {
+    brake_sync.tez_us = esp_timer_get_time();
+    vTaskNotifyGiveFromISR( brake_sync.task, &woken );
+  }
+  trace_end( TRACE_brake_isr, 0 );
+  if ( woken ) {
+    portYIELD_FROM_ISR();
+  }
+}
+
+static void brake_sync_task ( void *arg )
+{
+  uint16_t counts;
+  uint32_t n;
+  int32_t lat;
+  float amps, duty;
+
+  while ( brake_sync.run )
+  {
+    //more than one period start pending means we fell behind, skip to the latest
+    n = ulTaskNotifyTake( pdTRUE, 10 / portTICK_PERIOD_MS );
+    if ( n == 0 ) {
+      continue;
+    }
+    brake_sync.missed += n - 1;
+    trace_begin( TRACE_brake_sync, 0 );
+    if ( ad7998_read_one( brake_sync.port, ADC_SLAVE_ADDR, BRAKE_SYNC_CH, &counts ) != I2C_SUCCESS ) {
+      ++brake_sync.missed;
+      trace_end( TRACE_brake_sync, 0 );
+      continue;
+    }
+    lat = (int32_t) ( esp_timer_get_time() - brake_sync.tez_us );
+    if ( lat > 1000000 / BRAKE_PWM_FREQUENCY ) {
+      ++brake_sync.missed; //sampled in the next period, not the one that woke us
+    }
+    if ( lat > brake_sync.max_lat_us ) {
+      brake_sync.max_lat_us = lat;
+    }
+    brake_sync.i_brake = counts;
+    ++brake_sync.samples;
+
+    if ( ( brake_sync.sp <= 0 ) | adc_alert.tripped ) {
+      reset_pid( &brake_sync.pid );
+      set_brake_duty( 0 );
+      trace_end( TRACE_brake_sync, counts );
+      continue;
+    }
+    amps = ( counts_to_volts( counts ) * I_BRAKE_SCALE ) + I_BRAKE_OFFSET;
+    pid_update( &brake_sync.pid, brake_sync.sp, 100 * ( amps / I_BRAKE_MAX ) );
+    duty = brake_sync.pid.output;
+    set_brake_duty( ( duty > 0 ) ? duty : 0 );
+    trace_end( TRACE_brake_sync, counts );
+  }
+
+  set_brake_duty( 0 );
+  mem_note_stack( MEM_TASK_BRAKE );
+  brake_sync.task = NULL;
+  vTaskDelete(NULL);
+}
+
+// start of a run, after pwm_init. the brake PWM keeps running, only its interrupt is added
+void brake_sync_start ( int port )
+{
+  memset( &brake_sync, 0, sizeof(brake_sync) );
+  brake_sync.port = port;
+  brake_sync.run = 1;
+  init_pid( &brake_sync.pid, KP, KI, KD, BRAKE_WINDUP_GUARD, BRAKE_OUTPUT_MAX );
+
+  xTaskCreatePinnedToCore( brake_sync_task, "brake_sync", 2048, NULL, configMAX_PRIORITIES-1,
+                           &brake_sync.task, 1 );
+  mcpwm_isr_register( MCPWM_UNIT_0, brake_sync_isr, NULL, ESP_INTR_FLAG_IRAM, &brake_sync.isr );
+  MCPWM0.int_clr.val = BRAKE_SYNC_TEZ_INT;
+  MCPWM0.int_ena.val |= BRAKE_SYNC_TEZ_INT;
+  printf("brake_sync_start -- channel %d sampled every %d us PWM period\n",
+         BRAKE_SYNC_CH, 1000000 / BRAKE_PWM_FREQUENCY);
+}
+
+// set point from daq_task, every tick. 0 stops braking at the next period
+void brake_sync_set ( float sp )
+{
+  brake_sync.sp = sp;
+}
+
+// end of run: interrupt off, the task zeroes the duty and exits
+void brake_sync_stop ()
+{
+  if ( !brake_sync.run ) {
+    return;
+  }
+  MCPWM0.int_ena.val &= ~BRAKE_SYNC_TEZ_INT;
+  esp_intr_free( brake_sync.isr );
+  brake_sync.sp = 0;
+  brake_sync.run = 0;
+  while ( brake_sync.task != NULL ) {
+    vTaskDelay( 10 / portTICK_PERIOD_MS );
+  }
+  printf("brake_sync -- %u periods sampled, %u missed, worst %d us after the period start\n",
+         (unsigned) brake_sync.samples, (unsigned) brake_sync.missed, (int) brake_sync.max_lat_us);
+}
+
+#endif // NUBAJA_BRAKE_H_
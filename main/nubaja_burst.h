@@ -0,0 +1,314 @@
+#ifndef NUBAJA_BURST_H_
+#define NUBAJA_BURST_H_
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "nubaja_log_format.h"
+#include "nubaja_ad7998.h"
+#include "nubaja_gpio.h"
+#include "nubaja_config.h"
+#include "nubaja_mem.h"
+#include "nubaja_trace.h"
+
+/*
+** BURST CAPTURE - a second, faster sampler for the few moments worth a close look. burst_task
+samples the channels in burst_channels at CAP_SAMPLE_HZ into a ring that always holds the
+last BURST_RING samples. a trigger (burst_trigger from daq_task on launch or a fault trip,
+the trigger input, or a level crossing on one channel) starts a window: sampling carries on
+for the post-trigger part, then the ring is frozen while burst_write_task appends the window
+to data_N.cap. the normal rate log is not touched. triggers that land while a window is
+being filled or written are counted as missed.
+*/
+
+#define CAP_SAMPLE_HZ         1000
+#define BURST_RING            512            // samples kept, pre + post must fit
+#define BURST_TRIG_GPIO       13             // external trigger input, active low ***NOT ON PCB YET***
+
+// burst_task states
+#define BURST_ARMED           0
+#define BURST_POST            1              // triggered, filling the post-trigger part
+#define BURST_WRITING         2              // ring frozen while the window goes to the card
+
+typedef struct
+{
+  cap_sample ring[BURST_RING];
+  uint32_t head;                   // samples taken, next one goes to ring[head % BURST_RING]
+  uint32_t fresh;                  // head when last re-armed, older samples are stale
+  volatile int state;
+  volatile int run;
+  uint16_t ch_mask;                // bit k = log channel k
+  int n_pre, n_post;
+  int level_ch;                    // log channel for the level trigger, -1 = off
+  uint16_t level;
+  uint16_t last_level_v;
+  int adc_port;
+  const ad7998_chset_t *chset;
+  volatile uint32_t daq_idx;       // latest daq sample index, goes in the window header
+  uint16_t pending;                // trigger cause waiting for burst_task, 0 = none
+  cap_window_header win;           // window being filled
+  uint32_t win_end;                // head once the post-trigger part is full
+  uint32_t n_windows, n_missed;
+  char filename[32];
+  esp_timer_handle_t timer;
+  TaskHandle_t task;
+} burst_t;
+
+burst_t burst;
+portMUX_TYPE burst_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// ask for a window, from any task. ignored while one is already pending
+void burst_trigger ( uint16_t cause )
+{
+  portENTER_CRITICAL( &burst_mux );
+  if ( burst.pending == 0 ) {
+    burst.pending = cause;
+  }
+  portEXIT_CRITICAL( &burst_mux );
+}
+
+static void IRAM_ATTR burst_gpio_isr ( void *arg )
+{
+  portENTER_CRITICAL_ISR( &burst_mux );
+  if ( burst.pending == 0 ) {
+    burst.pending = CAP_TRIG_GPIO;
+  }
+  portEXIT_CRITICAL_ISR( &burst_mux );
+}
+
+// runs in the esp_timer task, the sampling itself happens in burst_task
+static void burst_timer_cb ( void *arg )
+{
+  xTaskNotifyGive( burst.task );
+}
+
+static void burst_sample ( cap_sample *s )
+{
+  uint16_t adc[AD7998_NUM_CH] = { 0 };
+  uint16_t v;
+  int ch;
+
+  trace_begin( TRACE_burst_sample, 0 );
+  s->time_us = (uint32_t) esp_timer_get_time();
+  if ( burst.ch_mask & ~( ( 1 << LOG_CH_prim_rpm ) | ( 1 << LOG_CH_sec_rpm ) ) ) {
+    ad7998_read( burst.adc_port, ADC_SLAVE_ADDR, burst.chset, adc );
+  }
+  for ( ch = 0; ch < LOG_NUM_CH; ch++ ) {
+    v = 0;
+    if ( burst.ch_mask & ( 1 << ch ) ) {
+      if ( log_ch_adc[ch] ) {
+        v = adc[log_ch_adc[ch] - 1];
+      }
+      else if ( ch == LOG_CH_prim_rpm ) {
+        rpm_log( primary_rpm_queue, &v );
+      }
+      else if ( ch == LOG_CH_sec_rpm ) {
+        rpm_log( secondary_rpm_queue, &v );
+      }
+    }
+    s->ch[ch] = v;
+  }
+  trace_end( TRACE_burst_sample, 0 );
+}
+
+// append the frozen window to the capture file, then re-arm
+static void burst_write_task ( void *arg )
+{
+  cap_window_header *w = &burst.win;
+  uint32_t first = ( burst.head - w->n_samples ) % BURST_RING;
+  uint32_t n1 = ( w->n_samples < BURST_RING - first ) ? w->n_samples : BURST_RING - first;
+  uint32_t n2 = w->n_samples - n1;
+  cap_file_header fh;
+  FILE *fp;
+
+  w->magic = CAP_WINDOW_MAGIC;
+  w->crc = 0;
+  w->crc = log_crc32( 0, w, sizeof(*w) );
+  w->crc = log_crc32( w->crc, &burst.ring[first], n1 * sizeof(cap_sample) );
+  w->crc = log_crc32( w->crc, &burst.ring[0], n2 * sizeof(cap_sample) );
+
+  // the file only exists once there is something to put in it
+  fp = fopen( burst.filename, ( burst.n_windows == 0 ) ? "w" : "a" );
+  if ( fp == NULL ) {
+    printf("burst_write_task -- failed to open %s\n", burst.filename);
+  }
+  else {
+    if ( burst.n_windows == 0 ) {
+      cap_file_header_init( &fh, CAP_SAMPLE_HZ );
+      fwrite( &fh, sizeof(fh), 1, fp );
+    }
+    fwrite( w, sizeof(*w), 1, fp );
+    fwrite( &burst.ring[first], sizeof(cap_sample), n1, fp );
+    fwrite( &burst.ring[0], sizeof(cap_sample), n2, fp );
+    fclose( fp );
+    ++burst.n_windows;
+    printf("burst_write_task -- window %u, cause %d at idx %u, %d samples\n",
+           (unsigned) burst.n_windows, w->cause, (unsigned) w->trig_idx, w->n_samples);
+  }
+
+  burst.fresh = burst.head;
+  burst.state = BURST_ARMED;
+  mem_note_stack( MEM_TASK_WRITER );
+  vTaskDelete(NULL);
+}
+
+static void burst_freeze ()
+{
+  burst.state = BURST_WRITING;
+  xTaskCreatePinnedToCore( burst_write_task, "burst_write", 3072, NULL,
+                           (configMAX_PRIORITIES-3), NULL, 1 );
+}
+
+static void burst_task ( void *arg )
+{
+  uint16_t cause;
+  cap_sample *s;
+
+  // a window still filling when the run ends is finished first, it is likely the fault
+  while ( burst.run || ( burst.state == BURST_POST ) )
+  {
+    ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+
+    portENTER_CRITICAL( &burst_mux );
+    cause = burst.pending;
+    burst.pending = 0;
+    portEXIT_CRITICAL( &burst_mux );
+
+    if ( burst.state == BURST_WRITING ) {
+      burst.n_missed += ( cause != 0 );
+      continue;
+    }
+
+    s = &burst.ring[burst.head % BURST_RING];
+    burst_sample( s );
+    ++burst.head;
+
+    if ( burst.level_ch >= 0 ) {
+      if ( ( burst.head > burst.fresh + 1 ) & ( burst.last_level_v < burst.level ) &
+           ( s->ch[burst.level_ch] >= burst.level ) & ( cause == 0 ) ) {
+        cause = CAP_TRIG_LEVEL;
+      }
+      burst.last_level_v = s->ch[burst.level_ch];
+    }
+
+    if ( cause && ( burst.state == BURST_ARMED ) ) {
+      // the sample just taken is the trigger sample, n_pre older ones go before it
+      uint32_t have = burst.head - 1 - burst.fresh;
+      burst.win.cause = cause;
+      burst.win.ch_mask = burst.ch_mask;
+      burst.win.trig_idx = burst.daq_idx;
+      burst.win.trig_time_us = s->time_us;
+      burst.win.n_pre = ( have < burst.n_pre ) ? have : burst.n_pre;
+      burst.win.n_samples = burst.win.n_pre + burst.n_post;
+      burst.win_end = burst.head + burst.n_post - 1;
+      burst.state = BURST_POST;
+    }
+    else if ( cause ) {
+      ++burst.n_missed;
+    }
+
+    if ( ( burst.state == BURST_POST ) && ( burst.head == burst.win_end ) ) {
+      burst_freeze();
+    }
+  }
+
+  esp_timer_stop( burst.timer );
+  esp_timer_delete( burst.timer );
+  printf("burst_task -- %u windows, %u triggers missed\n",
+         (unsigned) burst.n_windows, (unsigned) burst.n_missed);
+  mem_note_stack( MEM_TASK_BURST );
+  burst.task = NULL;
+  vTaskDelete(NULL);
+}
+
+// start the sampler for a run if the boot config selects any channels
+// 1 if burst_start with this config would sample AD7998 channels
+int burst_reads_adc ( const config_t *cfg )
+{
+  int mask = cfg->burst_channels & ( ( 1 << LOG_NUM_CH ) - 1 );
+
+  if ( cfg->burst_level_ch >= 0 ) {
+    mask |= ( 1 << cfg->burst_level_ch );
+  }
+  return ( mask & ~( ( 1 << LOG_CH_prim_rpm ) | ( 1 << LOG_CH_sec_rpm ) ) ) != 0;
+}
+
+void burst_start ( const config_t *cfg, int adc_port, const ad7998_chset_t *chset, int file_num )
+{
+  gpio_config_t io_conf;
+  uint16_t adc_mask = ( cfg->burst_channels >> 2 ) & 0xff;
+
+  // the last run's sampler may still be finishing its final window
+  while ( ( burst.task != NULL ) | ( burst.state == BURST_WRITING ) ) {
+    vTaskDelay( 10 / portTICK_PERIOD_MS );
+  }
+  memset( &burst, 0, sizeof(burst) );
+  burst.ch_mask = cfg->burst_channels & ( ( 1 << LOG_NUM_CH ) - 1 );
+  burst.level_ch = cfg->burst_level_ch;
+  burst.level = cfg->burst_level;
+  if ( burst.level_ch >= 0 ) {
+    burst.ch_mask |= ( 1 << burst.level_ch );
+  }
+  if ( burst.ch_mask == 0 ) {
+    return;
+  }
+
+  burst.n_pre = cfg->burst_pre_ms * CAP_SAMPLE_HZ / 1000;
+  burst.n_post = cfg->burst_post_ms * CAP_SAMPLE_HZ / 1000;
+  if ( burst.n_post < 1 ) {
+    burst.n_post = 1;
+  }
+  if ( burst.n_pre + burst.n_post > BURST_RING ) {
+    burst.n_post = ( burst.n_post < BURST_RING / 2 ) ? burst.n_post : BURST_RING / 2;
+    burst.n_pre = BURST_RING - burst.n_post;
+    printf("burst_start -- window too long, using %d ms pre / %d ms post\n",
+           burst.n_pre * 1000 / CAP_SAMPLE_HZ, burst.n_post * 1000 / CAP_SAMPLE_HZ);
+  }
+  if ( adc_mask & ~chset->mask ) {
+    printf("burst_start -- adc channels 0x%02x not in adc_channels, they will read 0\n",
+           adc_mask & ~chset->mask);
+  }
+
+  burst.adc_port = adc_port;
+  burst.chset = chset;
+  burst.run = 1;
+  burst.state = BURST_ARMED;
+  sprintf( burst.filename, "/sdcard/data_%d.cap", file_num );
+
+  // external trigger, needs the isr service from configure_gpio
+  io_conf.intr_type = GPIO_PIN_INTR_NEGEDGE;
+  io_conf.pin_bit_mask = ( 1ULL << BURST_TRIG_GPIO );
+  io_conf.mode = GPIO_MODE_INPUT;
+  io_conf.pull_up_en = GPIO_PULLUP_ENABLE;
+  io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+  gpio_config( &io_conf );
+  gpio_isr_handler_add( BURST_TRIG_GPIO, burst_gpio_isr, NULL );
+
+  xTaskCreatePinnedToCore( burst_task, "burst", 2048, NULL, (configMAX_PRIORITIES-1), &burst.task, 1 );
+
+  esp_timer_create_args_t timer_args;
+  timer_args.callback = burst_timer_cb;
+  timer_args.arg = NULL;
+  timer_args.dispatch_method = ESP_TIMER_TASK;
+  timer_args.name = "burst";
+  esp_timer_create( &timer_args, &burst.timer );
+  esp_timer_start_periodic( burst.timer, 1000000 / CAP_SAMPLE_HZ );
+
+  printf("burst_start -- channels 0x%03x at %d Hz, %d ms pre / %d ms post\n", burst.ch_mask,
+         CAP_SAMPLE_HZ, burst.n_pre * 1000 / CAP_SAMPLE_HZ, burst.n_post * 1000 / CAP_SAMPLE_HZ);
+}
+
+// end of run, burst_task finishes a window that is still filling and exits
+void burst_stop ()
+{
+  if ( burst.task == NULL ) {
+    return;
+  }
+  burst.run = 0;
+  gpio_isr_handler_remove( BURST_TRIG_GPIO );
+}
+
+#endif // NUBAJA_BURST_H_
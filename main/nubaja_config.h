@@ -0,0 +1,222 @@
+#ifndef NUBAJA_CONFIG_H_
+#define NUBAJA_CONFIG_H_
+
+#include <stdio.h>
+#include <string.h>
+#include "nubaja_ad7998.h"
+#include "nubaja_log_format.h"
+
+#define CONFIG_FILENAME       "/sdcard/config.txt"
+
+// display_ch values
+#define DISPLAY_RPM           0
+#define DISPLAY_ENG_POWER     1
+#define DISPLAY_CVT_RATIO     2
+#define DISPLAY_EFFICIENCY    3
+
+#define AUX_BUS_HZ            50             // IMU / display poll rate
+
+/*
+** BOOT CONFIG - read from CONFIG_FILENAME on the SD card, one "key = value" per line, # for comments
+profile = 1         profile number (see get_profile), 0 = prompt over serial
+engine_prompt = 0   1 = wait for start at the console (engine running) before the first run
+verbose = 0         1 = print SD card info at boot
+adc_channels = 0xd7 AD7998 channels to convert, bit k = channel k+1 (see nubaja_ad7998.h)
+adc_bus = 0         I2C controller per device: 0 = PORT_0, 1 = PORT_1, -1 = not fitted
+imu_bus = 1         the ADC gets a bus to itself at 1 MHz; a bus carrying the IMU or display
+display_bus = 1     runs at 400 kHz, and they are polled from their own task (aux_bus_task)
+display_ch = 0      0 engine rpm, 1 engine power (hp), 2 CVT ratio, 3 powertrain efficiency (%)
+adc_alert = 0       1 = AD7998 temperature limits on the ALERT pin cut the outputs in hardware
+                    (nubaja_alert.h). leave 0 until the pin has its pull-up, or it floats
+adc_convst = 0      us between CONVST pulses, one per ADC channel each tick, so the samples are
+                    timed by hardware (nubaja_convst.h), 100-255. 0 = converted by the I2C read.
+                    off while adc_alert, brake_sync or a burst capture of adc channels is on
+brake_sync = 0      1 = brake current sampled and controlled once a PWM period (nubaja_brake.h),
+                    i_sp is then a current set point for the PID
+burst_channels = 0x113  burst capture channels, bit k = log channel k (prim_rpm, sec_rpm, then
+                    AD7998 channels 1-8, see nubaja_burst.h), 0 = no burst capture
+burst_pre_ms = 200  burst window before / after the trigger
+burst_post_ms = 200
+burst_level_ch = -1 log channel for the level trigger, -1 = off
+burst_level = 0     level trigger threshold, raw counts / rpm, fires on a rising crossing
+log_qos_fill = 60   logging buffer fill (%) at which the slow channels are first logged at a
+log_qos_step = 15   lower rate, and the step to each further level (nubaja_log_qos.h), 0 = off
+breakin_governor = 1  1 = profile 4 holds BREAK_IN_RPM with the rpm governor (nubaja_governor.h),
+                    0 = the constant BREAK_IN_TPS throttle
+trace_events = 0    timeline trace ring, events kept (rounded down to a power of two, 8 bytes
+                    each), written to data_N.trc at the end of the run (nubaja_trace.h), 0 = off
+trace_freeze = 0    1 = stop the trace half a ring after the first late or overrun tick
+with no config file on the card every prompt is kept, as for a bench setup
+*/
+
+typedef struct
+{
+  int found;            // config file was present on the card
+  int profile;
+  int engine_prompt;
+  int verbose;
+  int adc_channels;
+  int adc_bus;
+  int imu_bus;
+  int display_bus;
+  int display_ch;
+  int adc_alert;
+  int adc_convst;
+  int brake_sync;
+  int burst_channels;
+  int burst_pre_ms;
+  int burst_post_ms;
+  int burst_level_ch;
+  int burst_level;
+  int log_qos_fill;
+  int log_qos_step;
+  int breakin_governor;
+  int trace_events;
+  int trace_freeze;
+} config_t;
+
+void config_defaults ( config_t *cfg )
+{
+  cfg->found = 0;
+  cfg->profile = 0;
+  cfg->engine_prompt = 1;
+  cfg->verbose = 1;
+  cfg->adc_channels = AD7998_CH_DEFAULT;
+  cfg->adc_bus = PORT_0;
+  cfg->imu_bus = PORT_NONE;
+  cfg->display_bus = PORT_NONE;
+  cfg->display_ch = DISPLAY_RPM;
+  cfg->adc_alert = 0;
+  cfg->adc_convst = 0;
+  cfg->brake_sync = 0;
+  cfg->burst_channels = 0;
+  cfg->burst_pre_ms = 200;
+  cfg->burst_post_ms = 200;
+  cfg->burst_level_ch = -1;
+  cfg->burst_level = 0;
+  cfg->log_qos_fill = 60;
+  cfg->log_qos_step = 15;
+  cfg->breakin_governor = 1;
+  cfg->trace_events = 0;
+  cfg->trace_freeze = 0;
+}
+
+// I2C controller number from a config value, bad values fall back to dflt
+static int config_bus ( const char *key, int val, int dflt )
+{
+  if ( ( val == PORT_NONE ) | ( val == PORT_0 ) | ( val == PORT_1 ) ) {
+    return val;
+  }
+  printf("config_load -- bad %s %d, using %d\n", key, val, dflt);
+  return dflt;
+}
+
+// bus clock for a port: 1 MHz only when the AD7998 has it to itself,
+// the IMU and display are 400 kHz parts
+int config_bus_clk ( const config_t *cfg, int port )
+{
+  if ( ( cfg->imu_bus == port ) | ( cfg->display_bus == port ) ) {
+    return FAST_MODE;
+  }
+  return FAST_MODE_PLUS;
+}
+
+int config_bus_used ( const config_t *cfg, int port )
+{
+  return ( cfg->adc_bus == port ) | ( cfg->imu_bus == port ) | ( cfg->display_bus == port );
+}
+
+void config_load ( config_t *cfg, const char *path )
+{
+  char line[64];
+  char key[32];
+  int val;
+
+  config_defaults( cfg );
+  FILE *fp = fopen( path, "r" );
+  if ( fp == NULL ) {
+    printf("config_load -- no %s, using interactive defaults\n", path);
+    return;
+  }
+  cfg->found = 1;
+
+  while ( fgets( line, sizeof(line), fp ) != NULL ) {
+    if ( ( line[0] == '#' ) | ( sscanf( line, " %31[a-z_] = %i", key, &val ) != 2 ) ) {
+      continue;
+    }
+    if ( !strcmp( key, "profile" ) ) {
+      cfg->profile = val;
+    }
+    else if ( !strcmp( key, "engine_prompt" ) ) {
+      cfg->engine_prompt = val;
+    }
+    else if ( !strcmp( key, "verbose" ) ) {
+      cfg->verbose = val;
+    }
+    else if ( !strcmp( key, "adc_channels" ) ) {
+      cfg->adc_channels = val & 0xff;
+    }
+    else if ( !strcmp( key, "adc_bus" ) ) {
+      cfg->adc_bus = config_bus( key, val, PORT_0 );
+    }
+    else if ( !strcmp( key, "imu_bus" ) ) {
+      cfg->imu_bus = config_bus( key, val, PORT_NONE );
+    }
+    else if ( !strcmp( key, "display_bus" ) ) {
+      cfg->display_bus = config_bus( key, val, PORT_NONE );
+    }
+    else if ( !strcmp( key, "display_ch" ) ) {
+      cfg->display_ch = val;
+    }
+    else if ( !strcmp( key, "adc_alert" ) ) {
+      cfg->adc_alert = val;
+    }
+    else if ( !strcmp( key, "adc_convst" ) ) {
+      cfg->adc_convst = ( val > 0 ) ? val : 0;
+    }
+    else if ( !strcmp( key, "brake_sync" ) ) {
+      cfg->brake_sync = val;
+    }
+    else if ( !strcmp( key, "burst_channels" ) ) {
+      cfg->burst_channels = val & ( ( 1 << LOG_NUM_CH ) - 1 );
+    }
+    else if ( !strcmp( key, "burst_pre_ms" ) ) {
+      cfg->burst_pre_ms = ( val > 0 ) ? val : 0;
+    }
+    else if ( !strcmp( key, "burst_post_ms" ) ) {
+      cfg->burst_post_ms = ( val > 0 ) ? val : 0;
+    }
+    else if ( !strcmp( key, "burst_level_ch" ) ) {
+      cfg->burst_level_ch = ( ( val >= 0 ) & ( val < LOG_NUM_CH ) ) ? val : -1;
+    }
+    else if ( !strcmp( key, "burst_level" ) ) {
+      cfg->burst_level = val;
+    }
+    else if ( !strcmp( key, "log_qos_fill" ) ) {
+      cfg->log_qos_fill = ( val > 0 ) ? val : 0;
+    }
+    else if ( !strcmp( key, "log_qos_step" ) ) {
+      cfg->log_qos_step = ( val > 0 ) ? val : 0;
+    }
+    else if ( !strcmp( key, "breakin_governor" ) ) {
+      cfg->breakin_governor = val;
+    }
+    else if ( !strcmp( key, "trace_events" ) ) {
+      cfg->trace_events = ( val > 0 ) ? val : 0;
+    }
+    else if ( !strcmp( key, "trace_freeze" ) ) {
+      cfg->trace_freeze = val;
+    }
+    else {
+      printf("config_load -- unknown key %s\n", key);
+    }
+  }
+  fclose(fp);
+  if ( cfg->adc_bus == PORT_NONE ) {
+    printf("config_load -- the ADC can't be left off, using bus %d\n", PORT_0);
+    cfg->adc_bus = PORT_0;
+  }
+  printf("config_load -- profile %d, engine_prompt %d\n", cfg->profile, cfg->engine_prompt);
+}
+
+#endif // NUBAJA_CONFIG_H_
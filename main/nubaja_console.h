@@ -0,0 +1,111 @@
+#ifndef NUBAJA_CONSOLE_H_
+#define NUBAJA_CONSOLE_H_
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "nubaja_mem.h"
+
+/*
+** COMMAND CONSOLE - line commands over the serial port, read by a low priority task that
+blocks on the uart driver, so typing never holds up daq_task. the commands themselves live
+with the state they touch (main.c) and are handed over as a table; "help" lists it.
+*/
+
+#define CONSOLE_UART          UART_NUM_0
+#define CONSOLE_RX_BUF        256            // uart driver rx ring, bytes
+#define CONSOLE_LINE          64
+#define CONSOLE_MAX_ARGS      4
+
+typedef struct
+{
+  const char *name;
+  const char *args;                // usage, "" for none
+  const char *help;
+  void (*fn) ( int argc, char **argv );
+} console_cmd_t;
+
+const console_cmd_t *console_cmds = NULL;
+int console_n_cmds = 0;
+
+static void console_help ()
+{
+  int i;
+  for ( i = 0; i < console_n_cmds; i++ ) {
+    printf("  %-8s %-10s %s\n", console_cmds[i].name, console_cmds[i].args, console_cmds[i].help);
+  }
+  printf("  %-8s %-10s %s\n", "help", "", "this list");
+}
+
+// split on spaces and run the matching command
+static void console_exec ( char *line )
+{
+  char *argv[CONSOLE_MAX_ARGS];
+  int argc = 0, i;
+  char *tok = strtok( line, " \t" );
+
+  while ( ( tok != NULL ) && ( argc < CONSOLE_MAX_ARGS ) ) {
+    argv[argc++] = tok;
+    tok = strtok( NULL, " \t" );
+  }
+  if ( argc == 0 ) {
+    return;
+  }
+  if ( !strcmp( argv[0], "help" ) ) {
+    console_help();
+    return;
+  }
+  for ( i = 0; i < console_n_cmds; i++ ) {
+    if ( !strcmp( argv[0], console_cmds[i].name ) ) {
+      console_cmds[i].fn( argc, argv );
+      return;
+    }
+  }
+  printf("console -- unknown command %s, try help\n", argv[0]);
+}
+
+static void console_task ( void *arg )
+{
+  char line[CONSOLE_LINE];
+  int len = 0;
+  uint8_t c;
+
+  for ( ;; )
+  {
+    if ( uart_read_bytes( CONSOLE_UART, &c, 1, portMAX_DELAY ) != 1 ) {
+      continue;
+    }
+    if ( ( c == '\r' ) | ( c == '\n' ) ) {
+      if ( len > 0 ) {
+        printf("\n");
+        line[len] = '\0';
+        console_exec( line );
+        mem_note_stack( MEM_TASK_CONSOLE );
+      }
+      len = 0;
+    }
+    else if ( ( c == '\b' ) | ( c == 0x7f ) ) {
+      if ( len > 0 ) {
+        --len;
+        printf("\b \b");
+      }
+    }
+    else if ( len < CONSOLE_LINE - 1 ) {
+      line[len++] = c;
+      putchar( c ); //echo, the terminal doesn't
+    }
+    fflush( stdout );
+  }
+}
+
+void console_start ( const console_cmd_t *cmds, int n )
+{
+  console_cmds = cmds;
+  console_n_cmds = n;
+  uart_driver_install( CONSOLE_UART, CONSOLE_RX_BUF, 0, 0, NULL, 0 );
+  xTaskCreatePinnedToCore( console_task, "console", 4096, NULL, tskIDLE_PRIORITY + 1, NULL, 1 );
+}
+
+#endif // NUBAJA_CONSOLE_H_
@@ -0,0 +1,182 @@
+#ifndef NUBAJA_CONVST_H_
+#define NUBAJA_CONVST_H_
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "rom/ets_sys.h"
+#include "driver/rmt.h"
+#include "soc/rmt_struct.h"
+#include "nubaja_ad7998.h"
+#include "nubaja_trace.h"
+
+/*
+** HARDWARE-TIMED ADC CONVERSIONS - in command mode the AD7998 converts when the address
+pointer write reaches it, so the sample instant floats with daq_task's wake-up and the bus,
+and each channel of the burst read is converted a couple of bytes after the one before.
+with adc_convst set, daq_timer_isr starts an RMT transmission on ADC_CONVST_GPIO as its first
+act, before it stamps the tick: one CONVST pulse per channel of the set, adc_convst us apart,
+timed by the RMT from the APB clock the daq timer also counts. the nth channel of the set
+(lowest channel first) is sampled n * adc_convst us after dp.time_us, which is the falling
+edge of the first pulse to within a microsecond, every tick. daq_task only collects each
+result before the next pulse replaces it, so a late wake-up or a slow bus no longer moves
+the samples, it can only lose them. between results it waits in short ets_delay_us calls,
+at most one pulse spacing each.
+
+every result carries its channel id. a tick whose daq_task woke after a result was replaced
+falls back to a command mode read of the whole set and restarts the sequence, and is
+counted. the log header records the set and the pulse spacing (adc_channels, adc_convst_us),
+so the offsets travel with the data. anything else converting on the part would break the
+sequence every time, so daq_task leaves this off with adc_alert (the ALERT cycle timer),
+brake_sync or a burst capture that reads the ADC.
+*/
+
+#define ADC_CONVST_GPIO       5              // AD7998 CONVST ***NOT ON PCB YET - FLY WIRE***
+#define ADC_CONVST_RMT_CH     RMT_CHANNEL_0
+#define ADC_CONVST_CLK_DIV    8              // 80 MHz APB / 8 = 0.1 us RMT ticks
+#define ADC_CONVST_TICKS_US   ( APB_CLK_FREQ / ADC_CONVST_CLK_DIV / 1000000 )
+#define ADC_CONVST_HIGH_US    ( 2 * AD7998_POWER_UP_US )
+#define ADC_CONVST_MIN_US     100            // pulse spacing: a daq_task wake-up plus a 2 byte read
+#define ADC_CONVST_MAX_US     255            // fits the log header
+
+typedef struct
+{
+  volatile int run;
+  int port;
+  const ad7998_chset_t *chset;
+  int n;                         // pulses a tick, one per channel of the set
+  int step_us;                   // pulse spacing
+  uint8_t ch[AD7998_NUM_CH];     // channel (0-7) converted by each pulse
+  uint32_t ticks, fallbacks, late;   // collected / read in command mode / of which woke too late
+} adc_convst_t;
+
+adc_convst_t adc_convst;
+
+// from daq_timer_isr, ahead of the tick stamp: the pulse train of this tick
+static inline void IRAM_ATTR adc_convst_fire ()
+{
+  RMT.conf_ch[ADC_CONVST_RMT_CH].conf1.mem_rd_rst = 1;
+  RMT.conf_ch[ADC_CONVST_RMT_CH].conf1.mem_owner = RMT_MEM_OWNER_TX;
+  RMT.conf_ch[ADC_CONVST_RMT_CH].conf1.tx_start = 1;
+}
+
+// start of a run, after the channel set is programmed. step_us 0 = command mode as before
+void adc_convst_start ( int port, const ad7998_chset_t *cs, int step_us )
+{
+  rmt_item32_t items[AD7998_NUM_CH + 1];
+  rmt_config_t cfg;
+  int i, k;
+
+  memset( &adc_convst, 0, sizeof(adc_convst) );
+  if ( step_us <= 0 ) {
+    return;
+  }
+  if ( step_us < ADC_CONVST_MIN_US ) {
+    printf("adc_convst_start -- %d us between pulses is too close, using %d\n", step_us, ADC_CONVST_MIN_US);
+    step_us = ADC_CONVST_MIN_US;
+  }
+  if ( step_us > ADC_CONVST_MAX_US ) {
+    printf("adc_convst_start -- %d us between pulses is too far, using %d\n", step_us, ADC_CONVST_MAX_US);
+    step_us = ADC_CONVST_MAX_US;
+  }
+  adc_convst.port = port;
+  adc_convst.chset = cs;
+  adc_convst.step_us = step_us;
+
+  // high for the power-up, the falling edge converts, low until the next pulse. a zero
+  // duration ends the train
+  memset( items, 0, sizeof(items) );
+  for ( i = 0, k = 0; i < AD7998_NUM_CH; i++ ) {
+    if ( !( ( cs->mask >> i ) & 0x1 ) ) {
+      continue;
+    }
+    adc_convst.ch[k] = i;
+    items[k].level0 = 1;
+    items[k].duration0 = ADC_CONVST_HIGH_US * ADC_CONVST_TICKS_US;
+    items[k].level1 = 0;
+    items[k].duration1 = ( step_us - ADC_CONVST_HIGH_US ) * ADC_CONVST_TICKS_US;
+    ++k;
+  }
+  adc_convst.n = k;
+  if ( k == 0 ) {
+    return;
+  }
+  items[k - 1].duration1 = ADC_CONVST_HIGH_US * ADC_CONVST_TICKS_US; //nothing follows the last one
+
+  memset( &cfg, 0, sizeof(cfg) );
+  cfg.rmt_mode = RMT_MODE_TX;
+  cfg.channel = ADC_CONVST_RMT_CH;
+  cfg.gpio_num = ADC_CONVST_GPIO;
+  cfg.mem_block_num = 1;
+  cfg.clk_div = ADC_CONVST_CLK_DIV;
+  cfg.tx_config.loop_en = false;
+  cfg.tx_config.carrier_en = false;
+  cfg.tx_config.idle_output_en = true;
+  cfg.tx_config.idle_level = RMT_IDLE_LEVEL_LOW;
+  if ( ( rmt_config( &cfg ) != ESP_OK ) || ( rmt_fill_tx_items( ADC_CONVST_RMT_CH, items, k + 1, 0 ) != ESP_OK ) ) {
+    printf("adc_convst_start -- RMT setup failed, converting in command mode\n");
+    return;
+  }
+  ad7998_restart_chset( port, ADC_SLAVE_ADDR, cs );
+  adc_convst.run = 1;
+
+  printf("adc_convst_start -- %d CONVST pulses every tick, %d us apart, offsets from time_us:",
+         adc_convst.n, step_us);
+  for ( k = 0; k < adc_convst.n; k++ ) {
+    printf(" ch%d +%d", adc_convst.ch[k] + 1, k * step_us);
+  }
+  printf(" us\n");
+}
+
+// this tick's results into ch[0..7] by channel, as ad7998_read does. fire_us is the tick
+// stamp. 1 when every channel came from its own pulse, 0 after a command mode read instead,
+// else the I2C error of that read
+int adc_convst_read ( int64_t fire_us, uint16_t *ch )
+{
+  uint16_t raw;
+  int64_t edge_us, wait_us;
+  int k, ret;
+
+  for ( k = 0; k < adc_convst.n; k++ ) {
+    edge_us = fire_us + ADC_CONVST_HIGH_US + k * adc_convst.step_us;
+
+    // gone once the next pulse has converted
+    if ( ( k + 1 < adc_convst.n ) && ( esp_timer_get_time() >= edge_us + adc_convst.step_us ) ) {
+      ++adc_convst.late;
+      break;
+    }
+    wait_us = edge_us + AD7998_CONV_US - esp_timer_get_time();
+    if ( wait_us > 0 ) {
+      ets_delay_us( (uint32_t) wait_us );
+    }
+    if ( ( ad7998_read_result( adc_convst.port, ADC_SLAVE_ADDR, &raw ) != I2C_SUCCESS ) ||
+         ( ( ( raw >> AD7998_CHID_SHIFT ) & 0x7 ) != adc_convst.ch[k] ) ) {
+      break;
+    }
+    ch[adc_convst.ch[k]] = raw & AD7998_BITMASK;
+  }
+  if ( k == adc_convst.n ) {
+    ++adc_convst.ticks;
+    return 1;
+  }
+
+  trace_mark( TRACE_adc_fallback, k );
+  ++adc_convst.fallbacks;
+  ret = ad7998_read( adc_convst.port, ADC_SLAVE_ADDR, adc_convst.chset, ch );
+  ad7998_restart_chset( adc_convst.port, ADC_SLAVE_ADDR, adc_convst.chset );
+  return ( ret == I2C_SUCCESS ) ? 0 : ret;
+}
+
+// end of run: no more pulses from the next tick on
+void adc_convst_stop ()
+{
+  if ( !adc_convst.run ) {
+    return;
+  }
+  adc_convst.run = 0;
+  printf("adc_convst -- %u ticks hardware timed, %u read in command mode (%u woke too late)\n",
+         (unsigned) adc_convst.ticks, (unsigned) adc_convst.fallbacks, (unsigned) adc_convst.late);
+}
+
+#endif // NUBAJA_CONVST_H_
@@ -0,0 +1,163 @@
+#ifndef NUBAJA_CTRL_H_
+#define NUBAJA_CTRL_H_
+
+#include <stdio.h>
+#include "nubaja_proj_vars.h"
+#include "nubaja_fault.h"
+#include "nubaja_pid.h"
+#include "nubaja_log_format.h"
+#include "nubaja_derived.h"
+
+/*
+** CONTROL LOGIC - everything daq_task decides each tick, kept free of ESP-IDF calls so the
+host replay tool runs exactly the same code against recorded samples. daq_task calls
+ctrl_setpoints, reads the sensors into the data point, then calls ctrl_update and applies
+the returned actuator commands.
+*/
+
+// actuator commands for one tick
+typedef struct
+{
+	float throttle; 		//0-100%
+	float brake_duty; 		//0-100%
+	int ebrake_release; 	//1 = release the e-brake this tick
+} ctrl_cmd_t;
+
+float counts_to_volts ( uint16_t adc_counts )
+{
+	float v = ( (float) adc_counts / (float) 4096 ) * (float) ADC_FS;
+	return v;
+}
+
+// inverse of scale * volts + offset, clamped to the 12 bit range. for limits in counts
+uint16_t phys_to_counts ( float x, float scale, float offset )
+{
+	float c = ( ( x - offset ) / scale ) / (float) ADC_FS * (float) 4096;
+	if ( c < 0 ) return 0;
+	if ( c > 4095 ) return 4095;
+	return (uint16_t) c;
+}
+
+// point prof at the set point tables for ctrl->num_profile
+void load_profile ( control_t *ctrl, profile_t *prof )
+{
+	prof->len = BSIZE;
+
+	switch( ctrl->num_profile )
+	{
+		case 1:
+			prof->i_sp = i_sp_accel_launch;
+			prof->tps_sp = tps_sp_accel_launch;
+			break;
+
+		case 2:
+			prof->i_sp = i_sp_accel;
+			prof->tps_sp = tps_sp_accel;
+			break;
+
+		case 3:
+			prof->i_sp = i_sp_hill;
+			prof->tps_sp = tps_sp_hill;
+			break;
+
+		case 4:
+			prof->i_sp = sp_zero; //no need for brake in engine break-in
+			prof->tps_sp = tps_sp_break_in; //constant throttle, or the start point of the rpm governor
+			prof->len = 1; //logged at the tick rate, the governor runs on engine edges
+			break;
+
+		case 5:
+			prof->i_sp = i_sp_demo;
+			prof->tps_sp = tps_sp_demo;
+			ctrl->en_log = 0;
+			break;
+
+		default:
+			printf("load_profile -- no profile %d, holding zero\n", ctrl->num_profile);
+			prof->i_sp = sp_zero;
+			prof->tps_sp = sp_zero;
+			prof->len = 1;
+			break;
+	}
+}
+
+// start of a tick: end-of-test check, new set points, e-brake release
+void ctrl_setpoints ( control_t *ctrl, fault_t *faults, data_point *dp,
+	const profile_t *prof, ctrl_cmd_t *cmd )
+{
+	//check if test is done (profiles ended) or if test faulted
+	//end disabled for break-in for continuous operation
+	//idx follows the timer and can skip a tick after an overrun, hence >=
+	if ( ( ( ctrl->idx >= BSIZE ) | ( faults->trip ) ) & ( ctrl->num_profile != 4 ) ) {
+		ctrl->run = 0;
+	}
+	//a hardware limit ends every profile, break-in included: the engine is already off
+	if ( faults->alert_fault ) {
+		ctrl->run = 0;
+	}
+
+	//get new set points (in the form of 0-100% i.e. duty cycle)
+	//held at the last entry once the profile runs out (last tick of a test, break-in)
+	int t = ( ctrl->idx < prof->len ) ? ctrl->idx : prof->len - 1;
+	dp->i_sp = fetch_sp ( t, prof->i_sp );
+	dp->tps_sp = fetch_sp ( t, prof->tps_sp );
+
+	//e-brake release
+	cmd->ebrake_release = ( dp->tps_sp > LAUNCH_THRESHOLD );
+}
+
+// rest of the tick, once the sensors are in dp: conversions, derived channels,
+// actuator commands, faults
+void ctrl_update ( control_t *ctrl, fault_t *faults, data_point *dp, derived_t *dv,
+	ctrl_cmd_t *cmd )
+{
+	if ( ctrl->en_log )
+	{
+		derived_update ( dv, dp );
+
+		//relevant physical quantity conversion for faults
+		ctrl->i_brake_amps = ( counts_to_volts ( dp->i_brake ) * I_BRAKE_SCALE )  + I_BRAKE_OFFSET; //ADC counts to amps
+		ctrl->i_brake_duty = 100 * ( ctrl->i_brake_amps / I_BRAKE_MAX ); //convert brake current in amps to duty cycle from 0-100%
+		ctrl->brake_temp = ( counts_to_volts ( dp->temp3 ) * THERM_SCALE )  + THERM_OFFSET; //ADC counts to deg C
+		ctrl->belt_temp = ( counts_to_volts ( dp->belt_temp ) * BELT_TEMP_SCALE )  + BELT_TEMP_OFFSET; //ADC counts to deg C
+	}
+
+	//set brake current, throttle. open loop at the tick rate, brake_sync closes the current loop
+	//on the PWM period (nubaja_brake.h)
+	cmd->throttle = dp->tps_sp;
+	cmd->brake_duty = dp->i_sp;
+
+	//hardware limit already cut the outputs, keep them cut
+	if ( faults->alert_fault )
+	{
+		faults->trip = 1;
+		cmd->throttle = 0;
+		cmd->brake_duty = 0;
+	}
+
+	// check for faults
+	if ( ctrl->i_brake_amps > MAX_I_BRAKE )
+	{
+		faults->trip = 1;
+		faults->overcurrent_fault = 1;
+	}
+	if ( ( ctrl->belt_temp > MAX_BELT_TEMP ) | ( ctrl->brake_temp > MAX_BRAKE_TEMP ) )
+	{
+		faults->trip = 1;
+		faults->overtemp_fault = 1;
+	}
+
+	//belt slip: engine making power that doesn't reach the wheels
+	if ( ctrl->en_log && ( dv->eng_power >= SLIP_MIN_POWER * 100 ) &&
+		( dv->efficiency < SLIP_EFFICIENCY * 10 ) ) {
+		if ( ++ctrl->slip_ticks >= SLIP_TICKS ) {
+			faults->slip_fault = 1;
+			faults->trip |= SLIP_TRIP;
+		}
+	}
+	else {
+		ctrl->slip_ticks = 0;
+	}
+}
+
+#endif // NUBAJA_CTRL_H_
@@ -0,0 +1,105 @@
+#ifndef NUBAJA_CURVE_H_
+#define NUBAJA_CURVE_H_
+
+#include <stdio.h>
+#include <string.h>
+#include "nubaja_proj_vars.h"
+#include "nubaja_log_format.h"
+#include "nubaja_derived.h"
+
+/*
+** POWER CURVE - torque and power against rpm, built up while the pull runs. every logged tick
+adds the derived engine torque and power to the CURVE_BIN_RPM wide bin of prim_rpm, and the
+load cell torque and wheel power to the bin of sec_rpm: a count, two sums and two maxima per
+bin, all integer. at the end of the run curve_print writes it to the serial port and to
+data_N.crv as csv, one row per bin that saw a sample, so the curve is there before the log is
+pulled. plain C, no ESP-IDF calls: host/run_archive builds its curves with curve_update too.
+*/
+
+#define CURVE_BIN_RPM         50
+#define CURVE_RPM_MAX         4800           // above both rpm caps, samples past it are not counted
+#define CURVE_BINS            ( CURVE_RPM_MAX / CURVE_BIN_RPM )
+
+typedef struct
+{
+  uint32_t n;
+  int64_t torque_sum, power_sum;     // 0.01 ft-lb, 0.01 hp, as in derived_t
+  int32_t torque_max, power_max;
+} curve_bin_t;
+
+typedef struct
+{
+  curve_bin_t eng[CURVE_BINS];       // engine torque and power by prim_rpm
+  curve_bin_t wheel[CURVE_BINS];     // load cell torque and wheel power by sec_rpm
+} power_curve_t;
+
+void curve_reset ( power_curve_t *cv )
+{
+  memset( cv, 0, sizeof(*cv) );
+}
+
+static inline void curve_bin_add ( curve_bin_t *bin, int32_t torque, int32_t power )
+{
+  if ( ( bin->n == 0 ) | ( torque > bin->torque_max ) ) {
+    bin->torque_max = torque;
+  }
+  if ( ( bin->n == 0 ) | ( power > bin->power_max ) ) {
+    bin->power_max = power;
+  }
+  ++bin->n;
+  bin->torque_sum += torque;
+  bin->power_sum += power;
+}
+
+// one logged sample, after derived_update has filled dv from it
+void curve_update ( power_curve_t *cv, const data_point *dp, const derived_t *dv )
+{
+  uint32_t b;
+
+  b = dp->prim_rpm / CURVE_BIN_RPM;
+  if ( b < CURVE_BINS ) {
+    curve_bin_add( &cv->eng[b], dv->torque, dv->eng_power );
+  }
+  b = dp->sec_rpm / CURVE_BIN_RPM;
+  if ( b < CURVE_BINS ) {
+    curve_bin_add( &cv->wheel[b], dv->wheel_torque, dv->wheel_power );
+  }
+}
+
+static void curve_print_bins ( FILE *fp, const char *side, const curve_bin_t *bins )
+{
+  int b;
+
+  for ( b = 0; b < CURVE_BINS; b++ ) {
+    const curve_bin_t *bin = &bins[b];
+    if ( bin->n == 0 ) {
+      continue;
+    }
+    fprintf(fp, "%s,%d,%u,%.2f,%.2f,%.2f,%.2f\n", side, b * CURVE_BIN_RPM, (unsigned) bin->n,
+            bin->torque_sum / (float) bin->n / 100, bin->torque_max / 100.0f,
+            bin->power_sum / (float) bin->n / 100, bin->power_max / 100.0f);
+  }
+}
+
+// csv, rpm is the bottom of the bin. torque in ft-lb, power in hp
+void curve_print ( FILE *fp, const power_curve_t *cv )
+{
+  fprintf(fp, "side,rpm,n,torque_mean,torque_max,power_mean,power_max\n");
+  curve_print_bins( fp, "engine", cv->eng );
+  curve_print_bins( fp, "wheel", cv->wheel );
+}
+
+// write the curve next to the log, e.g. /sdcard/data_3.crv
+int curve_write ( const char *path, const power_curve_t *cv )
+{
+  FILE *fp = fopen( path, "w" );
+  if ( fp == NULL ) {
+    printf("curve_write -- failed to open %s\n", path);
+    return 0;
+  }
+  curve_print( fp, cv );
+  fclose( fp );
+  return 1;
+}
+
+#endif // NUBAJA_CURVE_H_
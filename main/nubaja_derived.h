@@ -0,0 +1,61 @@
+#ifndef NUBAJA_DERIVED_H_
+#define NUBAJA_DERIVED_H_
+
+#include <stdint.h>
+#include "nubaja_proj_vars.h"
+#include "nubaja_log_format.h"
+
+/*
+** DERIVED CHANNELS - engine power, wheel power, powertrain efficiency and CVT ratio, worked
+out every tick in integer arithmetic from the raw sample. the adc scale/offset constants are
+folded into Q16 multipliers at compile time, so a tick costs a few multiplies and divides.
+same formulas as dyno_data_treatment.m: power (hp) = torque (ft-lb) * rpm / 5252, the load
+cell reading standing in for wheel torque.
+*/
+
+#define DERIVED_Q				16
+#define DERIVED_MIN_RPM			100 	//CVT ratio is 0 below this secondary rpm
+
+//counts to 0.01 units of scale * volts + offset, Q16
+#define DERIVED_GAIN(scale)		( (int32_t) ( (scale) * ADC_FS / 4096 * 100 * 65536 + 0.5 ) )
+#define DERIVED_OFFS(offset)	( (int32_t) ( (offset) * 100 * 65536 ) )
+
+typedef struct
+{
+	int32_t torque; 		//engine torque, 0.01 ft-lb
+	int32_t wheel_torque; 	//load cell, 0.01 ft-lb
+	int32_t eng_power; 		//0.01 hp
+	int32_t wheel_power; 	//0.01 hp
+	int32_t efficiency; 	//wheel / engine power, 0.1 %. 0 below SLIP_MIN_POWER
+	int32_t cvt_ratio; 		//prim_rpm / sec_rpm, x1000. 0 below DERIVED_MIN_RPM
+} derived_t;
+
+static inline int32_t derived_scale ( uint16_t counts, int32_t gain, int32_t offs )
+{
+	return ( (int32_t) counts * gain + offs ) >> DERIVED_Q;
+}
+
+void derived_update ( derived_t *dv, const data_point *dp )
+{
+	dv->torque = derived_scale( dp->torque, DERIVED_GAIN(TORQUE_SCALE), DERIVED_OFFS(TORQUE_OFFSET) );
+	dv->wheel_torque = derived_scale( dp->load_cell, DERIVED_GAIN(LOAD_CELL_SCALE), DERIVED_OFFS(LOAD_CELL_OFFSET) );
+
+	dv->eng_power = dv->torque * (int32_t) dp->prim_rpm / 5252;
+	dv->wheel_power = dv->wheel_torque * (int32_t) dp->sec_rpm / 5252;
+
+	if ( dv->eng_power >= SLIP_MIN_POWER * 100 ) {
+		dv->efficiency = dv->wheel_power * 1000 / dv->eng_power;
+	}
+	else {
+		dv->efficiency = 0;
+	}
+
+	if ( dp->sec_rpm >= DERIVED_MIN_RPM ) {
+		dv->cvt_ratio = (int32_t) dp->prim_rpm * 1000 / dp->sec_rpm;
+	}
+	else {
+		dv->cvt_ratio = 0;
+	}
+}
+
+#endif // NUBAJA_DERIVED_H_
@@ -6,6 +6,8 @@ struct fault
 	int overcurrent_fault; 
 	int overtemp_fault; 
 	int overvolt_fault;
+	int slip_fault;
+	int alert_fault; 	//AD7998 ALERT pin, outputs were cut by adc_alert_isr
 	int trip;  
 };
 typedef struct fault fault_t;
@@ -15,6 +17,8 @@ void clear_faults ( fault_t *fault )
 	fault->overcurrent_fault = 0;
 	fault->overtemp_fault = 0;
 	fault->overvolt_fault = 0;
+	fault->slip_fault = 0;
+	fault->alert_fault = 0;
 	fault->trip = 0;
 }
 
@@ -30,10 +34,16 @@ void print_faults ( fault_t *fault )
 		if ( fault->overvolt_fault ) {
 			printf("Overvolt fault %d \n", fault->overvolt_fault );
 		}
+		if ( fault->alert_fault ) {
+			printf("ADC alert limit fault %d \n", fault->alert_fault );
+		}
 	}
 	else {
 		printf("No faults.\n");
 	}		
+	if ( fault->slip_fault ) {
+		printf("Belt slip %d \n", fault->slip_fault );
+	}
 }
 
 
@@ -0,0 +1,172 @@
+#ifndef NUBAJA_GOVERNOR_H_
+#define NUBAJA_GOVERNOR_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nubaja_proj_vars.h"
+#include "nubaja_gpio.h"
+#include "nubaja_pwm.h"
+#include "nubaja_pid.h"
+#include "nubaja_mem.h"
+#include "nubaja_trace.h"
+
+/*
+** BREAK-IN RPM GOVERNOR - profile 4 used to hold BREAK_IN_TPS open loop and only looked at
+the engine once a tick. with breakin_governor on, the primary rpm ISR hands every edge
+period straight to gov_task, which turns it into rpm without the rounding of the logged
+channel and runs a PID on it, once per engine revolution (30 Hz at BREAK_IN_RPM). the PID
+output trims BREAK_IN_TPS, and the result is slewed at no more than GOV_SLEW_PCT_S before it
+goes to set_throttle, so noise on one edge can't jerk the servo. the servo latches a new
+pulse width every 20 ms, so that is as often as the throttle can move.
+
+no edge for GOV_STALL_MS is a stall: the PID is reset and the throttle goes back to
+BREAK_IN_TPS until the engine is turning again. daq_task carries on at the tick rate, logging
+the governor's throttle as tps_sp, so an hour of break-in costs an hour of 1 Hz records. the
+gains are per edge, so they change with the edge rate; retune them there.
+*/
+
+#define GOV_SLEW_PCT_S        20             // throttle rate limit, % per second
+#define GOV_STALL_MS          200            // no edge for this long = stalled (below 300 rpm)
+#define GOV_BAND_RPM          50             // settled once within this of the set point
+
+typedef struct
+{
+  volatile int run;
+  float sp;                      // rpm
+  volatile float rpm;            // from the last edge
+  volatile float tps;            // last throttle command, %
+  uint32_t edges, rejected, stalls;
+  int settled;                   // came within GOV_BAND_RPM, the error stats start here
+  uint32_t n_err;
+  double sum_sq_err;
+  float max_err;
+  pid_ctrl_t pid;
+  TaskHandle_t task;
+} governor_t;
+
+governor_t governor;
+
+// one step of the rate limit from the last command towards target, dt_us since it was sent
+static float gov_slew ( float target, uint32_t dt_us )
+{
+  float step = GOV_SLEW_PCT_S * ( dt_us / 1e6f );
+
+  if ( target > governor.tps + step ) {
+    return governor.tps + step;
+  }
+  if ( target < governor.tps - step ) {
+    return governor.tps - step;
+  }
+  return target;
+}
+
+static void gov_task ( void *arg )
+{
+  uint32_t period_us, dt_us;
+  int64_t now, last_us = esp_timer_get_time();
+  float rpm, err, target;
+
+  while ( governor.run )
+  {
+    if ( xTaskNotifyWait( 0, 0, &period_us, GOV_STALL_MS / portTICK_PERIOD_MS ) == pdFALSE ) {
+      if ( governor.run ) {
+        ++governor.stalls;
+        reset_pid( &governor.pid );
+        governor.rpm = 0;
+        governor.settled = 0;
+        now = esp_timer_get_time();
+        governor.tps = gov_slew( BREAK_IN_TPS, (uint32_t) ( now - last_us ) );
+        set_throttle( governor.tps );
+        last_us = now;
+      }
+      continue;
+    }
+    if ( !governor.run ) {
+      break; //woken by governor_stop
+    }
+    trace_begin( TRACE_gov_update, 0 );
+
+    //same cut as the logged rpm: a glitch edge reads as an impossible speed
+    if ( ( period_us == 0 ) || ( 60e6f / period_us > MAX_PRIMARY_RPM ) ) {
+      ++governor.rejected;
+      trace_end( TRACE_gov_update, 0 );
+      continue;
+    }
+    rpm = 60e6f / period_us;
+    ++governor.edges;
+    governor.rpm = rpm;
+
+    pid_update( &governor.pid, governor.sp, rpm );
+    target = BREAK_IN_TPS + governor.pid.output;
+    if ( target < 0 ) {
+      target = 0;
+    }
+
+    now = esp_timer_get_time();
+    dt_us = (uint32_t) ( now - last_us );
+    last_us = now;
+    governor.tps = gov_slew( target, dt_us );
+    set_throttle( governor.tps );
+
+    err = fabsf( governor.sp - rpm );
+    if ( err < GOV_BAND_RPM ) {
+      governor.settled = 1;
+    }
+    if ( governor.settled ) {
+      ++governor.n_err;
+      governor.sum_sq_err += (double) err * err;
+      if ( err > governor.max_err ) {
+        governor.max_err = err;
+      }
+    }
+    trace_end( TRACE_gov_update, (uint16_t) rpm );
+  }
+
+  set_throttle( 0 );
+  mem_note_stack( MEM_TASK_GOV );
+  governor.task = NULL;
+  vTaskDelete(NULL);
+}
+
+// start of a break-in run, after configure_gpio. the governor owns the throttle until governor_stop
+void governor_start ( float sp )
+{
+  // the last run's task is woken by governor_stop and gone within a tick
+  while ( governor.task != NULL ) {
+    vTaskDelay( 10 / portTICK_PERIOD_MS );
+  }
+  memset( &governor, 0, sizeof(governor) );
+  governor.sp = sp;
+  governor.tps = BREAK_IN_TPS;
+  governor.run = 1;
+  init_pid( &governor.pid, GOV_KP, GOV_KI, GOV_KD, GOV_WINDUP_GUARD, GOV_OUTPUT_MAX );
+  set_throttle( governor.tps );
+
+  xTaskCreatePinnedToCore( gov_task, "governor", 2048, NULL, configMAX_PRIORITIES-2, &governor.task, 1 );
+  primary_edge_task = governor.task;
+  printf("governor_start -- holding %.0f rpm, throttle from %.0f%%, slewed at %d%%/s\n",
+         sp, (float) BREAK_IN_TPS, GOV_SLEW_PCT_S);
+}
+
+// end of run or abort, from daq_task: the throttle is cut here, without waiting for the task.
+// it is woken so it exits now rather than at the stall timeout, zeroing the throttle again
+// behind any update it was in the middle of
+void governor_stop ()
+{
+  if ( !governor.run ) {
+    return;
+  }
+  governor.run = 0;
+  xTaskNotify( governor.task, 0, eSetValueWithOverwrite );
+  primary_edge_task = NULL;
+  set_throttle( 0 );
+  printf("governor -- %u edges, %u rejected, %u stalls, rms error %.1f rpm, worst %.0f rpm once settled\n",
+         (unsigned) governor.edges, (unsigned) governor.rejected, (unsigned) governor.stalls,
+         governor.n_err ? sqrt( governor.sum_sq_err / governor.n_err ) : 0.0, governor.max_err);
+}
+
+#endif // NUBAJA_GOVERNOR_H_
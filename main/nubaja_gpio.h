@@ -4,6 +4,7 @@
 #include "freertos/queue.h"
 #include "freertos/event_groups.h"
 #include "driver/gpio.h"
+#include "nubaja_trace.h"
 
 #define PRIMARY_GPIO          26             // engine rpm measurement
 #define SECONDARY_GPIO        27             // CVT secondary rpm measurement
@@ -25,6 +26,7 @@ xQueueHandle secondary_rpm_queue;                    // queue for wheel speed va
 
 double last_prim_rpm_time = 0;
 double last_sec_rpm_time = 0;
+TaskHandle_t primary_edge_task = NULL; // notified with every engine rpm edge period in us (nubaja_governor.h)
 
 void flasher_on()
 {
@@ -58,6 +60,7 @@ void engine_on()
 
 static void secondary_isr_handler(void *arg)
 {
+  trace_begin( TRACE_rpm_isr, SECONDARY_GPIO );
   double time;
   timer_get_counter_time_sec(RPM_TIMER_GROUP, RPM_TIMER_IDX, &time);
   uint16_t rpm = 60.0 / (time - last_sec_rpm_time);
@@ -68,20 +71,34 @@ static void secondary_isr_handler(void *arg)
   }
 
   last_sec_rpm_time = time;
+  trace_end( TRACE_rpm_isr, SECONDARY_GPIO );
 }
 
 static void primary_isr_handler(void *arg)
 {
+  trace_begin( TRACE_rpm_isr, PRIMARY_GPIO );
   double time;
   timer_get_counter_time_sec(RPM_TIMER_GROUP, RPM_TIMER_IDX, &time);
   uint16_t rpm = 60.0 / (time - last_prim_rpm_time);
+  BaseType_t woken = pdFALSE;
   
   if (rpm <= MAX_PRIMARY_RPM)
   {
     xQueueOverwriteFromISR(primary_rpm_queue, &rpm, NULL);
   }
 
+  // the raw period, unrounded, for the governor
+  if (primary_edge_task != NULL)
+  {
+    xTaskNotifyFromISR(primary_edge_task, (uint32_t) ((time - last_prim_rpm_time) * 1e6), eSetValueWithOverwrite, &woken);
+  }
+
   last_prim_rpm_time = time;
+  trace_end( TRACE_rpm_isr, PRIMARY_GPIO );
+  if (woken == pdTRUE)
+  {
+    portYIELD_FROM_ISR();
+  }
 }
 
 static void speed_timer_init()
@@ -2,10 +2,16 @@
 #define NUBAJA_I2C_H_
 
 #include "driver/i2c.h"
+#include "esp_timer.h"
+#include "nubaja_trace.h"
 
 #define I2C_MASTER_0_SDA_IO         23                // gpio number for I2C master data
 #define I2C_MASTER_0_SCL_IO         22                // gpio number for I2C master clock
+#define I2C_MASTER_1_SDA_IO         21                // bus 1 data ***NOT ON PCB YET - FLY WIRE***
+#define I2C_MASTER_1_SCL_IO         4                 // bus 1 clock ***NOT ON PCB YET - FLY WIRE***
 #define PORT_0                      I2C_NUM_0         // I2C port number for master dev
+#define PORT_1                      I2C_NUM_1         // second I2C controller, IMU and display
+#define PORT_NONE                   -1                // device not fitted
 #define I2C_MASTER_TX_BUF_DISABLE   0                 // I2C master do not need buffer
 #define I2C_MASTER_RX_BUF_DISABLE   0                 // I2C master do not need buffer
 #define NORMAL_MODE                 100000            // I2C master clock frequency
@@ -19,12 +25,29 @@
 #define NACK                        0x1               // I2C nack value
 #define DATA_LENGTH                 1                 // bytes
 #define I2C_TASK_LENGTH             1                 // ms
+#define I2C_BURST_MAX               8                 // max 2 byte values in one i2c_read_2_bytes_n
 
 // return values
 #define I2C_SUCCESS                 0
 #define I2C_WRITE_FAILED            1
 #define I2C_READ_FAILED             2
 
+/*
+** BUS UTILISATION - every transaction goes through i2c_cmd_begin_timed, which adds the time
+spent in i2c_master_cmd_begin to the port's busy time. that includes waiting on the driver's
+bus lock, so two tasks sharing a port show up as extra load rather than being hidden.
+i2c_stats_reset at the start of a run, i2c_stats_print at the end.
+*/
+typedef struct
+{
+  int64_t busy_us;
+  uint32_t transactions;
+  uint32_t errors;
+} i2c_bus_stats_t;
+
+i2c_bus_stats_t i2c_stats[I2C_NUM_MAX];
+int64_t i2c_stats_start_us = 0;
+portMUX_TYPE i2c_stats_mux = portMUX_INITIALIZER_UNLOCKED;
 
 
 // configure one I2C module for operation as an I2C master with internal pullups disabled
@@ -43,6 +66,51 @@ void i2c_master_config(int port_num, int clk, int sda, int scl)
   printf("i2c_master_config -- configuring success\n");
 }
 
+// run a queued command link on a port and account for it in i2c_stats
+esp_err_t i2c_cmd_begin_timed(int port_num, i2c_cmd_handle_t cmd)
+{
+  trace_begin(TRACE_i2c, port_num);
+  int64_t t0 = esp_timer_get_time();
+  esp_err_t ret = i2c_master_cmd_begin(port_num, cmd, I2C_TASK_LENGTH / portTICK_RATE_MS);
+  int64_t dt = esp_timer_get_time() - t0;
+  trace_end(TRACE_i2c, port_num);
+
+  portENTER_CRITICAL(&i2c_stats_mux);
+  i2c_stats[port_num].busy_us += dt;
+  ++i2c_stats[port_num].transactions;
+  if (ret != ESP_OK)
+    ++i2c_stats[port_num].errors;
+  portEXIT_CRITICAL(&i2c_stats_mux);
+
+  return ret;
+}
+
+void i2c_stats_reset()
+{
+  portENTER_CRITICAL(&i2c_stats_mux);
+  memset(i2c_stats, 0, sizeof(i2c_stats));
+  i2c_stats_start_us = esp_timer_get_time();
+  portEXIT_CRITICAL(&i2c_stats_mux);
+}
+
+// busy time as a percentage of the time since i2c_stats_reset, one line per port used
+void i2c_stats_print()
+{
+  int port;
+  int64_t elapsed = esp_timer_get_time() - i2c_stats_start_us;
+
+  for (port = 0; port < I2C_NUM_MAX; port++)
+  {
+    if (i2c_stats[port].transactions == 0)
+      continue;
+    printf("i2c_stats -- port %d: %.1f%% busy, %u transactions (%.0f us avg), %u errors\n",
+           port, elapsed > 0 ? 100.0 * i2c_stats[port].busy_us / elapsed : 0.0,
+           i2c_stats[port].transactions,
+           (double) i2c_stats[port].busy_us / i2c_stats[port].transactions,
+           i2c_stats[port].errors);
+  }
+}
+
 // write a single byte of data to a register using I2C protocol
 int i2c_write_byte(int port_num, uint8_t slave_address, uint8_t reg, uint8_t data)
 {
@@ -53,7 +121,7 @@ int i2c_write_byte(int port_num, uint8_t slave_address, uint8_t reg, uint8_t dat
   i2c_master_write_byte(cmd, reg, ACK);
   i2c_master_write_byte(cmd, data, ACK);
   i2c_master_stop(cmd);
-  ret = i2c_master_cmd_begin(port_num, cmd, I2C_TASK_LENGTH / portTICK_RATE_MS);
+  ret = i2c_cmd_begin_timed(port_num, cmd);
   i2c_cmd_link_delete(cmd);
 
   if (ret != ESP_OK)
@@ -77,7 +145,7 @@ int i2c_write_2_byte(int port_num, uint8_t slave_address, uint8_t reg, uint8_t d
   i2c_master_write_byte(cmd, data_h, ACK);
   i2c_master_write_byte(cmd, data_l, NACK);
   i2c_master_stop(cmd);
-  ret = i2c_master_cmd_begin(port_num, cmd, I2C_TASK_LENGTH / portTICK_RATE_MS);
+  ret = i2c_cmd_begin_timed(port_num, cmd);
   i2c_cmd_link_delete(cmd);
 
   if (ret != ESP_OK)
@@ -105,7 +173,7 @@ int i2c_write_4_bytes(int port_num, uint8_t slave_address, uint8_t reg,
   i2c_master_write_byte(cmd, data_2, ACK);
   i2c_master_write_byte(cmd, data_3, NACK);
   i2c_master_stop(cmd);
-  ret = i2c_master_cmd_begin(port_num, cmd, I2C_TASK_LENGTH / portTICK_RATE_MS);
+  ret = i2c_cmd_begin_timed(port_num, cmd);
   i2c_cmd_link_delete(cmd);
 
   if (ret != ESP_OK)
@@ -131,7 +199,7 @@ int i2c_read_byte(int port_num, uint8_t slave_address, int reg, uint8_t *data)
   i2c_master_write_byte(cmd, ( slave_address << 1 ) | READ_BIT, ACK_CHECK_EN);
   i2c_master_read_byte(cmd, data, NACK);
   i2c_master_stop(cmd);
-  ret = i2c_master_cmd_begin(port_num, cmd, I2C_TASK_LENGTH / portTICK_RATE_MS);
+  ret = i2c_cmd_begin_timed(port_num, cmd);
   i2c_cmd_link_delete(cmd);
 
   if (ret != ESP_OK)
@@ -159,7 +227,7 @@ int i2c_read_2_bytes(int port_num, uint8_t slave_address, int reg, uint16_t *dat
   i2c_master_read_byte(cmd, &data_h, ACK);
   i2c_master_read_byte(cmd, &data_l, NACK);
   i2c_master_stop(cmd);
-  ret = i2c_master_cmd_begin(port_num, cmd, I2C_TASK_LENGTH / portTICK_RATE_MS);
+  ret = i2c_cmd_begin_timed(port_num, cmd);
   i2c_cmd_link_delete(cmd);
 
   *data = (data_h << 8 | data_l);
@@ -201,7 +269,7 @@ int i2c_read_2_bytes_4(int port_num, uint8_t slave_address, int reg,
   i2c_master_read_byte(cmd, &data_3_l, NACK);
 
   i2c_master_stop(cmd);
-  ret = i2c_master_cmd_begin(port_num, cmd, I2C_TASK_LENGTH / portTICK_RATE_MS);
+  ret = i2c_cmd_begin_timed(port_num, cmd);
   i2c_cmd_link_delete(cmd);
 
   *data_0 = (data_0_h << 8 | data_0_l);
@@ -259,7 +327,7 @@ int i2c_read_2_bytes_8(int port_num, uint8_t slave_address, int reg,
   i2c_master_read_byte(cmd, &data_7_l, NACK);  
 
   i2c_master_stop(cmd);
-  ret = i2c_master_cmd_begin(port_num, cmd, I2C_TASK_LENGTH / portTICK_RATE_MS);
+  ret = i2c_cmd_begin_timed(port_num, cmd);
   i2c_cmd_link_delete(cmd);
 
   *data_0 = (data_0_h << 8 | data_0_l);
@@ -280,6 +348,46 @@ int i2c_read_2_bytes_8(int port_num, uint8_t slave_address, int reg,
     return I2C_SUCCESS;
 }
 
+// read n consecutive pairs of 2 bytes from an I2C device in one burst, n <= I2C_BURST_MAX
+int i2c_read_2_bytes_n(int port_num, uint8_t slave_address, int reg, uint16_t *data, int n)
+{
+  int ret, i;
+  uint8_t buf[2 * I2C_BURST_MAX];
+
+  if ( ( n < 1 ) || ( n > I2C_BURST_MAX ) )
+    return I2C_READ_FAILED;
+
+  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+  i2c_master_start(cmd);
+  i2c_master_write_byte(cmd, ( slave_address << 1 ) | WRITE_BIT, ACK_CHECK_EN);
+  i2c_master_write_byte(cmd, reg, ACK);
+  i2c_master_start(cmd);
+  i2c_master_write_byte(cmd, ( slave_address << 1 ) | READ_BIT, ACK_CHECK_EN);
+
+  for (i = 0; i < 2 * n - 1; i++)
+  {
+    i2c_master_read_byte(cmd, &buf[i], ACK);
+  }
+  i2c_master_read_byte(cmd, &buf[2 * n - 1], NACK);
+
+  i2c_master_stop(cmd);
+  ret = i2c_cmd_begin_timed(port_num, cmd);
+  i2c_cmd_link_delete(cmd);
+
+  for (i = 0; i < n; i++)
+  {
+    data[i] = (buf[2 * i] << 8 | buf[2 * i + 1]);
+  }
+
+  if (ret != ESP_OK) {
+    printf("i2c_read_2_bytes_n -- failure on port: %d, slave: %d, reg: %d\n",
+           port_num, slave_address, reg);
+    return I2C_READ_FAILED;
+  }
+  else
+    return I2C_SUCCESS;
+}
+
 // // read three consecutive groups of 2 bytes from the register of an I2C device with a low/high register order
 // int i2c_read_2_bytes_3_lh(int port_num, uint8_t slave_address, int reg,
 //                        uint16_t *data_0, uint16_t *data_1, uint16_t *data_2)
@@ -320,59 +428,58 @@ int i2c_read_2_bytes_8(int port_num, uint8_t slave_address, int reg,
 //     return I2C_SUCCESS;
 // }
 
-// // read 6 consecutive groups of 2 bytes from the register of an I2C device with a low/high register order
-// int i2c_read_2_bytes_6_lh(int port_num, uint8_t slave_address, int reg,
-//                        uint16_t *data_0, uint16_t *data_1, uint16_t *data_2,
-//                        uint16_t *data_3, uint16_t *data_4, uint16_t *data_5)
-// {
-//   int ret;
-//   uint8_t data_0_h, data_0_l, data_1_h, data_1_l, data_2_h, data_2_l,
-//           data_3_h, data_3_l, data_4_h, data_4_l, data_5_h, data_5_l;
-
-//   i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-//   i2c_master_start(cmd);
-//   i2c_master_write_byte(cmd, ( slave_address << 1 ) | WRITE_BIT, ACK_CHECK_EN);
-//   i2c_master_write_byte(cmd, reg, ACK);
-//   i2c_master_start(cmd);
-//   i2c_master_write_byte(cmd, ( slave_address << 1 ) | READ_BIT, ACK_CHECK_EN);
+// read 6 consecutive groups of 2 bytes from the register of an I2C device with a low/high register order
+int i2c_read_2_bytes_6_lh(int port_num, uint8_t slave_address, int reg,
+                       uint16_t *data_0, uint16_t *data_1, uint16_t *data_2,
+                       uint16_t *data_3, uint16_t *data_4, uint16_t *data_5)
+{
+  int ret;
+  uint8_t data_0_h, data_0_l, data_1_h, data_1_l, data_2_h, data_2_l,
+          data_3_h, data_3_l, data_4_h, data_4_l, data_5_h, data_5_l;
 
-//   i2c_master_read_byte(cmd, &data_0_l, ACK);
-//   i2c_master_read_byte(cmd, &data_0_h, ACK);
+  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+  i2c_master_start(cmd);
+  i2c_master_write_byte(cmd, ( slave_address << 1 ) | WRITE_BIT, ACK_CHECK_EN);
+  i2c_master_write_byte(cmd, reg, ACK);
+  i2c_master_start(cmd);
+  i2c_master_write_byte(cmd, ( slave_address << 1 ) | READ_BIT, ACK_CHECK_EN);
 
-//   i2c_master_read_byte(cmd, &data_1_l, ACK);
-//   i2c_master_read_byte(cmd, &data_1_h, ACK);
+  i2c_master_read_byte(cmd, &data_0_l, ACK);
+  i2c_master_read_byte(cmd, &data_0_h, ACK);
 
-//   i2c_master_read_byte(cmd, &data_2_l, ACK);
-//   i2c_master_read_byte(cmd, &data_2_h, ACK);
+  i2c_master_read_byte(cmd, &data_1_l, ACK);
+  i2c_master_read_byte(cmd, &data_1_h, ACK);
 
-//   i2c_master_read_byte(cmd, &data_3_l, ACK);
-//   i2c_master_read_byte(cmd, &data_3_h, ACK);
+  i2c_master_read_byte(cmd, &data_2_l, ACK);
+  i2c_master_read_byte(cmd, &data_2_h, ACK);
 
-//   i2c_master_read_byte(cmd, &data_4_l, ACK);
-//   i2c_master_read_byte(cmd, &data_4_h, ACK);
+  i2c_master_read_byte(cmd, &data_3_l, ACK);
+  i2c_master_read_byte(cmd, &data_3_h, ACK);
 
-//   i2c_master_read_byte(cmd, &data_5_l, ACK);
-//   i2c_master_read_byte(cmd, &data_5_h, NACK);
+  i2c_master_read_byte(cmd, &data_4_l, ACK);
+  i2c_master_read_byte(cmd, &data_4_h, ACK);
 
+  i2c_master_read_byte(cmd, &data_5_l, ACK);
+  i2c_master_read_byte(cmd, &data_5_h, NACK);
 
-//   i2c_master_stop(cmd);
-//   ret = i2c_master_cmd_begin(port_num, cmd, I2C_TASK_LENGTH / portTICK_RATE_MS);
-//   i2c_cmd_link_delete(cmd);
+  i2c_master_stop(cmd);
+  ret = i2c_cmd_begin_timed(port_num, cmd);
+  i2c_cmd_link_delete(cmd);
 
-//   *data_0 = (data_0_h << 8 | data_0_l);
-//   *data_1 = (data_1_h << 8 | data_1_l);
-//   *data_2 = (data_2_h << 8 | data_2_l);
-//   *data_3 = (data_3_h << 8 | data_3_l);
-//   *data_4 = (data_4_h << 8 | data_4_l);
-//   *data_5 = (data_5_h << 8 | data_5_l);
+  *data_0 = (data_0_h << 8 | data_0_l);
+  *data_1 = (data_1_h << 8 | data_1_l);
+  *data_2 = (data_2_h << 8 | data_2_l);
+  *data_3 = (data_3_h << 8 | data_3_l);
+  *data_4 = (data_4_h << 8 | data_4_l);
+  *data_5 = (data_5_h << 8 | data_5_l);
 
-//   if (ret != ESP_OK) {
-//     printf("i2c_read_2_bytes_6_lh -- failure on port: %d, slave: %d, reg: %d\n",
-//            port_num, slave_address, reg);
-//     return I2C_READ_FAILED;
-//   }
-//   else
-//     return I2C_SUCCESS;
-// }
+  if (ret != ESP_OK) {
+    printf("i2c_read_2_bytes_6_lh -- failure on port: %d, slave: %d, reg: %d\n",
+           port_num, slave_address, reg);
+    return I2C_READ_FAILED;
+  }
+  else
+    return I2C_SUCCESS;
+}
 
 #endif  // NUBAJA_I2C_H_
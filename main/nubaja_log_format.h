@@ -0,0 +1,609 @@
+#ifndef NUBAJA_LOG_FORMAT_H_
+#define NUBAJA_LOG_FORMAT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+
+/*
+** BINARY LOG LAYOUT - SHARED BY THE FIRMWARE WRITER AND THE HOST READERS
+file header | block 0 | block 1 | ... | block n-1 | index | footer
+
+every block is LOG_BLOCK_SIZE bytes: a block header holding the first sample index,
+the first sample timestamp and per-channel min/max/mean, followed by LOG_BLOCK_SAMPLES
+raw records. a short block is zero padded, so block k always starts at
+sizeof(log_file_header) + k * LOG_BLOCK_SIZE and a reader can seek straight to it.
+the index (one entry per block) and footer are appended when the run is closed; the
+footer is the last LOG_FOOTER_SIZE bytes of the file. all fields are little endian.
+
+each block carries a sequence number (its position in the file) and a crc32 over the
+whole block, so a run that was never closed can be salvaged by walking the blocks once
+and keeping everything up to the first torn one - a torn write costs at most one block.
+since version 3 a record position may also hold two packed fast samples or a logging rate
+change (RECORD SLOTS below); version 2 logs are the same with full records only.
+
+adc_convst_us in the file header is non-zero when the AD7998 was paced by CONVST pulses
+(main/nubaja_convst.h): the nth channel set in adc_channels, lowest first, was sampled
+n * adc_convst_us after the record's time_us. in command mode the channels are converted
+one after another during the I2C read, at offsets the log can't know.
+*/
+
+#define LOG_MAGIC             0x474c424e  // "NBLG"
+#define LOG_BLOCK_MAGIC       0x4b4c424e  // "NBLK"
+#define LOG_INDEX_MAGIC       0x58444e49  // "INDX"
+#define LOG_VERSION           3
+#define LOG_VERSION_MIN       2           // oldest version the readers still take
+#define LOG_BLOCK_SAMPLES     250         // records per block, divides LOGGING_QUEUE_SIZE
+
+/*
+** RECORD SCHEMA - every field of data_point in file order, X( type, name, kind, text format,
+info ). kind is META (sample index / time), CH (raw rpm or adc counts, uint16, summarised per
+block) or SP (set points). the struct, the channel tables, the record encoder / decoder and
+the text and csv formatters below all expand from this one list, so adding a field is one
+line here plus a LOG_VERSION bump. adc channels are in AD7998 channel order (1-8).
+
+info is () for META and SP fields. a CH field carries ( AD7998 channel 1-8 or 0, histogram
+top end, 1 = counts to volts first, scale, offset, unit ): where the firmware reads it from
+and how the run summary bins it and turns it into physical units (scale * x + offset, as in
+ctrl_update). the scales come from nubaja_proj_vars.h and are only expanded by the firmware.
+*/
+#define LOG_FIELDS(X) \
+  X( uint32_t, idx,       META, "%" PRIu32, () )    /* sample index */ \
+  X( uint32_t, time_us,   META, "%" PRIu32, () )    /* esp_timer time, wraps after ~71 min */ \
+  X( uint16_t, prim_rpm,  CH,   "%" PRIu16, ( 0, LOG_RPM_MAX, 0, 1, 0, "rpm" ) ) \
+  X( uint16_t, sec_rpm,   CH,   "%" PRIu16, ( 0, LOG_RPM_MAX, 0, 1, 0, "rpm" ) ) \
+  X( uint16_t, torque,    CH,   "%" PRIu16, ( 1, LOG_ADC_MAX, 1, TORQUE_SCALE, TORQUE_OFFSET, "" ) ) \
+  X( uint16_t, temp3,     CH,   "%" PRIu16, ( 2, LOG_ADC_MAX, 1, THERM_SCALE, THERM_OFFSET, "C" ) ) \
+  X( uint16_t, belt_temp, CH,   "%" PRIu16, ( 3, LOG_ADC_MAX, 1, BELT_TEMP_SCALE, BELT_TEMP_OFFSET, "C" ) ) \
+  X( uint16_t, temp2,     CH,   "%" PRIu16, ( 4, LOG_ADC_MAX, 1, THERM_SCALE, THERM_OFFSET, "C" ) ) \
+  X( uint16_t, i_brake,   CH,   "%" PRIu16, ( 5, LOG_ADC_MAX, 1, I_BRAKE_SCALE, I_BRAKE_OFFSET, "A" ) ) \
+  X( uint16_t, temp1,     CH,   "%" PRIu16, ( 6, LOG_ADC_MAX, 1, THERM_SCALE, THERM_OFFSET, "C" ) ) \
+  X( uint16_t, load_cell, CH,   "%" PRIu16, ( 7, LOG_ADC_MAX, 1, LOAD_CELL_SCALE, LOAD_CELL_OFFSET, "" ) ) \
+  X( uint16_t, tps,       CH,   "%" PRIu16, ( 8, LOG_ADC_MAX, 1, 1, 0, "V" ) ) \
+  X( float,    i_sp,      SP,   "%.2f",     () ) \
+  X( float,    tps_sp,    SP,   "%.2f",     () )
+
+#define LOG_RPM_MAX           4800        // histogram top end for the rpms, above both rpm caps
+#define LOG_ADC_MAX           4096        // adc full scale
+
+// the parts of a CH field's channel info, e.g. LOG_INFO_ADC info
+#define LOG_INFO_ADC(adc, hist_max, volts, scale, offset, unit)       adc
+#define LOG_INFO_HIST_MAX(adc, hist_max, volts, scale, offset, unit)  hist_max
+#define LOG_INFO_PHYS(adc, hist_max, volts, scale, offset, unit)      { volts, scale, offset, unit }
+
+// expand only for fields of one kind
+#define LOG_IF_META(...)
+#define LOG_IF_CH(...)        __VA_ARGS__
+#define LOG_IF_SP(...)
+
+// one sample, written to the card as-is
+#define LOG_FIELD_DECL(type, name, kind, fmt, info)       type name;
+typedef struct
+{
+  LOG_FIELDS(LOG_FIELD_DECL)
+} data_point;
+
+// LOG_CH_prim_rpm .. LOG_CH_tps, then LOG_NUM_CH
+#define LOG_FIELD_CH_ID(type, name, kind, fmt, info)      LOG_IF_##kind( LOG_CH_##name, )
+enum
+{
+  LOG_FIELDS(LOG_FIELD_CH_ID)
+  LOG_NUM_CH                          // raw rpm / adc channels summarised per block
+};
+
+// the record on the card is the fields back to back. data_point must not pick up padding,
+// then the struct in memory already is the encoded record and the logging queue can be
+// drained straight into a block
+#define LOG_FIELD_SIZE(type, name, kind, fmt, info)       + sizeof(type)
+#define LOG_RECORD_SIZE       ( 0 LOG_FIELDS(LOG_FIELD_SIZE) )
+_Static_assert( sizeof(data_point) == LOG_RECORD_SIZE, "data_point is padded, reorder LOG_FIELDS" );
+
+#define LOG_FIELD_CH_CHECK(type, name, kind, fmt, info) \
+  LOG_IF_##kind( _Static_assert( sizeof(type) == sizeof(uint16_t), #name " is a CH field, must be uint16_t" ); \
+                 _Static_assert( ( LOG_INFO_HIST_MAX info ) > 0, #name " needs a histogram top end" ); \
+                 _Static_assert( ( LOG_INFO_ADC info ) <= 8, #name " is not an AD7998 channel" ); )
+LOG_FIELDS(LOG_FIELD_CH_CHECK)
+
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t header_size;
+  uint16_t record_size;
+  uint16_t block_samples;
+  uint32_t block_size;
+  uint32_t sample_hz;
+  uint16_t num_ch;
+  uint8_t adc_channels;   // AD7998 channels converted, bit k = channel k+1. 0 in older logs
+  uint8_t adc_convst_us;  // CONVST pulse spacing, 0 = converted in command mode (see below)
+} log_file_header;
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t seq;           // block sequence number, equal to the block's position in the file
+  uint32_t crc;           // crc32 of the whole block, computed with this field zeroed
+  uint32_t first_idx;
+  uint32_t first_time_us;
+  uint16_t n_samples;
+  uint16_t reserved;
+  uint16_t min[LOG_NUM_CH];
+  uint16_t max[LOG_NUM_CH];
+  uint16_t mean[LOG_NUM_CH];
+} log_block_header;
+
+typedef struct
+{
+  uint32_t first_idx;
+  uint32_t first_time_us;
+  uint32_t offset;  // byte offset of the block from the start of the file
+} log_index_entry;
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t n_blocks;
+  uint32_t index_offset;
+} log_footer;
+
+#define LOG_BLOCK_SIZE        ( sizeof(log_block_header) + LOG_BLOCK_SAMPLES * sizeof(data_point) )
+#define LOG_FOOTER_SIZE       sizeof(log_footer)
+
+// summarised channels, in the order they appear in the block header arrays
+#define LOG_FIELD_CH_OFFSET(type, name, kind, fmt, info)  LOG_IF_##kind( offsetof(data_point, name), )
+#define LOG_FIELD_CH_NAME(type, name, kind, fmt, info)    LOG_IF_##kind( #name, )
+static const uint16_t log_ch_offset[LOG_NUM_CH] = { LOG_FIELDS(LOG_FIELD_CH_OFFSET) };
+static const char * const log_ch_name[LOG_NUM_CH] = { LOG_FIELDS(LOG_FIELD_CH_NAME) };
+
+static inline uint16_t log_ch_value ( const data_point *dp, int ch )
+{
+  return *(const uint16_t *) ( (const uint8_t *) dp + log_ch_offset[ch] );
+}
+
+static inline void log_ch_set ( data_point *dp, int ch, uint16_t v )
+{
+  *(uint16_t *) ( (uint8_t *) dp + log_ch_offset[ch] ) = v;
+}
+
+// AD7998 channel (1-8) each log channel is read from, 0 for the rpms
+#define LOG_FIELD_CH_ADC(type, name, kind, fmt, info)     LOG_IF_##kind( LOG_INFO_ADC info, )
+static const uint8_t log_ch_adc[LOG_NUM_CH] = { LOG_FIELDS(LOG_FIELD_CH_ADC) };
+
+// record <-> LOG_RECORD_SIZE bytes, one fixed size copy per field. both ends are little endian
+#define LOG_FIELD_ENCODE(type, name, kind, fmt, info) \
+  memcpy( buf + offsetof(data_point, name), &dp->name, sizeof(type) );
+#define LOG_FIELD_DECODE(type, name, kind, fmt, info) \
+  memcpy( &dp->name, buf + offsetof(data_point, name), sizeof(type) );
+
+static inline void log_record_encode ( uint8_t *buf, const data_point *dp )
+{
+  LOG_FIELDS(LOG_FIELD_ENCODE)
+}
+
+static inline void log_record_decode ( data_point *dp, const uint8_t *buf )
+{
+  LOG_FIELDS(LOG_FIELD_DECODE)
+}
+
+/*
+** RECORD SLOTS - each of a block's LOG_BLOCK_SAMPLES records is a slot of LOG_RECORD_SIZE
+bytes, and the top bits of the idx at its start say what it holds:
+  LOG_SLOT_FULL   a record as above
+  LOG_SLOT_PAIR   two fast samples: idx, time_us and the LOG_FAST_FIELDS channels of each,
+                  back to back, the rest of the slot zero
+  LOG_SLOT_QOS    a log_qos_marker, the logging rate changed from the sample idx on
+while the SD card falls behind, daq_task keeps only every decim-th sample whole and packs the
+fast channels of the samples between two to a slot (nubaja_log_qos.h). the slow channels
+(temps, tps, set points) then come at 1 / decim of the rate while the fast ones keep every
+sample. a reader gives a packed sample the slow channels of the last full record before it.
+*/
+
+#define LOG_SLOT_MASK         0xc0000000
+#define LOG_SLOT_FULL         0x00000000
+#define LOG_SLOT_PAIR         0x80000000
+#define LOG_SLOT_QOS          0x40000000
+
+// channels kept at full rate, in packing order
+#define LOG_FAST_FIELDS(X) \
+  X( prim_rpm ) \
+  X( sec_rpm ) \
+  X( torque ) \
+  X( i_brake ) \
+  X( load_cell )
+
+#define LOG_FAST_FIELD_SIZE(name)     + sizeof( ((data_point *) 0)->name )
+#define LOG_FAST_FIELD_BIT(name)      | ( 1u << LOG_CH_##name )
+#define LOG_FAST_SIZE         ( 2 * sizeof(uint32_t) LOG_FAST_FIELDS(LOG_FAST_FIELD_SIZE) )
+#define LOG_FAST_CH_MASK      ( 0 LOG_FAST_FIELDS(LOG_FAST_FIELD_BIT) )
+_Static_assert( offsetof(data_point, idx) == 0, "the slot tag is the top of idx, idx goes first" );
+_Static_assert( 2 * LOG_FAST_SIZE <= LOG_RECORD_SIZE, "two fast samples must fit in a record" );
+
+typedef struct
+{
+  uint32_t idx;           // LOG_SLOT_QOS | first sample at the new rate
+  uint32_t time_us;
+  uint16_t level;         // 0 = every channel at full rate
+  uint16_t decim;         // slow channels kept on 1 sample in decim
+  uint16_t fill_pct;      // logging buffers in use when it changed
+  uint16_t reserved;
+} log_qos_marker;
+
+_Static_assert( sizeof(log_qos_marker) <= LOG_RECORD_SIZE, "log_qos_marker must fit in a record" );
+
+static inline uint32_t log_slot_kind ( const data_point *slot )
+{
+  return slot->idx & LOG_SLOT_MASK;
+}
+
+#define LOG_FAST_ENCODE(name) \
+  memcpy( buf, &dp->name, sizeof(dp->name) ); buf += sizeof(dp->name);
+#define LOG_FAST_DECODE(name) \
+  memcpy( &dp->name, buf, sizeof(dp->name) ); buf += sizeof(dp->name);
+
+static inline uint8_t *log_fast_encode ( uint8_t *buf, const data_point *dp )
+{
+  memcpy( buf, &dp->idx, sizeof(uint32_t) );
+  memcpy( buf + sizeof(uint32_t), &dp->time_us, sizeof(uint32_t) );
+  buf += 2 * sizeof(uint32_t);
+  LOG_FAST_FIELDS(LOG_FAST_ENCODE)
+  return buf;
+}
+
+static inline const uint8_t *log_fast_decode ( data_point *dp, const uint8_t *buf )
+{
+  memcpy( &dp->idx, buf, sizeof(uint32_t) );
+  memcpy( &dp->time_us, buf + sizeof(uint32_t), sizeof(uint32_t) );
+  buf += 2 * sizeof(uint32_t);
+  LOG_FAST_FIELDS(LOG_FAST_DECODE)
+  return buf;
+}
+
+// pack the fast channels of two samples into one slot
+static inline void log_pair_encode ( data_point *slot, const data_point *a, const data_point *b )
+{
+  uint8_t *buf = (uint8_t *) slot;
+
+  memset( slot, 0, sizeof(*slot) );
+  buf = log_fast_encode( buf, a );
+  log_fast_encode( buf, b );
+  slot->idx |= LOG_SLOT_PAIR;
+}
+
+static inline void log_qos_encode ( data_point *slot, const log_qos_marker *qm )
+{
+  memset( slot, 0, sizeof(*slot) );
+  memcpy( slot, qm, sizeof(*qm) );
+  slot->idx |= LOG_SLOT_QOS;
+}
+
+static inline void log_qos_decode ( log_qos_marker *qm, const data_point *slot )
+{
+  memcpy( qm, slot, sizeof(*qm) );
+  qm->idx &= ~LOG_SLOT_MASK;
+}
+
+// the samples in one slot, 0 for a rate change. held is the last full record, updated here,
+// and fills the slow channels of packed samples
+static inline int log_slot_expand ( const data_point *slot, data_point *held, data_point *out )
+{
+  const uint8_t *buf = (const uint8_t *) slot;
+
+  switch ( log_slot_kind( slot ) ) {
+    case LOG_SLOT_FULL:
+      *held = *slot;
+      out[0] = *slot;
+      return 1;
+    case LOG_SLOT_PAIR:
+      out[0] = *held;
+      out[1] = *held;
+      buf = log_fast_decode( &out[0], buf );
+      log_fast_decode( &out[1], buf );
+      out[0].idx &= ~LOG_SLOT_MASK;
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+// text and csv: the format strings are put together by the preprocessor, one printf per record
+#define LOG_FIELD_TEXT_FMT(type, name, kind, fmt, info)   #name " " fmt "  "
+#define LOG_FIELD_CSV_NAME(type, name, kind, fmt, info)   "," #name
+#define LOG_FIELD_CSV_FMT(type, name, kind, fmt, info)    "," fmt
+#define LOG_FIELD_ARG(type, name, kind, fmt, info)        , dp->name
+
+#define LOG_TEXT_FMT          LOG_FIELDS(LOG_FIELD_TEXT_FMT) "\n"
+#define LOG_CSV_HEADER        ( LOG_FIELDS(LOG_FIELD_CSV_NAME) "\n" + 1 )     // skip the leading comma
+#define LOG_CSV_FMT           ( LOG_FIELDS(LOG_FIELD_CSV_FMT) "\n" + 1 )
+
+// "idx 12  time_us 48000  prim_rpm 2100 ..." on one line
+static inline void log_record_print ( FILE *fp, const data_point *dp )
+{
+  fprintf( fp, LOG_TEXT_FMT LOG_FIELDS(LOG_FIELD_ARG) );
+}
+
+static inline void log_csv_header ( FILE *fp )
+{
+  fputs( LOG_CSV_HEADER, fp );
+}
+
+static inline void log_csv_row ( FILE *fp, const data_point *dp )
+{
+  fprintf( fp, LOG_CSV_FMT LOG_FIELDS(LOG_FIELD_ARG) );
+}
+
+void log_file_header_init ( log_file_header *fh, uint32_t sample_hz )
+{
+  fh->magic = LOG_MAGIC;
+  fh->version = LOG_VERSION;
+  fh->header_size = sizeof(log_file_header);
+  fh->record_size = LOG_RECORD_SIZE;
+  fh->block_samples = LOG_BLOCK_SAMPLES;
+  fh->block_size = LOG_BLOCK_SIZE;
+  fh->sample_hz = sample_hz;
+  fh->num_ch = LOG_NUM_CH;
+  fh->adc_channels = 0;
+  fh->adc_convst_us = 0;
+}
+
+// standard (ieee 802.3) crc32, nibble table to keep it small
+static const uint32_t log_crc_table[16] =
+{
+  0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+  0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+uint32_t log_crc32 ( uint32_t crc, const void *buf, size_t len )
+{
+  const uint8_t *p = (const uint8_t *) buf;
+  crc = ~crc;
+  while ( len-- ) {
+    crc ^= *p++;
+    crc = ( crc >> 4 ) ^ log_crc_table[crc & 0x0f];
+    crc = ( crc >> 4 ) ^ log_crc_table[crc & 0x0f];
+  }
+  return ~crc;
+}
+
+// seal a complete block (header + LOG_BLOCK_SAMPLES records) with its crc
+void log_seal_block ( uint8_t *block )
+{
+  log_block_header *bh = (log_block_header *) block;
+  bh->crc = 0;
+  bh->crc = log_crc32( 0, block, LOG_BLOCK_SIZE );
+}
+
+// check a block read back from a log: magic, expected sequence number and crc
+int log_block_valid ( uint8_t *block, uint32_t seq )
+{
+  log_block_header *bh = (log_block_header *) block;
+  uint32_t crc = bh->crc;
+  int ok;
+
+  if ( ( bh->magic != LOG_BLOCK_MAGIC ) | ( bh->seq != seq ) | ( bh->n_samples > LOG_BLOCK_SAMPLES ) ) {
+    return 0;
+  }
+  bh->crc = 0;
+  ok = ( log_crc32( 0, block, LOG_BLOCK_SIZE ) == crc );
+  bh->crc = crc;
+  return ok;
+}
+
+// fill in a block header from the n slots that follow it. a channel is summarised over the
+// samples that logged it: packed samples only count for the fast channels
+void log_summarise_block ( log_block_header *bh, uint32_t seq, const data_point *dps, int n )
+{
+  uint32_t sum[LOG_NUM_CH] = { 0 };
+  uint32_t cnt[LOG_NUM_CH] = { 0 };
+  data_point held = { 0 }, out[2];
+  uint32_t mask;
+  int i, k, m, ch;
+
+  bh->magic = LOG_BLOCK_MAGIC;
+  bh->seq = seq;
+  bh->crc = 0;
+  bh->first_idx = ( n > 0 ) ? ( dps[0].idx & ~LOG_SLOT_MASK ) : 0;
+  bh->first_time_us = ( n > 0 ) ? dps[0].time_us : 0;
+  bh->n_samples = n;
+  bh->reserved = 0;
+
+  for ( ch = 0; ch < LOG_NUM_CH; ch++ ) {
+    bh->min[ch] = UINT16_MAX;
+    bh->max[ch] = 0;
+  }
+
+  for ( i = 0; i < n; i++ ) {
+    m = log_slot_expand( &dps[i], &held, out );
+    mask = ( log_slot_kind( &dps[i] ) == LOG_SLOT_FULL ) ? ~0u : LOG_FAST_CH_MASK;
+    for ( k = 0; k < m; k++ ) {
+      for ( ch = 0; ch < LOG_NUM_CH; ch++ ) {
+        if ( !( ( mask >> ch ) & 1 ) ) {
+          continue;
+        }
+        uint16_t v = log_ch_value( &out[k], ch );
+        if ( v < bh->min[ch] ) bh->min[ch] = v;
+        if ( v > bh->max[ch] ) bh->max[ch] = v;
+        sum[ch] += v;
+        ++cnt[ch];
+      }
+    }
+  }
+
+  for ( ch = 0; ch < LOG_NUM_CH; ch++ ) {
+    if ( cnt[ch] == 0 ) {
+      bh->min[ch] = 0;
+    }
+    bh->mean[ch] = ( cnt[ch] > 0 ) ? ( sum[ch] + cnt[ch] / 2 ) / cnt[ch] : 0;
+  }
+}
+
+/*
+** BURST CAPTURE FILE (data_N.cap) - short windows of selected channels sampled at CAP_SAMPLE_HZ
+around a trigger, written next to the run's log: capture header | window | window | ...
+each window is a window header followed by n_samples cap_samples, oldest first, with the
+trigger at sample n_pre. channels follow the log channel order (LOG_CH_*), channels
+not in ch_mask are 0. the crc covers the window header (crc zeroed) and its samples.
+*/
+
+#define CAP_MAGIC             0x5041434e  // "NCAP"
+#define CAP_WINDOW_MAGIC      0x4e49574e  // "NWIN"
+#define CAP_VERSION           1
+
+// trigger causes
+#define CAP_TRIG_LAUNCH       1           // e-brake released
+#define CAP_TRIG_FAULT        2           // fault trip
+#define CAP_TRIG_GPIO         3           // external trigger input
+#define CAP_TRIG_LEVEL        4           // a channel rose through the configured level
+
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t header_size;
+  uint16_t window_header_size;
+  uint16_t sample_size;
+  uint32_t sample_hz;
+  uint16_t num_ch;
+  uint16_t reserved;
+} cap_file_header;
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t crc;
+  uint16_t cause;
+  uint16_t ch_mask;       // bit k = log channel k
+  uint32_t trig_idx;      // daq sample index when the trigger fired
+  uint32_t trig_time_us;
+  uint16_t n_samples;
+  uint16_t n_pre;         // samples before the trigger
+} cap_window_header;
+
+typedef struct
+{
+  uint32_t time_us;
+  uint16_t ch[LOG_NUM_CH];
+} cap_sample;
+
+void cap_file_header_init ( cap_file_header *ch, uint32_t sample_hz )
+{
+  ch->magic = CAP_MAGIC;
+  ch->version = CAP_VERSION;
+  ch->header_size = sizeof(cap_file_header);
+  ch->window_header_size = sizeof(cap_window_header);
+  ch->sample_size = sizeof(cap_sample);
+  ch->sample_hz = sample_hz;
+  ch->num_ch = LOG_NUM_CH;
+  ch->reserved = 0;
+}
+
+/*
+** TIMELINE TRACE FILE (data_N.trc) - the trace ring of a run (nubaja_trace.h), oldest event first:
+trace header | trace_event | trace_event | ... each event is the begin, end or a mark of one
+TRACE_EVENTS entry, stamped with the CCOUNT cycle counter of the core it happened on. the two
+cores' counters are not in step and wrap every 2^32 / cpu_mhz us, so each core writes a sync
+pair at least every TRACE_SYNC_US and every quarter ring: a sync event with its cycle count,
+then a sync_time event carrying the esp_timer time (low 32 bits, as in data_point.time_us) in
+its cycles field. host/trace_json turns a trace into Chrome / Perfetto trace JSON.
+*/
+
+#define TRACE_MAGIC           0x4352544e  // "NTRC"
+#define TRACE_VERSION         1
+
+// event phases, flags bits 0-1. bit 7 is the core
+#define TRACE_BEGIN           0
+#define TRACE_END             1
+#define TRACE_MARK            2
+#define TRACE_PHASE_MASK      0x03
+#define TRACE_CORE_BIT        0x80
+
+// timeline row of each event. ISR events get a row per core, CALLER events go on the row
+// of the span open around them on their core (the task that made the I2C call, say)
+#define TRACE_TRACKS(X) \
+  X( NONE,    "" ) \
+  X( ISR,     "isr" ) \
+  X( DAQ,     "daq_task" ) \
+  X( WRITER,  "sd_writer" ) \
+  X( BRAKE,   "brake_sync" ) \
+  X( BURST,   "burst" ) \
+  X( AUX,     "aux_bus" ) \
+  X( GOV,     "governor" ) \
+  X( CALLER,  "" )
+
+// X( name, track, what arg holds ). new events go on the end, the id is the position
+#define TRACE_EVENTS(X) \
+  X( none,          NONE,   "" )          /* slot never written */ \
+  X( sync,          NONE,   "" ) \
+  X( sync_time,     NONE,   "" ) \
+  X( daq_isr,       ISR,    "" ) \
+  X( rpm_isr,       ISR,    "gpio" ) \
+  X( brake_isr,     ISR,    "" ) \
+  X( daq_tick,      DAQ,    "idx" )       /* low 16 bits */ \
+  X( daq_adc,       DAQ,    "" ) \
+  X( daq_ctrl,      DAQ,    "" ) \
+  X( daq_log,       DAQ,    "slots" ) \
+  X( daq_late,      DAQ,    "late_us" ) \
+  X( daq_overrun,   DAQ,    "" ) \
+  X( i2c,           CALLER, "port" ) \
+  X( sd_write,      WRITER, "records" ) \
+  X( sd_busy,       WRITER, "records" )   /* queue skipped or staged, card taken */ \
+  X( sd_rotate,     WRITER, "file" ) \
+  X( sd_close,      DAQ,    "file" ) \
+  X( stage_write,   CALLER, "file" ) \
+  X( stage_migrate, CALLER, "" ) \
+  X( brake_sync,    BRAKE,  "counts" ) \
+  X( burst_sample,  BURST,  "" ) \
+  X( aux_bus,       AUX,    "" ) \
+  X( adc_fallback,  DAQ,    "pulse" )     /* CONVST result lost, read in command mode */ \
+  X( gov_update,    GOV,    "rpm" )       /* one engine edge */
+
+#define TRACE_TRACK_ID(name, label)           TRACE_TRACK_##name,
+#define TRACE_TRACK_LABEL(name, label)        label,
+#define TRACE_EVENT_ID(name, track, arg)      TRACE_##name,
+#define TRACE_EVENT_NAME(name, track, arg)    #name,
+#define TRACE_EVENT_TRACK(name, track, arg)   TRACE_TRACK_##track,
+#define TRACE_EVENT_ARG(name, track, arg)     arg,
+
+enum { TRACE_TRACKS(TRACE_TRACK_ID) TRACE_NUM_TRACKS };
+enum { TRACE_EVENTS(TRACE_EVENT_ID) TRACE_NUM_EVENTS };
+
+static const char *const trace_track_labels[TRACE_NUM_TRACKS] = { TRACE_TRACKS(TRACE_TRACK_LABEL) };
+static const char *const trace_event_names[TRACE_NUM_EVENTS] = { TRACE_EVENTS(TRACE_EVENT_NAME) };
+static const uint8_t trace_event_tracks[TRACE_NUM_EVENTS] = { TRACE_EVENTS(TRACE_EVENT_TRACK) };
+static const char *const trace_event_args[TRACE_NUM_EVENTS] = { TRACE_EVENTS(TRACE_EVENT_ARG) };
+
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t header_size;
+  uint16_t event_size;
+  uint16_t num_events;    // TRACE_NUM_EVENTS of the writer
+  uint32_t cpu_mhz;       // CCOUNT rate
+  uint32_t n_events;      // events that follow
+  uint32_t recorded;      // events the run recorded, those overwritten or after a freeze included
+  uint32_t freeze_at;     // event the ring froze around (in the file), UINT32_MAX = it never froze
+} trace_file_header;
+
+typedef struct
+{
+  uint32_t cycles;        // CCOUNT, or the esp_timer time of a sync_time event
+  uint8_t id;             // TRACE_*
+  uint8_t flags;          // phase, core
+  uint16_t arg;
+} trace_event;
+
+void trace_file_header_init ( trace_file_header *th, uint32_t cpu_mhz )
+{
+  memset( th, 0, sizeof(*th) );
+  th->magic = TRACE_MAGIC;
+  th->version = TRACE_VERSION;
+  th->header_size = sizeof(trace_file_header);
+  th->event_size = sizeof(trace_event);
+  th->num_events = TRACE_NUM_EVENTS;
+  th->cpu_mhz = cpu_mhz;
+  th->freeze_at = UINT32_MAX;
+}
+
+#endif // NUBAJA_LOG_FORMAT_H_
@@ -0,0 +1,144 @@
+#ifndef NUBAJA_LOG_QOS_H_
+#define NUBAJA_LOG_QOS_H_
+
+#include <stdio.h>
+#include <string.h>
+#include "nubaja_log_format.h"
+
+/*
+** LOGGING RATE UNDER BACKLOG - when the SD card stalls the logging buffers fill, and once
+both are full a whole buffer of every channel is thrown away. before that happens daq_task
+steps the slow channels down instead. each level is entered when the buffers pass its fill
+threshold (log_qos_fill, then every log_qos_step percent above it in the boot config) and
+left again once the fill is LOG_QOS_HYST_PCT below it. at a level only one sample in decim
+is logged whole; the samples between keep their fast channels (LOG_FAST_FIELDS: rpm, torque,
+brake current, load cell), packed two to a record, so the buffers last up to twice as long.
+every change goes into the log as a LOG_SLOT_QOS record, ahead of the first sample at the
+new rate. a rotated file starts over on a full record, with a LOG_SLOT_QOS record first when
+it starts below full rate, so each file reads on its own.
+*/
+
+#define LOG_QOS_LEVELS        3
+#define LOG_QOS_HYST_PCT      10             // below the threshold by this much to step back up
+
+// slow channels logged on 1 sample in decim, by level. odd, so the packed samples between
+// two full records always pair up
+static const uint16_t log_qos_decim[LOG_QOS_LEVELS + 1] = { 1, 3, 9, 25 };
+
+typedef struct
+{
+  int level;                         // 0 = every channel at full rate
+  int fill_pct[LOG_QOS_LEVELS];      // buffer fill to enter level k + 1, 0 = never
+  uint32_t phase;                    // samples since the last full record
+  int pending;                       // hold is a fast sample waiting for its pair
+  int restart;                       // next sample opens a new file
+  data_point hold;
+  uint32_t changes;
+  uint32_t packed;                   // samples logged without their slow channels
+  uint32_t dropped;                  // samples lost with a buffer that could not be written
+  uint32_t level_samples[LOG_QOS_LEVELS + 1];
+} log_qos_t;
+
+// start of a run. fill_pct 0 turns the policy off
+void log_qos_reset ( log_qos_t *q, int fill_pct, int step_pct )
+{
+  int k;
+
+  memset( q, 0, sizeof(*q) );
+  for ( k = 0; k < LOG_QOS_LEVELS; k++ ) {
+    q->fill_pct[k] = ( fill_pct > 0 ) ? fill_pct + k * step_pct : 0;
+  }
+}
+
+static int log_qos_level ( const log_qos_t *q, int fill_pct )
+{
+  int level = q->level;
+
+  while ( ( level < LOG_QOS_LEVELS ) && ( q->fill_pct[level] > 0 ) &&
+          ( fill_pct >= q->fill_pct[level] ) ) {
+    ++level;
+  }
+  while ( ( level > 0 ) && ( fill_pct < q->fill_pct[level - 1] - LOG_QOS_HYST_PCT ) ) {
+    --level;
+  }
+  return level;
+}
+
+// a fast sample still waiting for its pair is logged whole. at a rate change, rotation and
+// the end of the run. returns the slots written, 0 or 1
+int log_qos_flush ( log_qos_t *q, data_point *slots )
+{
+  if ( !q->pending ) {
+    return 0;
+  }
+  q->pending = 0;
+  --q->packed;
+  slots[0] = q->hold;
+  return 1;
+}
+
+// the last slots of a file about to be rotated: the next sample is the first of the new file.
+// returns the slots written, 0 or 1
+int log_qos_rotate ( log_qos_t *q, data_point *slots )
+{
+  q->phase = 0;
+  q->restart = 1;
+  return log_qos_flush( q, slots );
+}
+
+// one sample in, up to 3 slots out to the logging queue: a flushed sample, a rate change,
+// then the sample itself (nothing while it waits for its pair). fill_pct is the share of
+// both logging buffers in use
+int log_qos_slots ( log_qos_t *q, const data_point *dp, int fill_pct, data_point *slots )
+{
+  log_qos_marker qm;
+  int n = 0, level = log_qos_level( q, fill_pct );
+
+  if ( ( level != q->level ) || ( q->restart && ( level > 0 ) ) ) {
+    n += log_qos_flush( q, slots );
+    qm.idx = dp->idx;
+    qm.time_us = dp->time_us;
+    qm.level = level;
+    qm.decim = log_qos_decim[level];
+    qm.fill_pct = fill_pct;
+    qm.reserved = 0;
+    log_qos_encode( &slots[n++], &qm );
+    if ( level != q->level ) {
+      ++q->changes;
+    }
+    q->level = level;
+    q->phase = 0;
+  }
+  q->restart = 0;
+  ++q->level_samples[q->level];
+
+  if ( q->phase == 0 ) {
+    slots[n++] = *dp;
+  }
+  else if ( q->pending ) {
+    log_pair_encode( &slots[n++], &q->hold, dp );
+    q->pending = 0;
+    ++q->packed;
+  }
+  else {
+    q->hold = *dp;
+    q->pending = 1;
+    ++q->packed;
+  }
+  q->phase = ( q->phase + 1 ) % log_qos_decim[q->level];
+  return n;
+}
+
+void log_qos_print ( const log_qos_t *q )
+{
+  int k;
+
+  printf("log_qos -- %u rate changes, %u samples without slow channels, %u dropped, samples by level:",
+         (unsigned) q->changes, (unsigned) q->packed, (unsigned) q->dropped);
+  for ( k = 0; k <= LOG_QOS_LEVELS; k++ ) {
+    printf(" 1/%u %u", (unsigned) log_qos_decim[k], (unsigned) q->level_samples[k]);
+  }
+  printf("\n");
+}
+
+#endif // NUBAJA_LOG_QOS_H_
@@ -30,6 +30,13 @@ typedef struct
   int slave_address;
 } LSM6DSM;
 
+// one gyro + accelerometer reading, raw counts
+typedef struct
+{
+  int16_t gyro_x, gyro_y, gyro_z;
+  int16_t xl_x, xl_y, xl_z;
+} imu_sample_t;
+
 // create and configure the LSM6DSM IMU
 LSM6DSM init_lsm6dsm(int port_num, int slave_address)
 {
@@ -66,10 +73,10 @@ LSM6DSM init_lsm6dsm(int port_num, int slave_address)
   return dev;
 }
 
-void imu_read_gyro_xl(LSM6DSM *dev, int16_t *gyro_x, int16_t *gyro_y, int16_t *gyro_z,
-                                    int16_t *xl_x, int16_t *xl_y, int16_t *xl_z)
+int imu_read_gyro_xl(LSM6DSM *dev, int16_t *gyro_x, int16_t *gyro_y, int16_t *gyro_z,
+                                   int16_t *xl_x, int16_t *xl_y, int16_t *xl_z)
 {
-  i2c_read_2_bytes_6_lh(dev->port_num, dev->slave_address, OUTX_L_G,
+  return i2c_read_2_bytes_6_lh(dev->port_num, dev->slave_address, OUTX_L_G,
                        (uint16_t *) gyro_x, (uint16_t *) gyro_y, (uint16_t *) gyro_z,
                        (uint16_t *) xl_x, (uint16_t *) xl_y, (uint16_t *) xl_z);
 }
@@ -0,0 +1,75 @@
+#ifndef NUBAJA_MEM_H_
+#define NUBAJA_MEM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+** MEMORY BUDGET - static RAM (.data + .bss) from the linker symbols, heap free / low-water /
+largest free block, and the stack high-water mark of each task. every task records its own
+mark with mem_note_stack just before it deletes itself (the console after each command), so
+short lived tasks like the SD writers are covered. for the per-component static breakdown run "make size-components".
+*/
+
+// tasks whose stack use is tracked, one slot per kind of task
+#define MEM_TASK_DAQ          0
+#define MEM_TASK_AUX          1
+#define MEM_TASK_INIT         2
+#define MEM_TASK_WRITER       3
+#define MEM_TASK_BURST        4
+#define MEM_TASK_CONSOLE      5
+#define MEM_TASK_BRAKE        6
+#define MEM_TASK_STAGE        7
+#define MEM_TASK_GOV          8
+#define MEM_NUM_TASKS         9
+
+// linker script symbols, addresses only
+extern int _data_start, _data_end, _bss_start, _bss_end;
+
+const char *mem_task_names[] = { "daq_task", "aux_bus", "init", "sd_writer", "burst", "console", "brake_sync",
+                                 "stage", "governor" };
+_Static_assert( sizeof(mem_task_names) / sizeof(mem_task_names[0]) == MEM_NUM_TASKS, "one name per MEM_TASK_" );
+uint32_t mem_stack_free[MEM_NUM_TASKS];    // UINT32_MAX = not recorded yet, see mem_init
+
+// first thing in app_main, before any task can record its mark
+void mem_init ()
+{
+  int i;
+
+  for ( i = 0; i < MEM_NUM_TASKS; i++ ) {
+    mem_stack_free[i] = UINT32_MAX;
+  }
+}
+
+// record the calling task's stack high-water mark (bytes never used) in its slot
+void mem_note_stack ( int task )
+{
+  uint32_t free_bytes = uxTaskGetStackHighWaterMark( NULL );
+  if ( free_bytes < mem_stack_free[task] ) {
+    mem_stack_free[task] = free_bytes;
+  }
+}
+
+void mem_report ( const char *when )
+{
+  int i;
+  uint32_t data = (uint32_t) ( (char *) &_data_end - (char *) &_data_start );
+  uint32_t bss = (uint32_t) ( (char *) &_bss_end - (char *) &_bss_start );
+
+  printf("mem_report -- %s\n", when);
+  printf("  static: %u bytes .data, %u bytes .bss\n", (unsigned) data, (unsigned) bss);
+  printf("  heap: %u free, %u low-water, %u largest block\n",
+         (unsigned) heap_caps_get_free_size( MALLOC_CAP_8BIT ),
+         (unsigned) heap_caps_get_minimum_free_size( MALLOC_CAP_8BIT ),
+         (unsigned) heap_caps_get_largest_free_block( MALLOC_CAP_8BIT ));
+  for ( i = 0; i < MEM_NUM_TASKS; i++ ) {
+    if ( mem_stack_free[i] != UINT32_MAX ) {
+      printf("  stack: %s %u bytes never used\n", mem_task_names[i], (unsigned) mem_stack_free[i]);
+    }
+  }
+}
+
+#endif // NUBAJA_MEM_H_
@@ -36,6 +36,10 @@ void pid_update ( pid_ctrl_t *pid, float sp, float pv )
 	{
 		pid->I = pid->windupGuard;
 	}
+	else if ( pid->I < -pid->windupGuard ) 
+	{
+		pid->I = -pid->windupGuard;
+	}
 
 	pid->output = ( pid->kp * pid->P ) + ( pid->ki * pid->I ) + ( pid->kd * pid->D );
 
@@ -54,7 +58,7 @@ void init_pid ( pid_ctrl_t *pid, float kp, float ki, float kd, float windupGuard
 	pid->output = 0; 
 	
 	// tuning parameters
-	pid->kp = 0;
+	pid->kp = kp;
 	pid->ki = ki;
 	pid->kd = kd; 
 
@@ -77,7 +81,7 @@ void reset_pid (pid_ctrl_t *pid )
 	pid->D = 0;	
 }
 
-float fetch_sp ( int t, float profile[] )
+float fetch_sp ( int t, const uint8_t profile[] )
 {
 	float sp; 
 	sp = profile[t];
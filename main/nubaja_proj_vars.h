@@ -1,6 +1,8 @@
 #ifndef NUBAJA_PROJ_VARS_H_
 #define NUBAJA_PROJ_VARS_H_
 
+#include <stdint.h>
+
 //timing
 #define DAQ_TIMER_GROUP       	TIMER_GROUP_0  // group of daq timer
 #define DAQ_TIMER_IDX         	0              // index of daq timer
@@ -10,8 +12,11 @@
 //ctrl
 #define LAUNCH_THRESHOLD      	50 //% of throttle needed for launch
 #define BSIZE                 	100 //test length
+#define NUM_PROFILES 			5 //profiles 1-5, see load_profile
 
 //adc scales, offsets (physical quantity = scale*volts + offset)
+#define ADC_FS					3.3 //volts at full scale (4096 counts)
+
 #define TORQUE_SCALE 			15.6
 #define TORQUE_OFFSET 			0
 
@@ -28,6 +33,7 @@
 #define LOAD_CELL_OFFSET 		-50
 
 #define BREAK_IN_RPM			1800
+#define BREAK_IN_TPS			( 0.05 * BREAK_IN_RPM - 90 ) //constant throttle for break-in, %
 
 //fault thresholds
 #define MAX_I_BRAKE				2.4 //amps
@@ -35,6 +41,10 @@
 #define MAX_CVT_AMBIENT 		100 //deg C
 #define MAX_BRAKE_TEMP			100 //deg C
 #define I_BRAKE_MAX           	3.6
+#define SLIP_EFFICIENCY			50 //%, powertrain efficiency below this is taken as belt slip
+#define SLIP_MIN_POWER			1 //hp engine power before the slip check applies
+#define SLIP_TICKS				3 //consecutive low efficiency ticks to flag slip
+#define SLIP_TRIP				0 //1 = belt slip ends the test like any other fault
 
 //PIDs
 #define	KP						0 
@@ -42,6 +52,11 @@
 #define	KD						0
 #define	BRAKE_WINDUP_GUARD		10
 #define	BRAKE_OUTPUT_MAX		100
+#define	GOV_KP					0.02 //break-in rpm governor, throttle % per rpm of error, per edge
+#define	GOV_KI					0.002
+#define	GOV_KD					0
+#define	GOV_WINDUP_GUARD		10000 //rpm x edges, GOV_KI x this = 20% of throttle
+#define	GOV_OUTPUT_MAX			60 //% throttle the governor may add above BREAK_IN_TPS
 
 //struct for consolidating various flags, key quantities, etc
 struct control 
@@ -60,11 +75,23 @@ struct control
 	float i_brake_duty;
 	float brake_temp;
 	float belt_temp;
+	int slip_ticks; //consecutive ticks of low powertrain efficiency
 };
 typedef struct control control_t;
 
-//profiles
-float i_sp_accel_launch[BSIZE] = 	{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+//profiles - whole percent (0-100), one entry per daq tick. const, so they stay in flash
+//and only the selected profile is read, through the pointers in profile_t
+typedef struct
+{
+	const uint8_t *i_sp;
+	const uint8_t *tps_sp;
+	int len; //entries, the last one is held once the profile runs out
+} profile_t;
+
+const uint8_t sp_zero[1] = { 0 };
+const uint8_t tps_sp_break_in[1] = { BREAK_IN_TPS };
+
+const uint8_t i_sp_accel_launch[BSIZE] = 	{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
 						   			0, 100, 100, 99, 99, 99, 99, 98, 98, 98, 
 						   			97, 97, 97, 96, 96, 96, 95, 95, 95, 94,
 						   			94, 94, 93, 93, 92, 92, 91, 91, 91, 90,
@@ -75,17 +102,17 @@ float i_sp_accel_launch[BSIZE] = 	{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 						   			59, 58, 57, 56, 55, 54, 52, 51, 50, 49,
 						   			48, 47, 46, 45, 44, 42, 41, 40, 39, 38};
 
-float tps_sp_accel_launch[BSIZE];
+const uint8_t tps_sp_accel_launch[BSIZE] = { 0 }; //placeholder, all zero
 
-float i_sp_accel[BSIZE];
+const uint8_t i_sp_accel[BSIZE] = { 0 }; //placeholder, all zero
 
-float tps_sp_accel[BSIZE];
+const uint8_t tps_sp_accel[BSIZE] = { 0 }; //placeholder, all zero
 
-float i_sp_hill[BSIZE];
+const uint8_t i_sp_hill[BSIZE] = { 0 }; //placeholder, all zero
 
-float tps_sp_hill[BSIZE];
+const uint8_t tps_sp_hill[BSIZE] = { 0 }; //placeholder, all zero
 
-float i_sp_test[BSIZE] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, //0-.9
+const uint8_t i_sp_test[BSIZE] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, //0-.9
 						   0, 100, 100, 99, 99, 99, 99, 98, 98, 98, //1-1.9
 						   97, 97, 97, 96, 96, 96, 95, 95, 95, 94,
 						   94, 94, 93, 93, 92, 92, 91, 91, 91, 90,
@@ -96,7 +123,7 @@ float i_sp_test[BSIZE] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, //0-.9
 						   59, 58, 57, 56, 55, 54, 52, 51, 50, 49,
 						   48, 47, 46, 45, 44, 42, 41, 40, 39, 38};
 
-float tps_sp_test[BSIZE] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+const uint8_t tps_sp_test[BSIZE] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 						   10, 10, 10, 10, 10, 25, 25, 25, 25, 25,
 						   35, 35, 35, 35, 35, 35, 35, 35, 35, 35,
 						   50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
@@ -107,7 +134,7 @@ float tps_sp_test[BSIZE] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 						   15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
 						   0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
-float i_sp_demo[BSIZE] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+const uint8_t i_sp_demo[BSIZE] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 						   0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 						   0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 						   0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -118,7 +145,7 @@ float i_sp_demo[BSIZE] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 						   0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 						   0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
-float tps_sp_demo[BSIZE] = { 0, 2, 4, 5, 6, 8, 10, 12, 14,16,
+const uint8_t tps_sp_demo[BSIZE] = { 0, 2, 4, 5, 6, 8, 10, 12, 14,16,
 						   18, 20, 22, 24, 26, 28, 30, 32, 34, 36,
 						   38, 40, 42, 44, 46, 48, 50, 52, 54, 56,
 						   58, 60, 62, 64, 66, 68, 70, 72, 74, 76,
@@ -4,105 +4,591 @@
 #define __STDC_FORMAT_MACROS
 
 #include <inttypes.h>
+#include <dirent.h>
+#include <strings.h>
 #include "esp_vfs_fat.h"
 #include "driver/sdmmc_host.h"
 #include "driver/sdspi_host.h"
 #include "sdmmc_cmd.h"
 #include "freertos/semphr.h"
+#include "nubaja_log_format.h"
+#include "nubaja_stage.h"
+#include "nubaja_mem.h"
+#include "nubaja_trace.h"
 
 #define SD_MISO 19
 #define SD_MOSI 18
 #define SD_CLK  14
 #define SD_CS   15
 
-#define LOGGING_QUEUE_SIZE  1000   // data logging queue size
+#define LOGGING_QUEUE_SIZE  ( 6 * LOG_BLOCK_SAMPLES )   // data logging queue size, whole blocks
 SemaphoreHandle_t write_lock = NULL;
 int file_num = 0;
-char filename[20] = "/sdcard/data_x.csv";
+char filename[32] = "/sdcard/data_x.bin";
+char idx_filename[32] = "/sdcard/data_x.idx"; // block index, appended to the log on close
+uint32_t log_block_count = 0;
+int log_open_num = 0; // run number of filename, 0 = none open
+uint8_t log_adc_channels = 0, log_adc_convst_us = 0; // ADC timing of the run, for its file headers
+sdmmc_card_t* sd_card = NULL;
+uint8_t log_block_buf[LOG_BLOCK_SIZE]; // one block being built, used under write_lock or before the run starts
 
+#define STAGE_CHUNK         32              // records moved from a queue to the flash ring at a time
+stage_t stage; // flash ring for what the card can't take, see nubaja_stage.h
+int stage_ok = 0; // the stage partition was found
+SemaphoreHandle_t stage_lock = NULL; // held for every stage_* call
+data_point stage_buf[STAGE_CHUNK]; // used under stage_lock
+volatile int stage_idle = 1; // no run logging, stage_task may erase
+TaskHandle_t stage_task_handle = NULL;
+
+// log file an older staged run is moved into, used under write_lock
 typedef struct
 {
-  uint16_t prim_rpm, sec_rpm;
-  uint16_t torque, temp3, belt_temp, temp2, temp1, load_cell, tps, i_brake;
-  float i_sp, tps_sp; 
-} data_point;
+  int num;
+  uint32_t run;               // stage run moved into it, for runs staged without a card
+  uint32_t blocks;
+  char name[32], idx_name[32];
+} log_target_t;
+
+log_target_t stage_target;
+
+// summarise and append one block of n records, plus its entry in the index file. count is
+// the file's block count, the block's sequence number, and only moves on once the block and
+// its entry are on the card. 0 if either write failed
+static int log_write_block(FILE *fp, FILE *ip, uint8_t *block, int n, uint32_t *count)
+{
+  log_block_header *bh = (log_block_header *) block;
+  data_point *recs = (data_point *) ( block + sizeof(log_block_header) );
+  log_index_entry entry;
+
+  // zero pad short blocks so every block stays LOG_BLOCK_SIZE bytes
+  memset( recs + n, 0, ( LOG_BLOCK_SAMPLES - n ) * sizeof(data_point) );
+  log_summarise_block( bh, *count, recs, n );
+  log_seal_block( block );
+
+  entry.first_idx = bh->first_idx;
+  entry.first_time_us = bh->first_time_us;
+  entry.offset = sizeof(log_file_header) + *count * LOG_BLOCK_SIZE;
+
+  // a short write leaves a torn block past the count, which the next append overwrites
+  if ( ( fwrite( block, LOG_BLOCK_SIZE, 1, fp ) != 1 ) || ( fflush( fp ) != 0 ) ) {
+    printf("log_write_block -- block %" PRIu32 " failed\n", *count);
+    return 0;
+  }
+  if ( ( ip != NULL ) && ( fwrite( &entry, sizeof(entry), 1, ip ) != 1 ) ) {
+    printf("log_write_block -- index entry %" PRIu32 " failed\n", *count);
+    return 0;
+  }
+  ++*count;
+  return 1;
+}
 
-void print_data_point(data_point *dp)
+// a block that didn't make it back onto the front of its queue, in order, for the next writer
+static void log_unwrite_block(xQueueHandle lq, data_point *recs, int n)
 {
-  printf("prrpm:\t%" PRIu16             "\tserpm:\t%" PRIu16            "\ttrque:\t%" PRIu16 "\n"
-         "temp3:\t%" PRIu16             "\tbtemp:\t%" PRIu16            "\ttemp2:\t%" PRIu16 "\n"
-         "braki:\t%" PRIu16             "\ttemp1:\t%" PRIu16            "\tloadc:\t%" PRIu16 "\n"
-         "t_p_s:\t%" PRIu16             "\tbi_sp: %6.2f"                "\ttpssp: %6.2f"  "\n",
-         dp->prim_rpm,                  dp->sec_rpm,                    dp->torque,
-         dp->temp3,                     dp->belt_temp,                  dp->temp2,
-         dp->i_brake,                   dp->temp1,                      dp->load_cell, 
-         dp->tps,                       dp->i_sp,                       dp->tps_sp); 
+  while ( n-- > 0 ) {
+    xQueueSendToFront( lq, &recs[n], 0 );
+  }
 }
 
-static void write_logging_queue_to_sd(void *arg)
+// drain a logging queue into fixed size blocks. caller must hold write_lock. 0 if the log
+// can't be opened or a block write failed, the queue is left holding everything not on the card
+static int log_write_queue(xQueueHandle lq)
 {
-  if( xSemaphoreTake( write_lock, ( TickType_t ) 1 ) == pdFALSE )
+  uint8_t *block = log_block_buf;
+  data_point *recs = (data_point *) ( block + sizeof(log_block_header) );
+
+  FILE *fp = fopen( filename, "a" );
+  FILE *ip = fopen( idx_filename, "a" );
+  if (fp == NULL)
   {
-    printf("write_logging_queue_to_sd -- task overlap, skipping queue\n");
-    vTaskDelete(NULL);
+    printf("log_write_queue -- failed to open file\n");
+    if (ip != NULL) fclose(ip);
+    return 0;
   }
 
-  xQueueHandle lq = (xQueueHandle) arg;
-  data_point dp;
-  // num fields * num chars for each value + comma / return
-  // int16_t can be -35,xxx, so max 6 chars per val
-  int line_size = (13 * 7) + 9; //THIS IS CRITICAL - DO NOT CHANGE
-  // num lines * line size + char for null term
-  int buff_size = LOGGING_QUEUE_SIZE * line_size + 1;
-  char* buff = (char*) malloc(buff_size * sizeof(char));
-
-  int i = 0;
-  while (xQueueReceive(lq, &dp, 0) != pdFALSE)
-  {
-    snprintf(buff + (i * line_size), buff_size - (i * line_size),
-             "%6" PRIu16 ", %6" PRIu16 ",   %6" PRIu16 ","
-             "%6" PRIu16 ", %6" PRIu16 ",   %6" PRIu16 ","
-             "%6" PRIu16 ", %6" PRIu16 ",   %6" PRIu16 ","
-             "%6" PRIu16 ", %6.2f"       ",   %6.2f" "\n", 
-              dp.prim_rpm,  dp.sec_rpm,     dp.torque,
-              dp.temp3,     dp.belt_temp,   dp.temp2,
-              dp.i_brake,   dp.temp1,       dp.load_cell, 
-              dp.tps,       dp.i_sp,        dp.tps_sp); 
-    ++i;
-  }
-  // for ( i = 0; i<5 ;i++ ) {
-  //   xQueueReceive(lq, &dp, 0);
-  //   snprintf(buff + (i * line_size), buff_size - (i * line_size),
-  //            "%6" PRIu16 ", %6" PRIu16 ",   %6" PRIu16 ","
-  //            "%6" PRIu16 ", %6" PRIu16 ",   %6" PRIu16 ","
-  //            "%6" PRIu16 ", %6" PRIu16 ",   %6" PRIu16 ","
-  //            "%6" PRIu16 ", %6.2f"     ",   %6.2f" "\n", 
-  //             dp.prim_rpm,  dp.sec_rpm,     dp.torque,
-  //             dp.temp3,     dp.belt_temp,   dp.temp2,
-  //             dp.i_brake,   dp.temp1,       dp.load_cell, 
-  //             dp.tps,       dp.i_sp,        dp.tps_sp); 
-  // }
+  int n = 0, ok = 1;
+  while ( ok && ( xQueueReceive(lq, &recs[n], 0) != pdFALSE ) )
+  {
+    if ( ++n == LOG_BLOCK_SAMPLES )
+    {
+      ok = log_write_block( fp, ip, block, n, &log_block_count );
+      if ( ok ) {
+        n = 0;
+      }
+    }
+  }
+  if ( ok && ( n > 0 ) )
+  {
+    ok = log_write_block( fp, ip, block, n, &log_block_count );
+  }
+  if ( !ok )
+  {
+    log_unwrite_block( lq, recs, n );
+  }
+
+  fclose(fp);
+  if (ip != NULL) fclose(ip);
+  return ok;
+}
+
+// copy the block index onto the end of the log and terminate it with the footer
+static void log_write_index(const char *log_name, const char *idx_name)
+{
+  FILE *fp = fopen( log_name, "a" );
+  FILE *ip = fopen( idx_name, "r" );
+  if (fp == NULL || ip == NULL)
+  {
+    printf("log_write_index -- failed to open files, log left without index\n");
+    if (fp != NULL) fclose(fp);
+    if (ip != NULL) fclose(ip);
+    return;
+  }
+
+  // the index goes after whatever is on the card, a torn block included
+  log_footer footer;
+  fseek( fp, 0, SEEK_END );
+  footer.magic = LOG_INDEX_MAGIC;
+  footer.n_blocks = 0;
+  footer.index_offset = ftell( fp );
+
+  log_index_entry entry;
+  while ( fread( &entry, sizeof(entry), 1, ip ) == 1 )
+  {
+    fwrite( &entry, sizeof(entry), 1, fp );
+    ++footer.n_blocks;
+  }
+  fwrite( &footer, sizeof(footer), 1, fp );
+
+  fclose(ip);
+  fclose(fp);
+  remove( idx_name );
+  printf("log_write_index -- %" PRIu32 " blocks indexed\n", footer.n_blocks);
+}
+
+// rewrite the block index of a log from its blocks, every one up to the first torn or missing
+// one. returns the blocks kept, -1 if the files can't be opened
+static int32_t log_reindex(const char *log_name, const char *idx_name)
+{
+  uint8_t *block = log_block_buf;
+  FILE *fp = fopen( log_name, "r" );
+  FILE *ip = fopen( idx_name, "w" );
+  if (fp == NULL || ip == NULL)
+  {
+    if (fp != NULL) fclose(fp);
+    if (ip != NULL) fclose(ip);
+    return -1;
+  }
+
+  uint32_t seq = 0;
+  log_index_entry entry;
+  fseek( fp, sizeof(log_file_header), SEEK_SET );
+  while ( ( fread( block, LOG_BLOCK_SIZE, 1, fp ) == 1 ) && log_block_valid( block, seq ) )
+  {
+    log_block_header *bh = (log_block_header *) block;
+    entry.first_idx = bh->first_idx;
+    entry.first_time_us = bh->first_time_us;
+    entry.offset = sizeof(log_file_header) + seq * LOG_BLOCK_SIZE;
+    fwrite( &entry, sizeof(entry), 1, ip );
+    ++seq;
+  }
+
+  fclose(fp);
+  fclose(ip);
+  return seq;
+}
+
+// rebuild the index of a run that was never closed (power loss, kill switch). walks the
+// blocks once and keeps every block up to the first torn or missing one
+static void log_recover(const char *log_name, const char *idx_name)
+{
+  int32_t seq = log_reindex( log_name, idx_name );
+  if (seq < 0)
+  {
+    printf("log_recover -- cannot recover %s\n", log_name);
+    remove( idx_name );
+    return;
+  }
+  printf("log_recover -- %s: salvaged %d blocks\n", log_name, (int) seq);
+  log_write_index( log_name, idx_name );
+}
 
+// a leftover .idx file means that run was never closed, recover each one found
+static void log_recover_all()
+{
+  DIR *dir = opendir( "/sdcard" );
+  struct dirent *entry;
+  char log_name[32], idx_name[32];
+
+  if (dir == NULL)
+  {
+    return;
+  }
+  while ( ( entry = readdir( dir ) ) != NULL )
+  {
+    size_t len = strlen( entry->d_name );
+    if ( ( len < 5 ) || ( len > 16 ) || strcasecmp( entry->d_name + len - 4, ".idx" ) )
+    {
+      continue;
+    }
+    snprintf( idx_name, sizeof(idx_name), "/sdcard/%s", entry->d_name );
+    snprintf( log_name, sizeof(log_name), "/sdcard/%.*s.bin", (int) ( len - 4 ), entry->d_name );
+    log_recover( log_name, idx_name );
+  }
+  closedir( dir );
+}
+
+// next free run number: one past the highest data_N.bin on the card
+static int log_next_file_num()
+{
+  DIR *dir = opendir( "/sdcard" );
+  struct dirent *entry;
+  int num, max_num = 0;
+
+  if (dir == NULL)
+  {
+    return 1;
+  }
+  while ( ( entry = readdir( dir ) ) != NULL )
+  {
+    size_t len = strlen( entry->d_name );
+    if ( ( len > 9 ) && !strncasecmp( entry->d_name, "data_", 5 ) &&
+         !strcasecmp( entry->d_name + len - 4, ".bin" ) )
+    {
+      num = atoi( entry->d_name + 5 );
+      if ( num > max_num ) max_num = num;
+    }
+  }
+  closedir( dir );
+  return max_num + 1;
+}
+
+void sd_print_info()
+{
+  if ( sd_card != NULL ) {
+    sdmmc_card_print_info(stdout, sd_card);
+  }
+}
+
+// create data_num.bin with its header and an empty block index
+static int log_create_file(int num, char *name, char *idx_name, uint32_t *count)
+{
   FILE *fp;
-  fp = fopen( filename, "a" );
+  log_file_header fh;
+
+  *count = 0;
+  fp = fopen( name, "w" );
   if (fp == NULL)
   {
-    printf("write_logging_queue_to_sd -- failed to create file\n");
-    vTaskDelete(NULL);
+    printf("log_create_file -- failed to create %s\n", name);
+    return 0;
   }
-  fprintf(fp, "%s", buff);
-  // printf("%s",buff);
+  log_file_header_init( &fh, DAQ_TIMER_HZ );
+  fh.adc_channels = log_adc_channels;
+  fh.adc_convst_us = log_adc_convst_us;
+  fwrite( &fh, sizeof(fh), 1, fp );
   fclose(fp);
 
+  // start a fresh block index for this run
+  fp = fopen( idx_name, "w" );
+  if (fp != NULL) {
+    fclose(fp);
+  }
+  return 1;
+}
+
+// point name / idx_name / count at data_num.bin: carry on after its last intact block if
+// records were already moved into it from the flash ring, else create it
+static int log_use_file(int num, char *name, char *idx_name, uint32_t *count)
+{
+  int32_t blocks;
+
+  snprintf( name, 32, "/sdcard/data_%d.bin", num );
+  snprintf( idx_name, 32, "/sdcard/data_%d.idx", num );
+  blocks = log_reindex( name, idx_name );
+  if ( blocks >= 0 )
+  {
+    *count = blocks;
+    return 1;
+  }
+  return log_create_file( num, name, idx_name, count );
+}
+
+// make data_num.bin the open log the writers append to. caller holds write_lock
+static int log_switch_file(int num)
+{
+  int ok = log_use_file( num, filename, idx_filename, &log_block_count );
+  log_open_num = ok ? num : 0;
+  stage_target.num = -1;
+  return ok;
+}
+
+// drain a logging queue into the flash ring, tagged with its run's file. records that find
+// no clean entry are lost. caller holds stage_lock
+static void stage_write_queue(xQueueHandle lq, int num)
+{
+  int n, k, open = 0;
+
+  trace_begin( TRACE_stage_write, num );
+  do
+  {
+    n = 0;
+    while ( ( n < STAGE_CHUNK ) && ( xQueueReceive( lq, &stage_buf[n], 0 ) != pdFALSE ) ) {
+      ++n;
+    }
+    for ( k = 0; k < n; )
+    {
+      if ( !open && !stage_begin( &stage, num ) )
+      {
+        stage.refused += n - k;
+        break;
+      }
+      open = 1;
+      k += stage_add( &stage, &stage_buf[k], n - k );
+      if ( stage_room( &stage ) == 0 )
+      {
+        stage_end( &stage, STAGE_RECORDS );
+        open = 0;
+      }
+    }
+  } while ( n == STAGE_CHUNK );
+
+  if ( open ) {
+    stage_end( &stage, STAGE_RECORDS );
+  }
+  trace_end( TRACE_stage_write, num );
+}
+
+// the run's file is complete once the ring has been moved up to here. caller holds stage_lock
+static void stage_write_close(int num)
+{
+  if ( stage_begin( &stage, num ) ) {
+    stage_end( &stage, STAGE_CLOSE );
+  }
+  else {
+    printf("stage_write_close -- flash ring full, data_%d is closed at the next boot\n", num);
+  }
+}
+
+static uint32_t stage_pending()
+{
+  uint32_t n;
+
+  xSemaphoreTake( stage_lock, portMAX_DELAY );
+  n = stage.pending;
+  xSemaphoreGive( stage_lock );
+  return n;
+}
+
+// the file a staged entry belongs in: the open log, or an older one reopened, or created
+// for a run staged without a card. caller holds write_lock
+static int stage_target_for(const stage_entry_header *hdr, char **name, char **idx_name, uint32_t **count)
+{
+  log_target_t *t = &stage_target;
+
+  if ( ( hdr->file_num != 0 ) && ( hdr->file_num == log_open_num ) )
+  {
+    *name = filename;
+    *idx_name = idx_filename;
+    *count = &log_block_count;
+    return 1;
+  }
+  if ( ( t->num <= 0 ) || ( hdr->file_num ? ( t->num != hdr->file_num ) : ( t->run != hdr->run ) ) )
+  {
+    t->num = hdr->file_num ? hdr->file_num : log_next_file_num();
+    t->run = hdr->run;
+    if ( !log_use_file( t->num, t->name, t->idx_name, &t->blocks ) )
+    {
+      t->num = -1;
+      return 0;
+    }
+    printf("stage_migrate -- staged run %u into %s\n", (unsigned) t->run, t->name);
+  }
+  *name = t->name;
+  *idx_name = t->idx_name;
+  *count = &t->blocks;
+  return 1;
+}
+
+// one staged entry onto a log as a block of its own, right after its last intact block
+static int log_append_block(const char *name, const char *idx_name, uint32_t *count, int n)
+{
+  int ok;
+  FILE *fp = fopen( name, "r+" );
+  FILE *ip = fopen( idx_name, "a" );
+  if (fp == NULL)
+  {
+    printf("log_append_block -- failed to open %s\n", name);
+    if (ip != NULL) fclose(ip);
+    return 0;
+  }
+  fseek( fp, sizeof(log_file_header) + *count * LOG_BLOCK_SIZE, SEEK_SET );
+  ok = log_write_block( fp, ip, log_block_buf, n, count );
+  fclose(fp);
+  if (ip != NULL) fclose(ip);
+  return ok;
+}
+
+// move the flash ring onto the card, oldest entry first, each into its run's file. caller
+// holds write_lock. 1 once the ring is empty, 0 if the card gave up
+static int stage_migrate()
+{
+  data_point *recs = (data_point *) ( log_block_buf + sizeof(log_block_header) );
+  stage_entry_header hdr;
+  char *name, *idx_name;
+  uint32_t *count;
+  int got, ok, done = 0;
+
+  trace_begin( TRACE_stage_migrate, 0 );
+  for ( ;; )
+  {
+    xSemaphoreTake( stage_lock, portMAX_DELAY );
+    got = stage_peek( &stage, &hdr );
+    if ( got < 0 ) {
+      stage_pop( &stage, 0, 0 );
+    }
+    xSemaphoreGive( stage_lock );
+    if ( got == 0 ) {
+      done = 1;
+      break;
+    }
+    if ( got < 0 ) {
+      continue;
+    }
+
+    // the target first: reopening a log walks its blocks through log_block_buf
+    if ( !stage_target_for( &hdr, &name, &idx_name, &count ) ) {
+      break;
+    }
+    xSemaphoreTake( stage_lock, portMAX_DELAY );
+    ok = stage_read( &stage, &hdr, recs );
+    xSemaphoreGive( stage_lock );
+
+    if ( ok && ( hdr.kind == STAGE_RECORDS ) && !log_append_block( name, idx_name, count, hdr.n ) ) {
+      break;
+    }
+    if ( ok && ( hdr.kind == STAGE_CLOSE ) ) {
+      log_write_index( name, idx_name );
+    }
+
+    xSemaphoreTake( stage_lock, portMAX_DELAY );
+    stage_pop( &stage, ok, hdr.n );
+    xSemaphoreGive( stage_lock );
+  }
+  trace_end( TRACE_stage_migrate, 0 );
+  return done;
+}
+
+// a queue onto the card in order: straight there while the flash ring is empty, else in
+// behind the records staged before it and the ring moved over. caller holds write_lock.
+// 1 once all of it is on the card
+static int log_write_ordered(xQueueHandle lq, int num)
+{
+  if ( ( !stage_ok || ( stage_pending() == 0 ) ) && log_write_queue( lq ) ) {
+    return 1;
+  }
+  if ( !stage_ok ) {
+    return 0;
+  }
+  xSemaphoreTake( stage_lock, portMAX_DELAY );
+  stage_write_queue( lq, num );
+  xSemaphoreGive( stage_lock );
+  return stage_migrate();
+}
+
+// last queue of the open log, then its index. with no card, or a card that gave up, the
+// rest of the file and its close wait in the flash ring. caller holds write_lock
+static void log_finish_file(xQueueHandle lq, int num)
+{
+  if ( ( sd_card != NULL ) && log_write_ordered( lq, num ) )
+  {
+    log_write_index( filename, idx_filename );
+    return;
+  }
+  if ( stage_ok )
+  {
+    xSemaphoreTake( stage_lock, portMAX_DELAY );
+    stage_write_queue( lq, num );
+    stage_write_close( num );
+    xSemaphoreGive( stage_lock );
+  }
+}
+
+static void write_logging_queue_to_sd(void *arg)
+{
+  if( ( sd_card == NULL ) || ( xSemaphoreTake( write_lock, ( TickType_t ) 1 ) == pdFALSE ) )
+  {
+    // no card, or the writer of the last queue still on it: the flash ring takes this one
+    if ( stage_ok )
+    {
+      xSemaphoreTake( stage_lock, portMAX_DELAY );
+      trace_mark( TRACE_sd_busy, uxQueueMessagesWaiting( (xQueueHandle) arg ) );
+      stage_write_queue( (xQueueHandle) arg, file_num );
+      xSemaphoreGive( stage_lock );
+      printf("write_logging_queue_to_sd -- card busy, queue staged in flash\n");
+    }
+    else
+    {
+      trace_mark( TRACE_sd_busy, uxQueueMessagesWaiting( (xQueueHandle) arg ) );
+      printf("write_logging_queue_to_sd -- task overlap, skipping queue\n");
+    }
+    mem_note_stack( MEM_TASK_WRITER );
+    vTaskDelete(NULL);
+  }
+
+  trace_begin( TRACE_sd_write, uxQueueMessagesWaiting( (xQueueHandle) arg ) );
+  log_write_ordered( (xQueueHandle) arg, file_num );
+  trace_end( TRACE_sd_write, 0 );
   printf("write_logging_queue_to_sd -- writing done\n");
-  free(buff);
 
   // per FreeRTOS, tasks MUST be deleted before breaking out of its implementing funciton
   //also release mutex
   xSemaphoreGive ( write_lock );
+  mem_note_stack( MEM_TASK_WRITER );
   vTaskDelete(NULL);
 }
 
+// last write of a run, from daq_task once the loop is done: waits out any writer still
+// running, then closes the log with its index. returns with the file complete on the card,
+// or its remainder in the flash ring
+void log_close_run(xQueueHandle lq)
+{
+  xSemaphoreTake( write_lock, portMAX_DELAY );
+
+  trace_begin( TRACE_sd_close, file_num );
+  log_finish_file( lq, file_num );
+  trace_end( TRACE_sd_close, file_num );
+  printf("log_close_run -- writing done\n");
+
+  xSemaphoreGive ( write_lock );
+
+  // between runs the entries already on the card are erased for the next one
+  if ( stage_ok )
+  {
+    stage_print( &stage );
+    stage_idle = 1;
+    xTaskNotifyGive( stage_task_handle );
+  }
+}
+
+// background upkeep of the flash ring: between runs it erases the entries already on the
+// card, one at a time, so a run that starts meanwhile waits out at most one erase
+static void stage_task(void *arg)
+{
+  int n;
+
+  for ( ;; )
+  {
+    do
+    {
+      xSemaphoreTake( stage_lock, portMAX_DELAY );
+      n = stage_idle ? stage_erase( &stage, 1 ) : 0;
+      xSemaphoreGive( stage_lock );
+    } while ( n > 0 );
+    mem_note_stack( MEM_TASK_STAGE );
+    ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+  }
+}
+
 void init_sd()
 {
   // printf("init_sd -- configuring SD storage\n");
@@ -121,10 +607,10 @@ void init_sd()
     .max_files = 5
   };
 
-  sdmmc_card_t* card;
-  esp_err_t ret = esp_vfs_fat_sdmmc_mount("/sdcard", &host, &slot_config, &mount_config, &card);
+  esp_err_t ret = esp_vfs_fat_sdmmc_mount("/sdcard", &host, &slot_config, &mount_config, &sd_card);
   if ( ret != ESP_OK )
   {
+    sd_card = NULL;
     if ( ret == ESP_FAIL ) {
       printf("init_sd -- failed to mount filesystem\n");
     }
@@ -133,31 +619,111 @@ void init_sd()
     }
   }
 
-  sdmmc_card_print_info(stdout, card);
-
-  //create mutex
+  //create mutexes
   write_lock = xSemaphoreCreateMutex();
+  stage_lock = xSemaphoreCreateMutex();
+  stage_target.num = -1;
 
-  FILE *fp;
-  // fp = fopen("/sdcard/data.csv", "a");
-  // memset(filename,0,strlen(filename));
-  printf("Enter output file num.\n");
-  while ( !file_num ) {
-    scanf( "%d", &file_num);
-  }
-  filename[13] = file_num + '0';
-  printf("output filename: %s\n",filename);
-  fp = fopen( filename, "a");
-  if (fp == NULL)
+  //whatever earlier runs left in the flash ring goes to the card before a new run takes a
+  //file number, then any run cut short by a power loss is salvaged
+  stage_ok = stage_init( &stage );
+  if ( sd_card != NULL )
   {
-    printf("init_sd -- failed to create file\n");
-    fclose(fp);
-    return;
+    if ( stage_ok && ( stage.pending > 0 ) )
+    {
+      printf("init_sd -- moving %u staged entries to the card\n", (unsigned) stage.pending);
+      stage_migrate();
+      stage_print( &stage );
+    }
+    log_recover_all();
+  }
+  if ( stage_ok ) {
+    xTaskCreatePinnedToCore( stage_task, "stage", 3072, NULL, tskIDLE_PRIORITY + 1, &stage_task_handle, 1 );
   }
-  fclose(fp);
 
+  if ( sd_card == NULL )
+  {
+    printf("init_sd -- no SD card, runs %s\n", stage_ok ? "are staged in flash" : "are not logged");
+    return;
+  }
   printf("init_sd -- configuring SD success\n");
+}
+
+// open the next free data_N.bin with its header and a fresh block index. waits for the
+// writers of the previous run to close its file first. with no card the run goes to the
+// flash ring and is given its file when it is moved to a card
+int log_open_run()
+{
+  int ok = 0;
+
+  xSemaphoreTake( write_lock, portMAX_DELAY );
+  if ( sd_card == NULL )
+  {
+    file_num = 0;
+    log_open_num = 0;
+    snprintf( filename, sizeof(filename), "(flash)" );
+    printf("output: %s\n", stage_ok ? "flash staging ring" : "none");
+  }
+  else
+  {
+    file_num = log_next_file_num();
+    ok = log_switch_file( file_num );
+    printf("output filename: %s\n",filename);
+  }
+  if ( stage_ok )
+  {
+    xSemaphoreTake( stage_lock, portMAX_DELAY );
+    stage_new_run( &stage );
+    stage_idle = 0;
+    xSemaphoreGive( stage_lock );
+  }
+  xSemaphoreGive( write_lock );
+  return ok;
+}
+
+// mid-run file rotation: close the current log with what is left in this queue, then carry
+// on in the next data_N.bin. the other queue fills meanwhile and is written after this
+static void write_rotate_queue_to_sd(void *arg)
+{
+  xQueueHandle lq = (xQueueHandle) arg;
+  int old = file_num, staged = 0;
 
+  trace_begin( TRACE_sd_rotate, old );
+  // every queue from here on belongs to the next file, whichever task ends up writing it
+  if ( stage_ok )
+  {
+    xSemaphoreTake( stage_lock, portMAX_DELAY );
+    if ( ( sd_card == NULL ) || ( stage.pending > 0 ) )
+    {
+      stage_write_queue( lq, old );
+      stage_write_close( old );
+      staged = 1;
+    }
+    file_num = ( sd_card != NULL ) ? old + 1 : 0;
+    stage_new_run( &stage );
+    xSemaphoreGive( stage_lock );
+  }
+
+  xSemaphoreTake( write_lock, portMAX_DELAY );
+  if ( !staged ) {
+    log_finish_file( lq, old );
+  }
+  if ( sd_card != NULL )
+  {
+    if ( !stage_ok ) {
+      file_num = log_next_file_num();
+    }
+    log_switch_file( file_num );
+    printf("output filename: %s\n",filename);
+    if ( stage_ok ) {
+      stage_migrate();
+    }
+  }
+  xSemaphoreGive ( write_lock );
+  trace_end( TRACE_sd_rotate, file_num );
+
+  mem_note_stack( MEM_TASK_WRITER );
+  vTaskDelete(NULL);
 }
 
 #endif // NUBAJA_SD_H_
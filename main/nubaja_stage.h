@@ -0,0 +1,282 @@
+#ifndef NUBAJA_STAGE_H_
+#define NUBAJA_STAGE_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "esp_partition.h"
+#include "nubaja_log_format.h"
+
+/*
+** FLASH STAGING RING - a data partition of the internal SPI flash ("stage" in partitions.csv)
+that takes the logging queues the SD card can't: no card at boot, or the writer of the other
+queue still stuck on the card. the partition is cut into STAGE_ENTRY_SIZE entries, each a
+stage_entry_header and up to STAGE_SLOTS log records, written in order round the ring, so
+every sector is erased once a lap and they all wear the same. the records go in first and
+the header last, and a pending entry's state word stays erased until the entry is on the
+card, when it is cleared in place. stage_init rebuilds the ring from the headers after a
+reset, so staged records outlive a power loss.
+
+erasing a sector stalls the flash cache, and every task with it, for tens of ms. a run only
+writes to entries erased beforehand (clean) and stage_erase is called between runs, so the
+records a run can stage are the clean entries it starts with. plain C on the esp_partition
+api; host/sim/esp_partition.h emulates a partition in a file.
+*/
+
+#define STAGE_PARTITION_LABEL "stage"
+#define STAGE_SECTOR          4096
+#define STAGE_ENTRY_SIZE      ( 2 * STAGE_SECTOR )
+#define STAGE_MAGIC           0x4753424e  // "NBSG"
+#define STAGE_PENDING         0xffffffff  // entry state, as erased
+#define STAGE_DONE            0x00000000  // on the card, the entry can be erased
+
+// entry kinds
+#define STAGE_RECORDS         1           // log records of a run
+#define STAGE_CLOSE           2           // the run is over, its log is closed once this is reached
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t seq;           // entries ever staged, orders the ring
+  uint32_t run;           // seq of the run's first entry
+  uint16_t file_num;      // data_N.bin of the run, 0 = no card when the run started
+  uint16_t kind;
+  uint16_t n;             // records that follow
+  uint16_t reserved;
+  uint32_t crc;           // crc32 of the records, then of the header with crc 0 and state erased
+  uint32_t state;         // STAGE_PENDING until the entry is on the card
+} stage_entry_header;
+
+#define STAGE_SLOTS           ( ( STAGE_ENTRY_SIZE - sizeof(stage_entry_header) ) / LOG_RECORD_SIZE )
+
+_Static_assert( STAGE_SLOTS <= LOG_BLOCK_SAMPLES, "a staged entry must fit in one log block" );
+
+typedef struct
+{
+  const esp_partition_t *part;
+  uint32_t n_entries;     // entries in the partition
+  uint32_t head;          // next entry to write
+  uint32_t tail;          // oldest pending entry
+  uint32_t pending;       // entries from tail on not yet on the card
+  uint32_t clean;         // erased entries from head on
+  uint32_t seq;           // seq of the next entry
+  uint32_t run;           // of the run being staged, 0 = nothing staged for it yet
+  stage_entry_header wr;  // entry being written
+  uint32_t wr_crc;
+  uint32_t staged, migrated, refused, lost, erased;     // records, records, records, entries, entries
+} stage_t;
+
+static uint32_t stage_addr ( const stage_t *st, uint32_t pos )
+{
+  return ( pos % st->n_entries ) * STAGE_ENTRY_SIZE;
+}
+
+// every byte of the entry reads back erased
+static int stage_entry_erased ( const stage_t *st, uint32_t pos )
+{
+  uint32_t buf[64];
+  uint32_t off;
+  int i;
+
+  for ( off = 0; off < STAGE_ENTRY_SIZE; off += sizeof(buf) ) {
+    if ( esp_partition_read( st->part, stage_addr( st, pos ) + off, buf, sizeof(buf) ) != ESP_OK ) {
+      return 0;
+    }
+    for ( i = 0; i < 64; i++ ) {
+      if ( buf[i] != 0xffffffff ) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+static int stage_read_header ( const stage_t *st, uint32_t pos, stage_entry_header *hdr )
+{
+  if ( esp_partition_read( st->part, stage_addr( st, pos ), hdr, sizeof(*hdr) ) != ESP_OK ) {
+    return 0;
+  }
+  return ( hdr->magic == STAGE_MAGIC ) & ( hdr->n <= STAGE_SLOTS );
+}
+
+// find the partition and rebuild the ring from the entry headers. 0 if there is no partition
+int stage_init ( stage_t *st )
+{
+  stage_entry_header hdr;
+  uint32_t pos, newest = 0, oldest = 0;
+  int any = 0, any_pending = 0;
+
+  memset( st, 0, sizeof(*st) );
+  st->part = esp_partition_find_first( ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                       STAGE_PARTITION_LABEL );
+  if ( st->part == NULL ) {
+    printf("stage_init -- no %s partition, nothing is staged\n", STAGE_PARTITION_LABEL);
+    return 0;
+  }
+  st->n_entries = st->part->size / STAGE_ENTRY_SIZE;
+
+  // the newest entry sets the head, the oldest pending one the tail
+  for ( pos = 0; pos < st->n_entries; pos++ ) {
+    if ( !stage_read_header( st, pos, &hdr ) ) {
+      continue;
+    }
+    if ( !any || ( (int32_t) ( hdr.seq - st->seq ) > 0 ) ) {
+      st->seq = hdr.seq;
+      newest = pos;
+    }
+    if ( hdr.state == STAGE_PENDING ) {
+      if ( !any_pending || ( (int32_t) ( hdr.seq - oldest ) < 0 ) ) {
+        oldest = hdr.seq;
+        st->tail = pos;
+      }
+      any_pending = 1;
+    }
+    any = 1;
+  }
+  st->head = any ? ( newest + 1 ) % st->n_entries : 0;
+  st->seq = any ? st->seq + 1 : 1;
+  if ( any_pending ) {
+    st->pending = ( st->head + st->n_entries - st->tail ) % st->n_entries;
+    if ( st->pending == 0 ) {
+      st->pending = st->n_entries;
+    }
+  }
+  else {
+    st->tail = st->head;
+  }
+  while ( ( st->pending + st->clean < st->n_entries ) && stage_entry_erased( st, st->head + st->clean ) ) {
+    ++st->clean;
+  }
+
+  printf("stage_init -- %u entries of %u records, %u pending, %u clean\n",
+         (unsigned) st->n_entries, (unsigned) STAGE_SLOTS, (unsigned) st->pending, (unsigned) st->clean);
+  return 1;
+}
+
+// a new run: its first entry starts a new run number
+void stage_new_run ( stage_t *st )
+{
+  st->run = 0;
+}
+
+// open an entry at the head. 0 when no clean entry is left
+int stage_begin ( stage_t *st, int file_num )
+{
+  if ( st->clean == 0 ) {
+    return 0;
+  }
+  if ( st->run == 0 ) {
+    st->run = st->seq;
+  }
+  memset( &st->wr, 0, sizeof(st->wr) );
+  st->wr.magic = STAGE_MAGIC;
+  st->wr.seq = st->seq;
+  st->wr.run = st->run;
+  st->wr.file_num = file_num;
+  st->wr.state = STAGE_PENDING;
+  st->wr_crc = 0;
+  return 1;
+}
+
+// room left in the open entry
+static inline int stage_room ( const stage_t *st )
+{
+  return STAGE_SLOTS - st->wr.n;
+}
+
+// append up to n records to the open entry, returns how many went in
+int stage_add ( stage_t *st, const data_point *recs, int n )
+{
+  uint32_t addr = stage_addr( st, st->head ) + sizeof(stage_entry_header) + st->wr.n * LOG_RECORD_SIZE;
+
+  if ( n > stage_room( st ) ) {
+    n = stage_room( st );
+  }
+  esp_partition_write( st->part, addr, recs, n * LOG_RECORD_SIZE );
+  st->wr_crc = log_crc32( st->wr_crc, recs, n * LOG_RECORD_SIZE );
+  st->wr.n += n;
+  st->staged += n;
+  return n;
+}
+
+// seal the open entry with its header, it is then pending
+void stage_end ( stage_t *st, int kind )
+{
+  stage_entry_header hdr = st->wr;
+
+  hdr.kind = kind;
+  hdr.crc = 0;
+  hdr.crc = log_crc32( st->wr_crc, &hdr, sizeof(hdr) );
+  esp_partition_write( st->part, stage_addr( st, st->head ), &hdr, sizeof(hdr) );
+  st->head = ( st->head + 1 ) % st->n_entries;
+  --st->clean;
+  ++st->pending;
+  ++st->seq;
+}
+
+// header of the oldest pending entry. 1 ok, 0 ring empty, -1 torn or corrupt (pop it)
+int stage_peek ( const stage_t *st, stage_entry_header *hdr )
+{
+  if ( st->pending == 0 ) {
+    return 0;
+  }
+  return stage_read_header( st, st->tail, hdr ) ? 1 : -1;
+}
+
+// its records, 0 if they don't match the crc
+int stage_read ( const stage_t *st, const stage_entry_header *hdr, data_point *recs )
+{
+  stage_entry_header h = *hdr;
+
+  if ( esp_partition_read( st->part, stage_addr( st, st->tail ) + sizeof(h), recs,
+                           h.n * LOG_RECORD_SIZE ) != ESP_OK ) {
+    return 0;
+  }
+  h.crc = 0;
+  h.state = STAGE_PENDING;
+  return log_crc32( log_crc32( 0, recs, h.n * LOG_RECORD_SIZE ), &h, sizeof(h) ) == hdr->crc;
+}
+
+// the oldest entry is on the card (or unreadable): mark it done in place
+void stage_pop ( stage_t *st, int ok, int n )
+{
+  uint32_t done = STAGE_DONE;
+
+  esp_partition_write( st->part, stage_addr( st, st->tail ) + offsetof(stage_entry_header, state),
+                       &done, sizeof(done) );
+  st->tail = ( st->tail + 1 ) % st->n_entries;
+  --st->pending;
+  if ( ok ) {
+    st->migrated += n;
+  }
+  else {
+    ++st->lost;
+  }
+}
+
+// erase up to max entries that are already on the card, next in line after the clean ones.
+// returns how many were erased. between runs only, see above
+int stage_erase ( stage_t *st, int max )
+{
+  int n = 0;
+
+  while ( ( n < max ) && ( st->pending + st->clean < st->n_entries ) ) {
+    if ( esp_partition_erase_range( st->part, stage_addr( st, st->head + st->clean ), STAGE_ENTRY_SIZE ) != ESP_OK ) {
+      break;
+    }
+    ++st->clean;
+    ++st->erased;
+    ++n;
+  }
+  return n;
+}
+
+void stage_print ( const stage_t *st )
+{
+  printf("stage -- %u records staged, %u moved to the card, %u refused (ring full), %u entries unreadable, "
+         "%u pending, %u of %u entries clean\n",
+         (unsigned) st->staged, (unsigned) st->migrated, (unsigned) st->refused, (unsigned) st->lost,
+         (unsigned) st->pending, (unsigned) st->clean, (unsigned) st->n_entries);
+}
+
+#endif // NUBAJA_STAGE_H_
@@ -0,0 +1,153 @@
+#ifndef NUBAJA_STATS_H_
+#define NUBAJA_STATS_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "nubaja_proj_vars.h"
+#include "nubaja_log_format.h"
+#include "nubaja_ctrl.h"
+
+/*
+** RUN STATISTICS - kept up to date one sample at a time by daq_task, for every log channel:
+running mean and variance (Welford), min and max with the index and time they happened,
+and a STATS_BINS bin histogram over 0..stats_hist_max. stats_print writes the summary as
+text, to the serial port (stdout) or to data_N.sum at the end of the run, so a run can be
+triaged without pulling the raw log.
+*/
+
+#define STATS_BINS            16
+
+typedef struct
+{
+  float mean;
+  float m2;                     // sum of squared differences from the mean
+  uint16_t min, max;
+  uint32_t min_idx, max_idx;
+  uint32_t min_time_us, max_time_us;
+  uint32_t hist[STATS_BINS];
+} ch_stats_t;
+
+typedef struct
+{
+  uint32_t n;
+  uint32_t first_idx, last_idx;
+  uint32_t first_time_us, last_time_us;
+  ch_stats_t ch[LOG_NUM_CH];
+} run_stats_t;
+
+// histogram top end per log channel, from its LOG_FIELDS info
+#define STATS_FIELD_HIST_MAX(type, name, kind, fmt, info)  LOG_IF_##kind( LOG_INFO_HIST_MAX info, )
+static const uint16_t stats_hist_max[LOG_NUM_CH] = { LOG_FIELDS(STATS_FIELD_HIST_MAX) };
+
+// raw to physical units, scale * volts + offset for the adc channels, as in ctrl_update
+typedef struct
+{
+  int volts;                    // 1 = convert counts to volts first
+  float scale, offset;
+  const char *unit;
+} ch_phys_t;
+
+#define STATS_FIELD_PHYS(type, name, kind, fmt, info)      LOG_IF_##kind( LOG_INFO_PHYS info, )
+static const ch_phys_t stats_phys[LOG_NUM_CH] = { LOG_FIELDS(STATS_FIELD_PHYS) };
+
+static float stats_to_phys ( int ch, float raw )
+{
+  const ch_phys_t *p = &stats_phys[ch];
+  float x = p->volts ? ( raw / 4096 ) * (float) ADC_FS : raw;
+  return p->scale * x + p->offset;
+}
+
+void stats_reset ( run_stats_t *st )
+{
+  memset( st, 0, sizeof(*st) );
+}
+
+void stats_update ( run_stats_t *st, const data_point *dp )
+{
+  int ch, bin;
+  uint16_t v;
+  float delta;
+
+  if ( st->n == 0 ) {
+    st->first_idx = dp->idx;
+    st->first_time_us = dp->time_us;
+  }
+  ++st->n;
+  st->last_idx = dp->idx;
+  st->last_time_us = dp->time_us;
+
+  for ( ch = 0; ch < LOG_NUM_CH; ch++ ) {
+    ch_stats_t *c = &st->ch[ch];
+    v = log_ch_value( dp, ch );
+
+    delta = v - c->mean;
+    c->mean += delta / st->n;
+    c->m2 += delta * ( v - c->mean );
+
+    if ( ( st->n == 1 ) | ( v < c->min ) ) {
+      c->min = v;
+      c->min_idx = dp->idx;
+      c->min_time_us = dp->time_us;
+    }
+    if ( ( st->n == 1 ) | ( v > c->max ) ) {
+      c->max = v;
+      c->max_idx = dp->idx;
+      c->max_time_us = dp->time_us;
+    }
+
+    bin = (int) v * STATS_BINS / stats_hist_max[ch];
+    c->hist[ ( bin < STATS_BINS ) ? bin : STATS_BINS - 1 ]++;
+  }
+}
+
+// times are printed in seconds from the first sample of the run
+void stats_print ( FILE *fp, const char *name, const run_stats_t *st )
+{
+  int ch, b;
+  float sd;
+
+  fprintf(fp, "%s: %u samples, idx %u-%u, %.3f s\n", name, (unsigned) st->n,
+          (unsigned) st->first_idx, (unsigned) st->last_idx,
+          ( st->last_time_us - st->first_time_us ) / 1e6);
+  if ( st->n == 0 ) {
+    return;
+  }
+
+  fprintf(fp, "%-10s %8s %8s %6s %7s %8s %6s %7s %8s | %9s %9s %9s\n", "channel", "mean", "std",
+          "min", "@idx", "@s", "max", "@idx", "@s", "phys min", "phys mean", "phys max");
+  for ( ch = 0; ch < LOG_NUM_CH; ch++ ) {
+    const ch_stats_t *c = &st->ch[ch];
+    sd = ( st->n > 1 ) ? sqrtf( c->m2 / ( st->n - 1 ) ) : 0;
+    fprintf(fp, "%-10s %8.1f %8.1f %6u %7u %8.3f %6u %7u %8.3f | %9.2f %9.2f %9.2f %s\n",
+            log_ch_name[ch], c->mean, sd,
+            c->min, (unsigned) c->min_idx, ( c->min_time_us - st->first_time_us ) / 1e6,
+            c->max, (unsigned) c->max_idx, ( c->max_time_us - st->first_time_us ) / 1e6,
+            stats_to_phys( ch, c->min ), stats_to_phys( ch, c->mean ), stats_to_phys( ch, c->max ),
+            stats_phys[ch].unit);
+  }
+
+  fprintf(fp, "histograms, %d bins from 0 to the channel max\n", STATS_BINS);
+  for ( ch = 0; ch < LOG_NUM_CH; ch++ ) {
+    fprintf(fp, "%-10s %5u:", log_ch_name[ch], stats_hist_max[ch]);
+    for ( b = 0; b < STATS_BINS; b++ ) {
+      fprintf(fp, " %u", (unsigned) st->ch[ch].hist[b]);
+    }
+    fprintf(fp, "\n");
+  }
+}
+
+// write the summary next to the log, e.g. /sdcard/data_3.sum
+int stats_write ( const char *path, const char *name, const run_stats_t *st )
+{
+  FILE *fp = fopen( path, "w" );
+  if ( fp == NULL ) {
+    printf("stats_write -- failed to open %s\n", path);
+    return 0;
+  }
+  stats_print( fp, name, st );
+  fclose( fp );
+  return 1;
+}
+
+#endif // NUBAJA_STATS_H_
@@ -0,0 +1,198 @@
+#ifndef NUBAJA_TRACE_H_
+#define NUBAJA_TRACE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "xtensa/core-macros.h"
+#include "nubaja_log_format.h"
+
+/*
+** TIMELINE TRACE - a flight recorder for contention between daq_task, the writer tasks, the
+ISRs and the I2C and SD traffic. with trace_events in the boot config, each run records
+begin / end / mark events (TRACE_EVENTS in nubaja_log_format.h) into a ring of that many
+events, and run_end writes what the ring holds to data_N.trc. host/trace_json turns it into
+Chrome / Perfetto JSON.
+
+recording takes no lock, so it works the same from any task, ISR or core: an event reserves
+its slot with an atomic add on head and writes it, the ring keeps the last trace_events
+events. a stamp is the CCOUNT of the core, a register read, so a trace point costs well
+under a microsecond. each core re-anchors its count to esp_timer time at least every
+TRACE_SYNC_US and every quarter ring (see the file format). with trace_freeze the ring stops half a ring after the
+first late or overrun tick, so that tick sits in the middle of what is kept. events of a
+core that is interrupted between reserving a slot and writing it may land a few cycles out
+of order; the converter sorts by time.
+*/
+
+#define TRACE_SYNC_US         500000         // longest a core goes without a sync pair
+#define TRACE_MIN_EVENTS      256
+#define TRACE_CPU_MHZ         CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ
+
+typedef struct
+{
+  trace_event *volatile ring;      // NULL while not recording
+  trace_event *buf;                // the ring, kept for trace_write after trace_stop
+  uint32_t mask;                   // events in the ring - 1
+  volatile uint32_t head;          // events reserved, next one goes to ring[head & mask]
+  volatile uint32_t stop;          // events from this one on are not kept, UINT32_MAX = never
+  volatile uint32_t freeze_at;     // event the freeze is centred on
+  uint32_t sync_cycles[portNUM_PROCESSORS];
+  uint32_t sync_head[portNUM_PROCESSORS];
+  int synced[portNUM_PROCESSORS];              // each written by its own core only
+  int freeze;                      // freeze around the first trace_trigger
+} trace_t;
+
+trace_t trace;
+
+static inline void IRAM_ATTR trace_store ( trace_event *ring, uint32_t idx, uint32_t cycles, int id, int flags,
+                                           uint16_t arg )
+{
+  trace_event *e;
+
+  if ( idx >= trace.stop ) {
+    return;
+  }
+  e = &ring[idx & trace.mask];
+  e->cycles = cycles;
+  e->id = id;
+  e->flags = flags;
+  e->arg = arg;
+}
+
+static void IRAM_ATTR trace_put ( int id, int phase, uint16_t arg )
+{
+  trace_event *ring = trace.ring;
+  uint32_t cycles, idx, core, flags;
+
+  if ( ring == NULL ) {
+    return;
+  }
+  core = xPortGetCoreID();
+  flags = core ? TRACE_CORE_BIT : 0;
+  cycles = XTHAL_GET_CCOUNT();
+
+  // a sync pair ahead of the event when this core has gone too long without one, in time or
+  // in events, so whatever part of the ring is kept holds one
+  if ( !trace.synced[core] || ( cycles - trace.sync_cycles[core] > TRACE_SYNC_US * TRACE_CPU_MHZ ) ||
+       ( trace.head - trace.sync_head[core] > ( trace.mask + 1 ) / 4 ) ) {
+    trace.synced[core] = 1;
+    trace.sync_cycles[core] = cycles;
+    idx = __atomic_fetch_add( &trace.head, 2, __ATOMIC_RELAXED );
+    trace.sync_head[core] = idx;
+    trace_store( ring, idx, cycles, TRACE_sync, flags | TRACE_MARK, 0 );
+    trace_store( ring, idx + 1, (uint32_t) esp_timer_get_time(), TRACE_sync_time, flags | TRACE_MARK, 0 );
+  }
+
+  idx = __atomic_fetch_add( &trace.head, 1, __ATOMIC_RELAXED );
+  trace_store( ring, idx, cycles, id, flags | phase, arg );
+}
+
+static inline void IRAM_ATTR trace_begin ( int id, uint16_t arg )
+{
+  trace_put( id, TRACE_BEGIN, arg );
+}
+
+static inline void IRAM_ATTR trace_end ( int id, uint16_t arg )
+{
+  trace_put( id, TRACE_END, arg );
+}
+
+static inline void IRAM_ATTR trace_mark ( int id, uint16_t arg )
+{
+  trace_put( id, TRACE_MARK, arg );
+}
+
+// a late or overrun tick. with trace_freeze the first one is kept half a ring either side
+void trace_trigger ()
+{
+  if ( ( trace.ring == NULL ) || !trace.freeze || ( trace.stop != UINT32_MAX ) ) {
+    return;
+  }
+  trace.freeze_at = trace.head;
+  trace.stop = trace.head + ( trace.mask + 1 ) / 2;
+}
+
+// start of a run: n_events rounded down to a power of two, 0 = off
+void trace_start ( int n_events, int freeze )
+{
+  uint32_t n = TRACE_MIN_EVENTS;
+
+  if ( n_events <= 0 ) {
+    return;
+  }
+  while ( n * 2 <= (uint32_t) n_events ) {
+    n *= 2;
+  }
+  trace.buf = (trace_event *) calloc( n, sizeof(trace_event) );
+  if ( trace.buf == NULL ) {
+    printf("trace_start -- no room for %u events, not tracing\n", (unsigned) n);
+    return;
+  }
+  trace.mask = n - 1;
+  trace.head = 0;
+  trace.stop = UINT32_MAX;
+  trace.freeze_at = UINT32_MAX;
+  trace.freeze = freeze;
+  memset( trace.synced, 0, sizeof(trace.synced) );
+  trace.ring = trace.buf;
+  printf("trace_start -- %u events, %u bytes%s\n", (unsigned) n, (unsigned) ( n * sizeof(trace_event) ),
+         freeze ? ", frozen around the first late tick" : "");
+}
+
+// end of run: no more events, the ring is kept for trace_write
+void trace_stop ()
+{
+  if ( trace.ring == NULL ) {
+    return;
+  }
+  trace.ring = NULL;
+  vTaskDelay( 1 ); //let an event already past the check finish its write
+}
+
+// the ring to a .trc file, oldest event first, then it is freed
+void trace_write ( const char *name )
+{
+  trace_file_header th;
+  uint32_t end, first, i;
+  FILE *fp;
+
+  if ( trace.buf == NULL ) {
+    return;
+  }
+  end = ( trace.head < trace.stop ) ? trace.head : trace.stop;
+  first = ( end > trace.mask + 1 ) ? end - ( trace.mask + 1 ) : 0;
+
+  trace_file_header_init( &th, TRACE_CPU_MHZ );
+  th.recorded = trace.head;
+  for ( i = first; i < end; i++ ) {
+    th.n_events += ( trace.buf[i & trace.mask].id != TRACE_none );
+  }
+  if ( ( trace.freeze_at != UINT32_MAX ) && ( trace.freeze_at >= first ) ) {
+    th.freeze_at = trace.freeze_at - first;
+  }
+
+  fp = fopen( name, "w" );
+  if ( fp == NULL ) {
+    printf("trace_write -- failed to open %s\n", name);
+  }
+  else {
+    fwrite( &th, sizeof(th), 1, fp );
+    for ( i = first; i < end; i++ ) {
+      if ( trace.buf[i & trace.mask].id != TRACE_none ) {
+        fwrite( &trace.buf[i & trace.mask], sizeof(trace_event), 1, fp );
+      }
+    }
+    fclose(fp);
+    printf("trace -- %u of %u events written to %s%s\n", (unsigned) th.n_events, (unsigned) th.recorded, name,
+           ( th.freeze_at != UINT32_MAX ) ? ", frozen around a late tick" : "");
+  }
+  free( trace.buf );
+  trace.buf = NULL;
+}
+
+#endif // NUBAJA_TRACE_H_
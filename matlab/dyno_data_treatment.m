@@ -25,38 +25,22 @@ tps_offset = 0;
 
 %parse data from files
 %each quantity has its own column
-dp = csvread(filename); %contains all columns 
+[dp, hdr, col] = read_log(filename); %contains all columns, see read_log.m
 num_rows = size(dp,1); %depends on test
-num_cols = size(dp,2); %should be 12
-
-%populate data points
-prim_rpm = zeros(num_rows,1);
-sec_rpm = zeros(num_rows,1);        
-torque = zeros(num_rows,1);
-temp3 = zeros(num_rows,1);       
-belt_temp = zeros(num_rows,1);      
-temp2 = zeros(num_rows,1);
-i_brake = zeros(num_rows,1);     
-temp1 = zeros(num_rows,1);          
-load_cell = zeros(num_rows,1); 
-tps = zeros(num_rows,1);         
-i_sp = zeros(num_rows,1);           
-tps_sp = zeros(num_rows,1);
 
-for i = 1:num_rows
-    prim_rpm(i,1) = dp(i,1);
-    sec_rpm(i,1) = dp(i,2);
-    torque(i,1) = dp(i,3);
-    temp3(i,1) = dp(i,4);
-    belt_temp(i,1) = dp(i,5);
-    temp2(i,1) = dp(i,6);
-    i_brake(i,1) = dp(i,7);
-    temp1(i,1) = dp(i,8);
-    load_cell(i,1) = dp(i,9);
-    tps(i,1) = dp(i,10);
-    i_sp(i,1) = dp(i,11);
-    tps_sp(i,1) = dp(i,12);
-end
+%populate data points, by name so the columns can't slip
+prim_rpm = dp(:,col.prim_rpm);
+sec_rpm = dp(:,col.sec_rpm);
+torque = dp(:,col.torque);
+temp3 = dp(:,col.temp3);
+belt_temp = dp(:,col.belt_temp);
+temp2 = dp(:,col.temp2);
+i_brake = dp(:,col.i_brake);
+temp1 = dp(:,col.temp1);
+load_cell = dp(:,col.load_cell);
+tps = dp(:,col.tps);
+i_sp = dp(:,col.i_sp);
+tps_sp = dp(:,col.tps_sp);
 
 %analog value conversions
 for i = 1:num_rows
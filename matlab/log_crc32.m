@@ -0,0 +1,25 @@
+function [ crc ] = log_crc32( bytes )
+%standard (ieee 802.3) crc32 of a byte vector, matches log_crc32 in nubaja_log_format.h
+persistent table
+if isempty(table)
+    table = zeros(256, 1, 'uint32');
+    for i = 0:255
+        c = uint32(i);
+        for j = 1:8
+            if bitand(c, 1)
+                c = bitxor(bitshift(c, -1), uint32(hex2dec('edb88320')));
+            else
+                c = bitshift(c, -1);
+            end
+        end
+        table(i+1) = c;
+    end
+end
+
+crc = uint32(hex2dec('ffffffff'));
+bytes = uint32(bytes(:));
+for k = 1:length(bytes)
+    crc = bitxor(table(bitand(bitxor(crc, bytes(k)), 255) + 1), bitshift(crc, -8));
+end
+crc = double(bitxor(crc, uint32(hex2dec('ffffffff'))));
+end
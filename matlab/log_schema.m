@@ -0,0 +1,25 @@
+function [ s, record_size, fast_size ] = log_schema()
+%record layout of data_N.bin, generated by host/log_dump -m from LOG_FIELDS
+%in main/nubaja_log_format.h - do not edit, regenerate.
+%   s(k) has name, type (matlab class), kind (META / CH / SP), offset (bytes) and
+%   fast, its offset in a packed fast sample of fast_size bytes (-1 = not packed)
+f = {
+    'idx', 'uint32', 'META', 0, 0;
+    'time_us', 'uint32', 'META', 4, 4;
+    'prim_rpm', 'uint16', 'CH', 8, 8;
+    'sec_rpm', 'uint16', 'CH', 10, 10;
+    'torque', 'uint16', 'CH', 12, 12;
+    'temp3', 'uint16', 'CH', 14, -1;
+    'belt_temp', 'uint16', 'CH', 16, -1;
+    'temp2', 'uint16', 'CH', 18, -1;
+    'i_brake', 'uint16', 'CH', 20, 14;
+    'temp1', 'uint16', 'CH', 22, -1;
+    'load_cell', 'uint16', 'CH', 24, 16;
+    'tps', 'uint16', 'CH', 26, -1;
+    'i_sp', 'single', 'SP', 28, -1;
+    'tps_sp', 'single', 'SP', 32, -1;
+    };
+s = cell2struct(f, {'name', 'type', 'kind', 'offset', 'fast'}, 2);
+record_size = 36;
+fast_size = 18;
+end
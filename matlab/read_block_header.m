@@ -0,0 +1,13 @@
+function [ bh ] = read_block_header( fid, hdr )
+%reads one block header at the current file position, see log_block_header
+bh.magic = fread(fid, 1, 'uint32');
+bh.seq = fread(fid, 1, 'uint32');
+bh.crc = fread(fid, 1, 'uint32');
+bh.first_idx = fread(fid, 1, 'uint32');
+bh.first_time_us = fread(fid, 1, 'uint32');
+bh.n_samples = fread(fid, 1, 'uint16');
+fread(fid, 1, 'uint16'); %reserved
+bh.min = fread(fid, hdr.num_ch, 'uint16')';
+bh.max = fread(fid, hdr.num_ch, 'uint16')';
+bh.mean = fread(fid, hdr.num_ch, 'uint16')';
+end
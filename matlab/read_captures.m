@@ -0,0 +1,66 @@
+function [ w, hdr ] = read_captures( filename )
+%reads every burst capture window from a data_N.cap file
+%   w(k).data is n_samples x 10 in log channel order prim_rpm sec_rpm torque
+%   temp3 belt_temp temp2 i_brake temp1 load_cell tps (raw counts / rpm,
+%   channels not captured are 0). w(k).t is in seconds from the trigger,
+%   which is sample n_pre + 1. cause: 1 launch, 2 fault, 3 trigger input,
+%   4 level crossing. a window that fails its crc ends the read.
+fid = fopen(filename, 'r', 'ieee-le');
+if fid < 0
+    error('read_captures: cannot open %s', filename);
+end
+
+hdr.magic = fread(fid, 1, 'uint32');
+if hdr.magic ~= hex2dec('5041434e')
+    fclose(fid);
+    error('read_captures: %s is not a capture file', filename);
+end
+hdr.version = fread(fid, 1, 'uint16');
+hdr.header_size = fread(fid, 1, 'uint16');
+hdr.window_header_size = fread(fid, 1, 'uint16');
+hdr.sample_size = fread(fid, 1, 'uint16');
+hdr.sample_hz = fread(fid, 1, 'uint32');
+hdr.num_ch = fread(fid, 1, 'uint16');
+fseek(fid, hdr.header_size, 'bof');
+
+w = struct('cause', {}, 'ch_mask', {}, 'trig_idx', {}, 'trig_time_us', {}, ...
+           'n_pre', {}, 't', {}, 'time_us', {}, 'data', {});
+while true
+    wh = fread(fid, hdr.window_header_size, 'uint8=>uint8');
+    if length(wh) < hdr.window_header_size
+        break;
+    end
+    v = double(typecast(wh(1:8), 'uint32'));
+    f = double(typecast(wh(9:24), 'uint16'));
+    if v(1) ~= hex2dec('4e49574e')
+        warning('read_captures: %s bad window header after %d windows', filename, length(w));
+        break;
+    end
+    n = f(7);
+    raw = fread(fid, n * hdr.sample_size, 'uint8=>uint8');
+    if length(raw) < n * hdr.sample_size
+        warning('read_captures: %s torn window after %d windows', filename, length(w));
+        break;
+    end
+    wh(5:8) = 0; %crc is computed with its own field zeroed
+    if log_crc32([wh; raw]) ~= v(2)
+        warning('read_captures: %s bad crc after %d windows', filename, length(w));
+        break;
+    end
+
+    k = length(w) + 1;
+    w(k).cause = f(1);
+    w(k).ch_mask = f(2);
+    w(k).trig_idx = double(typecast(wh(13:16), 'uint32'));
+    w(k).trig_time_us = double(typecast(wh(17:20), 'uint32'));
+    w(k).n_pre = f(8);
+    s = reshape(raw, hdr.sample_size, n);
+    w(k).time_us = double(typecast(reshape(s(1:4,:), [], 1), 'uint32'));
+    w(k).data = double(reshape(typecast(reshape(s(5:end,:), [], 1), 'uint16'), hdr.num_ch, n)');
+    t = w(k).time_us - w(k).trig_time_us;
+    t(t < -2^31) = t(t < -2^31) + 2^32; %timer wrap inside the window
+    t(t > 2^31) = t(t > 2^31) - 2^32;
+    w(k).t = t / 1e6;
+end
+fclose(fid);
+end
@@ -0,0 +1,107 @@
+function [ dp, hdr, col ] = read_log( filename, t_start, t_end )
+%reads samples from a block indexed binary log (data_N.bin)
+%   dp has one row per sample: every CH and SP field of the record in schema
+%   order (prim_rpm sec_rpm torque temp3 belt_temp temp2 i_brake temp1 load_cell
+%   tps i_sp tps_sp), then idx and time (s). col maps field names to columns,
+%   e.g. dp(:, col.belt_temp). the layout comes from log_schema.m. with t_start /
+%   t_end (seconds from the first sample) only the blocks overlapping that window
+%   are decoded. samples logged without their slow channels while the SD card was
+%   behind (packed fast samples) repeat the slow channels of the last full record,
+%   NaN until the first one; logging rate changes are skipped.
+if nargin < 2
+    t_start = -inf;
+end
+if nargin < 3
+    t_end = inf;
+end
+
+[hdr, index] = read_log_index(filename);
+[schema, record_size, fast_size] = log_schema();
+if hdr.record_size ~= record_size
+    error('read_log: %s has %d byte records, log_schema.m says %d - regenerate it with host/log_dump -m', ...
+          filename, hdr.record_size, record_size);
+end
+[order, col] = log_columns(schema);
+t_col = col.time;
+
+fid = fopen(filename, 'r', 'ieee-le');
+
+%pick blocks from the index, a block covers up to the start of the next one
+first_t = index.first_time;
+last_t = [first_t(2:end); inf];
+sel = find(last_t >= t_start & first_t <= t_end);
+
+dp = zeros(0, length(order));
+held = nan(1, length(order));
+for k = sel'
+    fseek(fid, index.offset(k), 'bof');
+    bh = read_block_header(fid, hdr);
+    raw = fread(fid, [hdr.record_size, bh.n_samples], 'uint8=>uint8');
+    [block, held] = decode_slots(raw, schema(order), fast_size, held);
+    %32 bit microsecond timer, unwrapped against the (already unwrapped) block start
+    dt = mod(block(:,t_col) - bh.first_time_us, 2^32);
+    block(:,t_col) = (index.first_time_raw(k) + dt - index.first_time_raw(1)) / 1e6;
+    dp = [dp; block]; %#ok<AGROW>
+end
+fclose(fid);
+
+keep = dp(:,t_col) >= t_start & dp(:,t_col) <= t_end;
+dp = dp(keep,:);
+end
+
+function [ order, col ] = log_columns( schema )
+%data fields first, then the META ones (idx, time_us as time)
+meta = strcmp({schema.kind}, 'META');
+order = [find(~meta), find(meta)];
+col = struct();
+for k = 1:length(order)
+    name = schema(order(k)).name;
+    if strcmp(name, 'time_us')
+        name = 'time';
+    end
+    col.(name) = k;
+end
+end
+
+function [ dp, held ] = decode_slots( raw, fields, fast_size, held )
+%one row per full record, two per packed slot, none for a rate change. the top two
+%bits of idx say which (LOG_SLOT_* in nubaja_log_format.h). held is the last full
+%record, carried from block to block
+tag = bitshift(typecast(reshape(raw(1:4,:), [], 1), 'uint32'), -30);
+full = tag == 0;
+pair = tag == 2;
+rows = cumsum(double(full) + 2 * double(pair));
+if isempty(rows) || rows(end) == 0
+    dp = zeros(0, length(fields));
+    return;
+end
+fast = [fields.fast] >= 0;
+
+dp = nan(rows(end), length(fields));
+dp(rows(full),:) = decode_records(raw(:,full), fields, [fields.offset]);
+a = decode_records(raw(1:fast_size, pair), fields(fast), [fields(fast).fast]);
+b = decode_records(raw(fast_size + (1:fast_size), pair), fields(fast), [fields(fast).fast]);
+idx = strcmp({fields(fast).name}, 'idx');
+a(:,idx) = mod(a(:,idx), 2^30);
+dp(rows(pair) - 1, fast) = a;
+dp(rows(pair), fast) = b;
+
+%slow channels of packed samples from the last full record at or before them
+src = zeros(rows(end), 1);
+src(rows(full)) = rows(full);
+src = cummax(src);
+ext = [held; dp];
+dp(:,~fast) = ext(src + 1, ~fast);
+held = ext(src(end) + 1, :);
+end
+
+function [ dp ] = decode_records( raw, fields, offsets )
+%raw is bytes x n, one column per record; each field read at its offset
+dp = zeros(size(raw, 2), length(fields));
+for k = 1:length(fields)
+    f = fields(k);
+    nb = length(typecast(zeros(1, 1, f.type), 'uint8'));
+    b = offsets(k) + (1:nb);
+    dp(:,k) = double(typecast(reshape(raw(b,:), [], 1), f.type));
+end
+end
@@ -0,0 +1,76 @@
+function [ hdr, index ] = read_log_index( filename )
+%reads the file header and block index of a binary log (data_N.bin)
+%   if the run was not closed cleanly (no footer, and the logger never got
+%   to recover it on boot) the index is rebuilt by walking the fixed size
+%   blocks, stopping at the first one with a bad sequence number or crc.
+fid = fopen(filename, 'r', 'ieee-le');
+if fid < 0
+    error('read_log_index: cannot open %s', filename);
+end
+
+hdr.magic = fread(fid, 1, 'uint32');
+if hdr.magic ~= hex2dec('474c424e')
+    fclose(fid);
+    error('read_log_index: %s is not a nubaja log', filename);
+end
+hdr.version = fread(fid, 1, 'uint16');
+hdr.header_size = fread(fid, 1, 'uint16');
+hdr.record_size = fread(fid, 1, 'uint16');
+hdr.block_samples = fread(fid, 1, 'uint16');
+hdr.block_size = fread(fid, 1, 'uint32');
+hdr.sample_hz = fread(fid, 1, 'uint32');
+hdr.num_ch = fread(fid, 1, 'uint16');
+hdr.adc_channels = fread(fid, 1, 'uint8');   %0 in older logs
+hdr.adc_convst_us = fread(fid, 1, 'uint8');  %nth channel sampled n*adc_convst_us after time_us, 0 = unknown
+
+fseek(fid, 0, 'eof');
+file_size = ftell(fid);
+
+%footer: magic, n_blocks, index_offset
+footer = [0 0 0];
+if file_size >= hdr.header_size + 12
+    fseek(fid, -12, 'eof');
+    footer = fread(fid, 3, 'uint32');
+end
+
+if footer(1) == hex2dec('58444e49')
+    fseek(fid, footer(3), 'bof');
+    e = fread(fid, [3, footer(2)], 'uint32')';
+    index.first_idx = e(:,1);
+    index.first_time_raw = e(:,2);
+    index.offset = e(:,3);
+else
+    n_blocks = floor((file_size - hdr.header_size) / hdr.block_size);
+    index.first_idx = zeros(n_blocks, 1);
+    index.first_time_raw = zeros(n_blocks, 1);
+    index.offset = hdr.header_size + (0:n_blocks-1)' * hdr.block_size;
+    for k = 1:n_blocks
+        fseek(fid, index.offset(k), 'bof');
+        block = fread(fid, hdr.block_size, 'uint8=>uint8');
+        v = double(typecast(block(1:20), 'uint32'));
+        crc = v(3);
+        block(9:12) = 0; %crc is computed with its own field zeroed
+        if v(1) ~= hex2dec('4b4c424e') || v(2) ~= k-1 || log_crc32(block) ~= crc
+            warning('read_log_index: %s torn at block %d, keeping %d blocks', filename, k-1, k-1);
+            n_blocks = k-1;
+            break;
+        end
+        index.first_idx(k) = v(4);
+        index.first_time_raw(k) = v(5);
+    end
+    index.first_idx = index.first_idx(1:n_blocks);
+    index.first_time_raw = index.first_time_raw(1:n_blocks);
+    index.offset = index.offset(1:n_blocks);
+end
+fclose(fid);
+
+%unwrap the 32 bit microsecond timer, times in seconds from the first block
+t = index.first_time_raw;
+t = t + cumsum([0; diff(t) < 0]) * 2^32;
+index.first_time_raw = t;
+if isempty(t)
+    index.first_time = t;
+else
+    index.first_time = (t - t(1)) / 1e6;
+end
+end
@@ -0,0 +1,27 @@
+function [ s, hdr ] = read_log_summaries( filename )
+%reads only the per-block summaries of a binary log, no samples are decoded
+%   s.time is the block start in seconds, s.min / s.max / s.mean are
+%   n_blocks x 10 in channel order prim_rpm sec_rpm torque temp3 belt_temp
+%   temp2 i_brake temp1 load_cell tps (raw counts / rpm). good enough for
+%   zoomed out plots of an entire run.
+[hdr, index] = read_log_index(filename);
+n_blocks = length(index.offset);
+
+s.time = index.first_time;
+s.first_idx = index.first_idx;
+s.n_samples = zeros(n_blocks, 1);
+s.min = zeros(n_blocks, hdr.num_ch);
+s.max = zeros(n_blocks, hdr.num_ch);
+s.mean = zeros(n_blocks, hdr.num_ch);
+
+fid = fopen(filename, 'r', 'ieee-le');
+for k = 1:n_blocks
+    fseek(fid, index.offset(k), 'bof');
+    bh = read_block_header(fid, hdr);
+    s.n_samples(k) = bh.n_samples;
+    s.min(k,:) = bh.min;
+    s.max(k,:) = bh.max;
+    s.mean(k,:) = bh.mean;
+end
+fclose(fid);
+end